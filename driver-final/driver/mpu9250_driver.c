@@ -5,6 +5,125 @@
 #include <linux/of.h>
 #include <linux/uaccess.h>
 #include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/kthread.h>
+#include <linux/bitmap.h>
+#include <linux/debugfs.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
+#endif
+
+#include "mpu9250_driver.h"
+
+#define CREATE_TRACE_POINTS
+#include "mpu9250_trace.h"
+
+/*
+ * Firmas del bus i2c que cambiaron despues del kernel de la Raspberry Pi. Los kernels
+ * nuevos hacen falta para correr la suite KUnit en una VM (mpu9250_driver_kunit.c).
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+#define MSE_PROBE_ARGS			struct i2c_client *client
+#else
+#define MSE_PROBE_ARGS			struct i2c_client *client, const struct i2c_device_id *id
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+#define MSE_REMOVE_RET			void
+#define MSE_REMOVE_OK
+#else
+#define MSE_REMOVE_RET			int
+#define MSE_REMOVE_OK			0
+#endif
+
+/* Registros del MPU9250 que usa el driver */
+#define MPU9250_FIFO_EN			0x23
+#define MPU9250_FIFO_TEMP		0x80
+#define MPU9250_FIFO_GYRO		0x70
+#define MPU9250_FIFO_ACCEL		0x08
+#define MPU9250_FIFO_MAG		0x01
+#define MPU9250_USER_CTRL		0x6A
+#define MPU9250_USER_FIFO_EN		0x40
+#define MPU9250_I2C_MST_EN		0x20
+#define MPU9250_USER_FIFO_RST		0x04
+#define MPU9250_FIFO_COUNT		0x72
+#define MPU9250_FIFO_READ		0x74
+#define MPU9250_ACCEL_OUT		0x3B
+#define MPU9250_SMPDIV			0x19
+#define MPU9250_INT_PIN_CFG		0x37
+#define MPU9250_INT_ACTL		0x80
+#define MPU9250_INT_LATCH_EN		0x20
+#define MPU9250_INT_ANYRD_2CLEAR	0x10
+#define MPU9250_INT_ENABLE		0x38
+#define MPU9250_INT_DISABLE		0x00
+#define MPU9250_INT_RAW_RDY_EN		0x01
+#define MPU9250_I2C_MST_STATUS		0x36
+#define MPU9250_INT_STATUS		0x3A
+#define MPU9250_EXT_SENS_DATA_23	0x60
+#define MPU9250_PWR_MGMNT_1		0x6B
+#define MPU9250_PWR_RESET		0x80
+#define MPU9250_USER_SELF_CLEAR		0x07	/* SIG_COND_RST, I2C_MST_RST, FIFO_RST */
+
+#define MPU9250_NUM_REGS		128
+
+/* La FIFO del sensor tiene 512 bytes, entran 24 muestras completas */
+#define MPU9250_FIFO_SIZE		512
+#define MSE_BURST_FRAMES		(MPU9250_FIFO_SIZE / MSE_FRAME_SIZE)
+
+/* Cantidad de muestras que se guardan en el kernel (potencia de 2) */
+#define MSE_KFIFO_SAMPLES		1024
+
+/* Histograma de duracion de las transferencias: < 1 us, [1, 2) us, [2, 4) us ... >= 16 ms */
+#define MSE_XFER_HIST_BUCKETS		16
+
+/* Cache de registros de configuracion: evita escrituras redundantes y relecturas */
+static bool regcache = true;
+module_param(regcache, bool, 0644);
+MODULE_PARM_DESC(regcache, "Servir registros de configuracion desde memoria");
+
+/* Periodo de vaciado de la FIFO en modo streaming. A 1 kHz la FIFO se llena en 24 ms */
+static unsigned int poll_ms = 5;
+module_param(poll_ms, uint, 0644);
+MODULE_PARM_DESC(poll_ms, "Periodo de vaciado de la FIFO del sensor en ms");
+
+/* Estadisticas del bus para debugfs. Se actualizan con mse->lock tomado */
+struct mse_stats {
+	u64 transfers;
+	u64 bytes;			/* datos transferidos, sin contar la direccion del registro */
+	u64 errors;
+	u64 xfer_ns_total;
+	u64 xfer_ns_max;
+	u64 xfer_hist[MSE_XFER_HIST_BUCKETS];
+};
+
+/*
+ * Dueno del anillo de mmap(). El dispositivo tiene una referencia y cada mapeo otra, asi
+ * las paginas siguen validas si se desasocia el driver con el anillo todavia mapeado.
+ */
+struct mse_ring_map {
+	struct kref ref;
+	atomic_t users;			/* mapeos activos; mientras haya, se produce en el anillo */
+	size_t bytes;
+	struct mse_ring *ring;
+};
 
 /* Private device structure */
 struct mse_dev {
@@ -12,10 +131,55 @@ struct mse_dev {
 	struct miscdevice mse_miscdevice;
 	char name[9]; /* msedrvXX */
 
+	struct mutex lock;		/* serializa el acceso al bus y al estado */
+	bool streaming;
+	bool irq_mode;			/* muestras por data-ready en lugar de la FIFO */
+	u8 int_pin_cfg;			/* polaridad del pin INT segun el device tree */
+	DECLARE_KFIFO_PTR(samples, struct mse_sample);
+	struct delayed_work poll_work;
+	wait_queue_head_t wait;		/* lectores esperando muestras nuevas */
+
+	/* Modo "ultimo valor": adquisicion periodica propia y read() sin tocar el bus */
+	bool latest_active;
+	struct hrtimer latest_timer;
+	ktime_t latest_period;
+	struct task_struct *latest_task;
+	seqlock_t latest_lock;
+	struct mse_sample latest;
+	u32 latest_gen;			/* muestras publicadas en latest, protegido por latest_lock */
+	u8 *burst;			/* buffer de una rafaga de la FIFO del sensor */
+	u64 period_ns;			/* periodo de muestreo segun SMPLRT_DIV */
+	u64 irq_ts;			/* instante del ultimo data-ready */
+	struct mse_ring_map *ring_map;	/* anillo compartido con el usuario via mmap() */
+	struct mse_ring *ring;		/* ring_map->ring */
+	unsigned long overflows;	/* veces que se desbordo la FIFO del sensor */
+	u32 seq;			/* numero de la proxima muestra adquirida */
+	u32 dropped;			/* muestras perdidas (kfifo/anillo llenos, FIFO desbordada) */
+	u8 regs[MPU9250_NUM_REGS];	/* copia de los registros de configuracion */
+	DECLARE_BITMAP(regs_valid, MPU9250_NUM_REGS);
+	struct mse_stats stats;
+	struct dentry *debugfs;		/* /sys/kernel/debug/mseXX */
+};
+
+/* Estado de cada open() de /dev/mseXX */
+struct mse_file {
+	struct mse_dev *mse;
+	u32 latest_gen;			/* ultima muestra del modo ultimo valor que leyo este archivo */
 };
 
 /*
- * Definicion de los ID correspondientes al Device Tree. Estos deben ser informados al
+ * Definicion de los ID correspondientes al Device Tree.
+ * El pin INT del sensor es opcional y se describe con interrupts, por ejemplo:
+ *
+ *	imu@68 {
+ *		compatible = "mse,IMD";
+ *		reg = <0x68>;
+ *		interrupt-parent = <&gpio>;
+ *		interrupts = <17 IRQ_TYPE_EDGE_RISING>;
+ *	};
+ *
+ * Para probar sin hardware se puede apuntar interrupt-parent a un banco de gpio-sim
+ * y generar flancos desde /sys/devices/platform/gpio-sim.*, o usar MSE_IOC_SW_TRIGGER. Estos deben ser informados al
  * kernel mediante la macro MODULE_DEVICE_TABLE
  *
  * NOTA: Esta seccion requiere que CONFIG_OF=y en el kernel
@@ -28,80 +192,1048 @@ static const struct of_device_id mse_dt_ids[] = {
 
 MODULE_DEVICE_TABLE(of, mse_dt_ids);
 
+/*
+ * Registros que cambian solos o cuya lectura tiene efectos (INT_STATUS se limpia al leer,
+ * FIFO_R_W consume la FIFO). Nunca se guardan en la cache.
+ */
+static bool mse_reg_volatile(unsigned int reg)
+{
+	switch (reg) {
+	case MPU9250_I2C_MST_STATUS:
+	case MPU9250_INT_STATUS:
+	case MPU9250_FIFO_COUNT:
+	case MPU9250_FIFO_COUNT + 1:
+	case MPU9250_FIFO_READ:
+		return true;
+	}
+
+	/* Datos de los sensores: ACCEL_OUT .. EXT_SENS_DATA_23 */
+	if (reg >= MPU9250_ACCEL_OUT && reg <= MPU9250_EXT_SENS_DATA_23)
+		return true;
+
+	return reg >= MPU9250_NUM_REGS;
+}
+
+/* Bits de accion que el sensor borra solo despues de ejecutarlos */
+static u8 mse_reg_self_clear(unsigned int reg)
+{
+	switch (reg) {
+	case MPU9250_PWR_MGMNT_1:
+		return MPU9250_PWR_RESET;
+	case MPU9250_USER_CTRL:
+		return MPU9250_USER_SELF_CLEAR;
+	}
+	return 0;
+}
+
+static void mse_cache_drop(struct mse_dev *mse)
+{
+	bitmap_zero(mse->regs_valid, MPU9250_NUM_REGS);
+}
+
+static bool mse_cache_get(struct mse_dev *mse, unsigned int reg, u8 *val)
+{
+	if (!regcache || mse_reg_volatile(reg) || !test_bit(reg, mse->regs_valid))
+		return false;
+
+	*val = mse->regs[reg];
+	return true;
+}
+
+/* Guarda un valor leido del sensor */
+static void mse_cache_store(struct mse_dev *mse, unsigned int reg, u8 val)
+{
+	if (mse_reg_volatile(reg))
+		return;
+
+	mse->regs[reg] = val;
+	set_bit(reg, mse->regs_valid);
+}
+
+/* Actualiza la cache despues de escribir val en reg */
+static void mse_cache_write(struct mse_dev *mse, unsigned int reg, u8 val)
+{
+	/* El reset deja todos los registros en su valor por defecto */
+	if (reg == MPU9250_PWR_MGMNT_1 && (val & MPU9250_PWR_RESET)) {
+		mse_cache_drop(mse);
+		return;
+	}
+
+	mse_cache_store(mse, reg, val & ~mse_reg_self_clear(reg));
+}
+
+/* La escritura no cambiaria nada: el registro ya tiene val y no hay bits de accion */
+static bool mse_cache_hit(struct mse_dev *mse, unsigned int reg, u8 val)
+{
+	u8 cached;
+
+	if (val & mse_reg_self_clear(reg))
+		return false;
+
+	return mse_cache_get(mse, reg, &cached) && cached == val;
+}
+
+/* Inicio de una transferencia i2c: tracepoint y marca de tiempo para mse_xfer_end */
+static u64 mse_xfer_begin(struct mse_dev *mse, int op, u8 reg, u16 len)
+{
+	trace_mse_xfer_start(mse->name, op, reg, len);
+	return ktime_get_ns();
+}
+
+/* Fin de una transferencia (err es 0 o negativo): contadores de debugfs y tracepoint */
+static void mse_xfer_end(struct mse_dev *mse, int op, u8 reg, u16 len, u64 start, int err)
+{
+	struct mse_stats *stats = &mse->stats;
+	u64 ns = ktime_get_ns() - start;
+	unsigned int bucket = 0;
+
+	if (ns >= NSEC_PER_USEC)
+		bucket = min_t(unsigned int, ilog2(div_u64(ns, NSEC_PER_USEC)) + 1,
+			       MSE_XFER_HIST_BUCKETS - 1);
+
+	stats->transfers++;
+	if (err)
+		stats->errors++;
+	else
+		stats->bytes += len;
+	stats->xfer_ns_total += ns;
+	stats->xfer_ns_max = max(stats->xfer_ns_max, ns);
+	stats->xfer_hist[bucket]++;
+
+	trace_mse_xfer_done(mse->name, op, reg, len, err, ns);
+}
+
+/* Escribe un registro del MPU9250, salvo que ya tenga ese valor */
+static int mse_write_reg(struct mse_dev *mse, u8 reg, u8 val)
+{
+	u64 start;
+	int ret;
+
+	if (mse_cache_hit(mse, reg, val))
+		return 0;
+
+	start = mse_xfer_begin(mse, MSE_XFER_WRITE, reg, 1);
+	ret = i2c_smbus_write_byte_data(mse->client, reg, val);
+	mse_xfer_end(mse, MSE_XFER_WRITE, reg, 1, start, ret < 0 ? ret : 0);
+	if (ret == 0)
+		mse_cache_write(mse, reg, val);
+
+	return ret;
+}
+
+/*
+ * Lee len registros consecutivos a partir de reg en una sola transaccion (repeated start).
+ * Si todos estan en la cache no se usa el bus.
+ */
+static int mse_read_regs(struct mse_dev *mse, u8 reg, u8 *buf, u16 len)
+{
+	struct i2c_msg msgs[2] = {
+		{ .addr = mse->client->addr, .flags = 0, .len = 1, .buf = &reg },
+		{ .addr = mse->client->addr, .flags = I2C_M_RD, .len = len, .buf = buf },
+	};
+	bool cacheable = true;
+	unsigned int i;
+	u64 start;
+	int ret;
+
+	for (i = 0; i < len && cacheable; i++)
+		cacheable = !mse_reg_volatile(reg + i);
+
+	if (cacheable) {
+		for (i = 0; i < len; i++) {
+			if (!mse_cache_get(mse, reg + i, &buf[i]))
+				break;
+		}
+		if (i == len)
+			return 0;
+	}
+
+	start = mse_xfer_begin(mse, MSE_XFER_READ, reg, len);
+	ret = i2c_transfer(mse->client->adapter, msgs, ARRAY_SIZE(msgs));
+	if (ret >= 0)
+		ret = (ret == ARRAY_SIZE(msgs)) ? 0 : -EIO;
+	mse_xfer_end(mse, MSE_XFER_READ, reg, len, start, ret);
+	if (ret < 0)
+		return ret;
+
+	/* Una rafaga que empieza en un registro volatil (FIFO_R_W) no recorre direcciones */
+	if (cacheable) {
+		for (i = 0; i < len; i++)
+			mse_cache_store(mse, reg + i, buf[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * Arma el registro que ve el usuario a partir del bloque de 21 bytes del sensor
+ * (accel, temp y gyro big endian, magnetometro little endian seguido de ST2).
+ * Debe llamarse con mse->lock tomado: consume un numero de secuencia.
+ */
+static void mse_build_sample(struct mse_dev *mse, const struct mse_frame *frame, u64 ts,
+			     struct mse_sample *sample)
+{
+	const u8 *d = frame->data;
+	int i;
+
+	sample->timestamp_ns = ts;
+	sample->seq = mse->seq++;
+	sample->dropped = mse->dropped;
+	for (i = 0; i < 3; i++) {
+		sample->accel[i] = (s16)get_unaligned_be16(&d[2 * i]);
+		sample->gyro[i] = (s16)get_unaligned_be16(&d[8 + 2 * i]);
+		sample->mag[i] = (s16)get_unaligned_le16(&d[14 + 2 * i]);
+	}
+	sample->temp = (s16)get_unaligned_be16(&d[6]);
+	sample->mag_st2 = d[20];
+	memset(sample->reserved, 0, sizeof(sample->reserved));
+}
+
+/*
+ * Entrega una muestra al consumidor: al anillo si esta mapeado, si no a la kfifo que
+ * lee read(). En el anillo se descarta la muestra nueva si esta lleno, porque tail es
+ * del usuario. El hueco queda a la vista en seq.
+ */
+static void mse_push_frame(struct mse_dev *mse, const struct mse_frame *frame, u64 ts)
+{
+	struct mse_ring *ring = mse->ring;
+	struct mse_sample sample;
+	u32 head;
+
+	if (atomic_read(&mse->ring_map->users) > 0) {
+		head = ring->head;
+		if (head - READ_ONCE(ring->tail) >= ring->size) {
+			mse->dropped++;
+			trace_mse_sample_drop(mse->name, MSE_DROP_RING, mse->seq, mse->dropped);
+			mse->seq++;
+			WRITE_ONCE(ring->dropped, mse->dropped);
+			return;
+		}
+		mse_build_sample(mse, frame, ts, &ring->samples[head & (ring->size - 1)]);
+		smp_store_release(&ring->head, head + 1);
+		return;
+	}
+
+	if (kfifo_is_full(&mse->samples)) {
+		kfifo_skip(&mse->samples);
+		mse->dropped++;
+		trace_mse_sample_drop(mse->name, MSE_DROP_KFIFO, mse->seq, mse->dropped);
+	}
+	mse_build_sample(mse, frame, ts, &sample);
+	kfifo_put(&mse->samples, sample);
+}
+
+/*
+ * Vacia la FIFO del sensor hacia la kfifo del dispositivo. Se lee FIFO_COUNT y luego
+ * todas las muestras completas en una unica rafaga. Debe llamarse con mse->lock tomado.
+ * Devuelve la cantidad de muestras leidas o un error negativo.
+ */
+static int mse_fifo_drain(struct mse_dev *mse)
+{
+	u8 count[2];
+	unsigned int bytes, n, i;
+	u64 now;
+	int ret;
+
+	ret = mse_read_regs(mse, MPU9250_FIFO_COUNT, count, sizeof(count));
+	if (ret < 0)
+		return ret;
+
+	bytes = ((count[0] & 0x1F) << 8) | count[1];
+
+	/* Si la FIFO se lleno las muestras quedan desalineadas, hay que reiniciarla */
+	if (bytes >= MPU9250_FIFO_SIZE) {
+		mse->overflows++;
+		/* Se pierde al menos el contenido de la FIFO */
+		mse->seq += MSE_BURST_FRAMES;
+		mse->dropped += MSE_BURST_FRAMES;
+		trace_mse_fifo_overflow(mse->name, mse->overflows, mse->dropped);
+		ret = mse_write_reg(mse, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN |
+				    MPU9250_USER_FIFO_EN | MPU9250_USER_FIFO_RST);
+		return ret < 0 ? ret : 0;
+	}
+
+	n = min_t(unsigned int, bytes / MSE_FRAME_SIZE, MSE_BURST_FRAMES);
+	trace_mse_fifo_drain(mse->name, bytes, n);
+	if (n == 0)
+		return 0;
+
+	ret = mse_read_regs(mse, MPU9250_FIFO_READ, mse->burst, n * MSE_FRAME_SIZE);
+	if (ret < 0)
+		return ret;
+
+	/* La ultima muestra de la rafaga es la de ahora, las anteriores van un periodo atras */
+	now = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		const struct mse_frame *frame = (const struct mse_frame *)&mse->burst[i * MSE_FRAME_SIZE];
+
+		mse_push_frame(mse, frame, now - (n - 1 - i) * mse->period_ns);
+	}
+	wake_up_interruptible(&mse->wait);
+
+	return n;
+}
+
+/* Lee la muestra recien convertida (ACCEL_OUT..EXT_SENS_DATA_06) y la encola */
+static int mse_fetch_sample(struct mse_dev *mse)
+{
+	struct mse_frame frame;
+	int ret;
+
+	ret = mse_read_regs(mse, MPU9250_ACCEL_OUT, frame.data, MSE_FRAME_SIZE);
+	if (ret < 0)
+		return ret;
+
+	mse_push_frame(mse, &frame, mse->irq_ts);
+	wake_up_interruptible(&mse->wait);
+
+	return 1;
+}
+
+/* Handler en contexto de interrupcion: solo toma la marca de tiempo */
+static irqreturn_t mse_irq_handler(int irq, void *data)
+{
+	struct mse_dev *mse = data;
+
+	mse->irq_ts = ktime_get_ns();
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * Handler en contexto de hilo del data-ready. Tambien lo invoca MSE_IOC_SW_TRIGGER,
+ * por eso en modo FIFO vacia la FIFO en lugar de leer una sola muestra.
+ */
+static irqreturn_t mse_irq_thread(int irq, void *data)
+{
+	struct mse_dev *mse = data;
+	int ret;
+
+	mutex_lock(&mse->lock);
+	if (mse->streaming) {
+		ret = mse->irq_mode ? mse_fetch_sample(mse) : mse_fifo_drain(mse);
+		if (ret < 0)
+			dev_warn_ratelimited(&mse->client->dev, "Error leyendo la muestra = %d\n", ret);
+	}
+	mutex_unlock(&mse->lock);
+
+	return IRQ_HANDLED;
+}
+
+static void mse_poll_work(struct work_struct *work)
+{
+	struct mse_dev *mse = container_of(to_delayed_work(work), struct mse_dev, poll_work);
+	int ret;
+
+	mutex_lock(&mse->lock);
+	if (!mse->streaming) {
+		mutex_unlock(&mse->lock);
+		return;
+	}
+	ret = mse_fifo_drain(mse);
+	if (ret < 0)
+		dev_warn_ratelimited(&mse->client->dev, "Error leyendo la FIFO = %d\n", ret);
+	mutex_unlock(&mse->lock);
+
+	schedule_delayed_work(&mse->poll_work, msecs_to_jiffies(poll_ms));
+}
+
+/* Con el DLPF habilitado la tasa interna es 1 kHz y se divide por SMPLRT_DIV + 1 */
+static int mse_update_period(struct mse_dev *mse)
+{
+	u8 div;
+	int ret;
+
+	ret = mse_read_regs(mse, MPU9250_SMPDIV, &div, 1);
+	if (ret)
+		return ret;
+
+	mse->period_ns = (u64)(div + 1) * NSEC_PER_MSEC;
+	return 0;
+}
+
+/*
+ * Inicia el modo streaming. Si el device tree describe el pin INT cada data-ready dispara
+ * la lectura de una muestra; si no, se configura la FIFO del sensor para guardar accel,
+ * temp, gyro y los 7 bytes del AK8963 y se vacia periodicamente.
+ */
+static int mse_stream_start(struct mse_dev *mse)
+{
+	int ret;
+
+	mutex_lock(&mse->lock);
+	if (mse->streaming || mse->latest_active) {
+		mutex_unlock(&mse->lock);
+		return mse->streaming ? 0 : -EBUSY;
+	}
+
+	ret = mse_update_period(mse);
+	if (ret) {
+		mutex_unlock(&mse->lock);
+		return ret;
+	}
+
+	if (mse->irq_mode) {
+		kfifo_reset(&mse->samples);
+		mse->streaming = true;
+		ret = mse_write_reg(mse, MPU9250_INT_PIN_CFG, mse->int_pin_cfg);
+		if (!ret)
+			ret = mse_write_reg(mse, MPU9250_INT_ENABLE, MPU9250_INT_RAW_RDY_EN);
+		if (ret)
+			mse->streaming = false;
+		mutex_unlock(&mse->lock);
+		return ret;
+	}
+
+	ret = mse_write_reg(mse, MPU9250_FIFO_EN, 0);
+	if (!ret)
+		ret = mse_write_reg(mse, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN | MPU9250_USER_FIFO_RST);
+	if (!ret)
+		ret = mse_write_reg(mse, MPU9250_FIFO_EN, MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO |
+				    MPU9250_FIFO_ACCEL | MPU9250_FIFO_MAG);
+	if (!ret)
+		ret = mse_write_reg(mse, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN | MPU9250_USER_FIFO_EN);
+	if (ret) {
+		mutex_unlock(&mse->lock);
+		return ret;
+	}
+
+	kfifo_reset(&mse->samples);
+	mse->streaming = true;
+	mutex_unlock(&mse->lock);
+
+	schedule_delayed_work(&mse->poll_work, msecs_to_jiffies(poll_ms));
+	return 0;
+}
+
+static int mse_stream_stop(struct mse_dev *mse)
+{
+	int ret;
+
+	mutex_lock(&mse->lock);
+	mse->streaming = false;
+	mutex_unlock(&mse->lock);
+	wake_up_interruptible(&mse->wait);
+
+	if (mse->irq_mode) {
+		mutex_lock(&mse->lock);
+		ret = mse_write_reg(mse, MPU9250_INT_ENABLE, MPU9250_INT_DISABLE);
+		mutex_unlock(&mse->lock);
+		synchronize_irq(mse->client->irq);
+		return ret;
+	}
+
+	cancel_delayed_work_sync(&mse->poll_work);
+
+	mutex_lock(&mse->lock);
+	ret = mse_write_reg(mse, MPU9250_FIFO_EN, 0);
+	if (!ret)
+		ret = mse_write_reg(mse, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN);
+	mutex_unlock(&mse->lock);
+
+	return ret;
+}
+
+
+/* El hrtimer solo despierta al hilo de adquisicion, el I2C no se puede usar aca */
+static enum hrtimer_restart mse_latest_timer(struct hrtimer *timer)
+{
+	struct mse_dev *mse = container_of(timer, struct mse_dev, latest_timer);
+
+	wake_up_process(mse->latest_task);
+	hrtimer_forward_now(timer, mse->latest_period);
+
+	return HRTIMER_RESTART;
+}
+
+/* Hilo de adquisicion del modo ultimo valor: una lectura de 21 bytes por tick */
+static int mse_latest_thread(void *data)
+{
+	struct mse_dev *mse = data;
+	struct mse_frame frame;
+	struct mse_sample sample;
+	u64 ts;
+	int ret;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			break;
+		}
+		schedule();
+
+		ts = ktime_get_ns();
+		mutex_lock(&mse->lock);
+		ret = mse_read_regs(mse, MPU9250_ACCEL_OUT, frame.data, MSE_FRAME_SIZE);
+		if (ret == 0)
+			mse_build_sample(mse, &frame, ts, &sample);
+		mutex_unlock(&mse->lock);
+		if (ret < 0) {
+			dev_warn_ratelimited(&mse->client->dev, "Error leyendo la muestra = %d\n", ret);
+			continue;
+		}
+
+		write_seqlock(&mse->latest_lock);
+		mse->latest = sample;
+		mse->latest_gen++;
+		write_sequnlock(&mse->latest_lock);
+
+		wake_up_interruptible(&mse->wait);
+	}
+
+	return 0;
+}
+
+/* Inicia el modo ultimo valor con periodo period_us, o el del sensor si es 0 */
+static int mse_latest_start(struct mse_dev *mse, u32 period_us)
+{
+	struct task_struct *task;
+	int ret;
+
+	mutex_lock(&mse->lock);
+	if (mse->streaming || mse->latest_active) {
+		mutex_unlock(&mse->lock);
+		return -EBUSY;
+	}
+
+	ret = mse_update_period(mse);
+	if (ret) {
+		mutex_unlock(&mse->lock);
+		return ret;
+	}
+	mse->latest_period = period_us ? us_to_ktime(period_us) : ns_to_ktime(mse->period_ns);
+	memset(&mse->latest, 0, sizeof(mse->latest));
+
+	task = kthread_create(mse_latest_thread, mse, "%s-latest", mse->name);
+	if (IS_ERR(task)) {
+		mutex_unlock(&mse->lock);
+		return PTR_ERR(task);
+	}
+	/* La lectura debe ocurrir cuanto antes despues del tick */
+	sched_set_fifo(task);
+	mse->latest_task = task;
+	mse->latest_active = true;
+	mutex_unlock(&mse->lock);
+
+	wake_up_process(task);
+	hrtimer_start(&mse->latest_timer, mse->latest_period, HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static int mse_latest_stop(struct mse_dev *mse)
+{
+	mutex_lock(&mse->lock);
+	if (!mse->latest_active) {
+		mutex_unlock(&mse->lock);
+		return 0;
+	}
+	mse->latest_active = false;
+	mutex_unlock(&mse->lock);
+
+	hrtimer_cancel(&mse->latest_timer);
+	kthread_stop(mse->latest_task);
+	mse->latest_task = NULL;
+	/* Los que esperan en poll() vuelven a modo directo, que siempre es legible */
+	wake_up_interruptible(&mse->wait);
+
+	return 0;
+}
+
+static struct mse_dev *mse_file_dev(struct file *file)
+{
+	struct mse_file *mf = file->private_data;
+
+	return mf->mse;
+}
+
+/* Copia la muestra mas reciente sin tomar mse->lock ni usar el bus */
+static ssize_t mse_read_latest(struct mse_file *mf, char __user *userbuf, size_t count)
+{
+	struct mse_dev *mse = mf->mse;
+	struct mse_sample sample;
+	unsigned int seq;
+	u32 gen;
+
+	if (count < sizeof(sample))
+		return -EINVAL;
+
+	do {
+		seq = read_seqbegin(&mse->latest_lock);
+		sample = mse->latest;
+		gen = mse->latest_gen;
+	} while (read_seqretry(&mse->latest_lock, seq));
+
+	if (copy_to_user(userbuf, &sample, sizeof(sample)))
+		return -EFAULT;
+
+	/* poll() vuelve a informar legible recien con la proxima muestra */
+	mf->latest_gen = gen;
+
+	return sizeof(sample);
+}
+
+/* Hay muestras para el consumidor, en el anillo si esta mapeado o en la kfifo */
+static bool mse_data_ready(struct mse_dev *mse)
+{
+	if (atomic_read(&mse->ring_map->users) > 0)
+		return READ_ONCE(mse->ring->head) != READ_ONCE(mse->ring->tail);
+
+	return !kfifo_is_empty(&mse->samples);
+}
 
 /* User is reading data from /dev/msedrvXX */
 static ssize_t mse_read(struct file *file, char __user *userbuf, size_t count, loff_t *ppos)  {
 
 	struct mse_dev *mse;
-	char buffer[21] = {0};
+	char buffer[MSE_FRAME_SIZE] = {0};
+	unsigned int copied;
+	u64 start;
 	int ret = 0;
 	
-	mse = container_of(file->private_data, struct mse_dev, mse_miscdevice);
-		
-	/* Aqui ira las llamadas a i2c_transfer() que correspondan pasando
-	 * como dispositiivo mse->client
-	 *
-	*/	
-	ret = i2c_master_recv(mse->client, buffer, count);
+	mse = mse_file_dev(file);
 
-	if (IS_ERR(&ret)) {
-		pr_info("Error reading data for i2c = %d", ret);
-		return ret;
+	if (READ_ONCE(mse->latest_active))
+		return mse_read_latest(file->private_data, userbuf, count);
+
+	mutex_lock(&mse->lock);
+
+	/* En modo streaming se devuelven todos los registros struct mse_sample que entren en userbuf */
+	if (mse->streaming) {
+		if (count < sizeof(struct mse_sample)) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		while (kfifo_is_empty(&mse->samples)) {
+			/* Si no hay nada en el kernel se vacia la FIFO del sensor en el momento */
+			if (!mse->irq_mode) {
+				ret = mse_fifo_drain(mse);
+				if (ret < 0)
+					goto out;
+				if (ret > 0)
+					break;
+			}
+
+			if (file->f_flags & O_NONBLOCK) {
+				ret = -EAGAIN;
+				goto out;
+			}
+
+			/* Se bloquea hasta la proxima rafaga o data-ready */
+			mutex_unlock(&mse->lock);
+			ret = wait_event_interruptible(mse->wait, !kfifo_is_empty(&mse->samples) ||
+						       !mse->streaming);
+			if (ret)
+				return ret;
+			mutex_lock(&mse->lock);
+
+			if (!mse->streaming) {
+				ret = -EAGAIN;
+				goto out;
+			}
+		}
+
+		ret = kfifo_to_user(&mse->samples, userbuf, count, &copied);
+		if (ret == 0)
+			ret = copied;
+		goto out;
 	}
 
-	ret = copy_to_user(userbuf, buffer, count);
+	if (count > sizeof(buffer))
+		count = sizeof(buffer);
 
-        if (IS_ERR(&ret)) {
-                pr_info("Error with copy_to_user with error = %d", ret);
-                return ret;
-        }
+	start = mse_xfer_begin(mse, MSE_XFER_RECV, 0, count);
+	ret = i2c_master_recv(mse->client, buffer, count);
+	mse_xfer_end(mse, MSE_XFER_RECV, 0, count, start, ret < 0 ? ret : 0);
+	if (ret < 0)
+		goto out;
 
-	pr_info("mse_read() fue invocada.");
-	return 0;
+	if (copy_to_user(userbuf, buffer, ret))
+		ret = -EFAULT;
+out:
+	mutex_unlock(&mse->lock);
+	return ret;
 
 }
 
 static ssize_t mse_write(struct file *file, const char __user *buffer, size_t len, loff_t *offset)  {
 	
 	struct mse_dev *mse;
-	char kernel_buf[21] = {0};
+	char kernel_buf[MSE_FRAME_SIZE] = {0};
+	u64 start;
 	int ret = 0;
 	
-	mse = container_of(file->private_data, struct mse_dev, mse_miscdevice);
-		
-	/* Aqui ira las llamadas a i2c_transfer() que correspondan pasando
-	 * como dispositivo mse->client
-	 *
-	*/	
-	ret = copy_from_user(kernel_buf, buffer, len);
-
-	if (IS_ERR(&ret)) {
-		pr_info("Error with copy_from_user with error = %d", ret);
+	mse = mse_file_dev(file);
+
+	if (len > sizeof(kernel_buf))
+		return -EINVAL;
+
+	if (copy_from_user(kernel_buf, buffer, len))
+		return -EFAULT;
+
+	mutex_lock(&mse->lock);
+	start = mse_xfer_begin(mse, MSE_XFER_SEND, kernel_buf[0], len);
+	ret = i2c_master_send(mse->client, kernel_buf, len);
+	mse_xfer_end(mse, MSE_XFER_SEND, kernel_buf[0], len, start, ret < 0 ? ret : 0);
+	/* Escritura cruda: no se sabe que registros cambiaron */
+	if (len > 1)
+		mse_cache_drop(mse);
+	mutex_unlock(&mse->lock);
+	
+	if (ret < 0)
 		return ret;
+
+	return 0;
+}
+
+/* MSE_IOC_READ_REGS: escritura del registro y lectura en una sola transaccion */
+static long mse_ioctl_read_regs(struct mse_dev *mse, void __user *argp)
+{
+	struct mse_reg_xfer xfer;
+	u8 small[MSE_FRAME_SIZE];
+	u8 *buf = small;
+	int ret;
+
+	if (copy_from_user(&xfer, argp, sizeof(xfer)))
+		return -EFAULT;
+
+	if (xfer.len == 0 || xfer.len > MSE_REG_XFER_MAX)
+		return -EINVAL;
+
+	if (xfer.len > sizeof(small)) {
+		buf = kmalloc(xfer.len, GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
 	}
 
-	ret = i2c_master_send(mse->client, kernel_buf, len);	
-	
-	if (IS_ERR(&ret)) {
-                pr_info("Error sending data for i2c = %d", ret);
-                return ret;
+	mutex_lock(&mse->lock);
+	ret = mse_read_regs(mse, xfer.reg, buf, xfer.len);
+	mutex_unlock(&mse->lock);
+
+	if (!ret && copy_to_user(u64_to_user_ptr(xfer.buf), buf, xfer.len))
+		ret = -EFAULT;
+
+	if (buf != small)
+		kfree(buf);
+
+	return ret;
+}
+
+/* Ejecuta una operacion de la secuencia. Se llama con el segmento del bus tomado */
+static int mse_batch_op(struct mse_dev *mse, const struct mse_reg_op *op)
+{
+	struct i2c_client *client = mse->client;
+	u8 buf[2] = { op->reg, op->val };
+	u8 readback;
+	struct i2c_msg write = { .addr = client->addr, .flags = 0, .len = 2, .buf = buf };
+	struct i2c_msg read[2] = {
+		{ .addr = client->addr, .flags = 0, .len = 1, .buf = buf },
+		{ .addr = client->addr, .flags = I2C_M_RD, .len = 1, .buf = &readback },
+	};
+	bool check = op->flags & (MSE_REG_OP_VERIFY | MSE_REG_OP_EXPECT);
+	bool hit;
+	u64 start;
+	int ret;
+
+	if (op->flags & MSE_REG_OP_EXPECT) {
+		hit = mse_cache_get(mse, op->reg, &readback);
+	} else {
+		/* Si el registro ya tiene ese valor no se escribe ni se relee */
+		hit = mse_cache_hit(mse, op->reg, op->val);
+		readback = op->val;
+		if (!hit) {
+			start = mse_xfer_begin(mse, MSE_XFER_WRITE, op->reg, 1);
+			ret = __i2c_transfer(client->adapter, &write, 1);
+			if (ret >= 0)
+				ret = (ret == 1) ? 0 : -EIO;
+			mse_xfer_end(mse, MSE_XFER_WRITE, op->reg, 1, start, ret);
+			if (ret < 0)
+				return ret;
+			mse_cache_write(mse, op->reg, op->val);
+		}
 	}
 
-	pr_info("mse_write() fue invocada.");
+	if (check && !hit) {
+		start = mse_xfer_begin(mse, MSE_XFER_READ, op->reg, 1);
+		ret = __i2c_transfer(client->adapter, read, ARRAY_SIZE(read));
+		if (ret >= 0)
+			ret = (ret == ARRAY_SIZE(read)) ? 0 : -EIO;
+		mse_xfer_end(mse, MSE_XFER_READ, op->reg, 1, start, ret);
+		if (ret < 0)
+			return ret;
+		mse_cache_store(mse, op->reg, readback);
+	}
+
+	if (check && ((readback ^ op->val) & op->mask))
+		return -EIO;
+
+	if (op->delay_us)
+		usleep_range(op->delay_us, op->delay_us + op->delay_us / 8 + 10);
+
 	return 0;
 }
 
+/* MSE_IOC_WRITE_BATCH: toda la secuencia de configuracion en un solo syscall y lock del bus */
+static long mse_ioctl_write_batch(struct mse_dev *mse, void __user *argp)
+{
+	struct mse_reg_batch batch;
+	struct mse_reg_op *ops;
+	u32 i;
+	int ret = 0;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.count == 0 || batch.count > MSE_REG_BATCH_MAX)
+		return -EINVAL;
+
+	ops = memdup_user(u64_to_user_ptr(batch.ops), batch.count * sizeof(*ops));
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	for (i = 0; i < batch.count; i++) {
+		if (ops[i].delay_us > MSE_REG_OP_DELAY_MAX) {
+			kfree(ops);
+			return -EINVAL;
+		}
+	}
+
+	mutex_lock(&mse->lock);
+	i2c_lock_bus(mse->client->adapter, I2C_LOCK_SEGMENT);
+	for (i = 0; i < batch.count; i++) {
+		ret = mse_batch_op(mse, &ops[i]);
+		if (ret)
+			break;
+	}
+	i2c_unlock_bus(mse->client->adapter, I2C_LOCK_SEGMENT);
+	mutex_unlock(&mse->lock);
+
+	kfree(ops);
+
+	batch.done = i;
+	if (copy_to_user(argp, &batch, sizeof(batch)))
+		return -EFAULT;
+
+	return ret;
+}
+
 static long mse_ioctl(struct file *file, unsigned int cmd, unsigned long arg)  {
 	struct mse_dev *mse;
 	
-	mse = container_of(file->private_data, struct mse_dev, mse_miscdevice);
-		
-	/* Aqui ira las llamadas a i2c_transfer() que correspondan pasando
-	 * como dispositivo mse->client
-	 *
-	*/
-	
+	mse = mse_file_dev(file);
+
+	switch (cmd) {
+	case MSE_IOC_STREAM_START:
+		return mse_stream_start(mse);
+	case MSE_IOC_STREAM_STOP:
+		return mse_stream_stop(mse);
+	case MSE_IOC_SW_TRIGGER:
+		mse_irq_handler(0, mse);
+		mse_irq_thread(0, mse);
+		return 0;
+	case MSE_IOC_READ_REGS:
+		return mse_ioctl_read_regs(mse, (void __user *)arg);
+	case MSE_IOC_WRITE_BATCH:
+		return mse_ioctl_write_batch(mse, (void __user *)arg);
+	case MSE_IOC_LATEST_START:
+		return mse_latest_start(mse, (u32)arg);
+	case MSE_IOC_LATEST_STOP:
+		return mse_latest_stop(mse);
+	case MSE_IOC_REGCACHE_DROP:
+		mutex_lock(&mse->lock);
+		mse_cache_drop(mse);
+		mutex_unlock(&mse->lock);
+		return 0;
+	}
+
 	pr_info("my_dev_ioctl() fue invocada. cmd = %d, arg = %ld\n", cmd, arg);
+	return -ENOTTY;
+}
+
+/*
+ * poll/select/epoll: legible cuando hay muestras nuevas en la kfifo o en el anillo, o en
+ * modo ultimo valor cuando se publico una muestra que este archivo todavia no leyo
+ */
+static __poll_t mse_poll(struct file *file, poll_table *wait)
+{
+	struct mse_file *mf = file->private_data;
+	struct mse_dev *mse = mf->mse;
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+	bool readable;
+
+	poll_wait(file, &mse->wait, wait);
+
+	if (READ_ONCE(mse->latest_active))
+		readable = READ_ONCE(mse->latest_gen) != READ_ONCE(mf->latest_gen);
+	else
+		/* En modo directo read() nunca espera */
+		readable = !READ_ONCE(mse->streaming) || mse_data_ready(mse);
+
+	if (readable)
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	return mask;
+}
+
+static struct mse_ring_map *mse_ring_alloc(void)
+{
+	struct mse_ring_map *map;
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return NULL;
+
+	map->bytes = PAGE_ALIGN(struct_size(map->ring, samples, MSE_RING_SAMPLES));
+	map->ring = vmalloc_user(map->bytes);
+	if (!map->ring) {
+		kfree(map);
+		return NULL;
+	}
+	map->ring->version = MSE_RING_VERSION;
+	map->ring->size = MSE_RING_SAMPLES;
+	map->ring->sample_size = sizeof(struct mse_sample);
+	kref_init(&map->ref);
+	atomic_set(&map->users, 0);
+
+	return map;
+}
+
+static void mse_ring_release(struct kref *ref)
+{
+	struct mse_ring_map *map = container_of(ref, struct mse_ring_map, ref);
+
+	vfree(map->ring);
+	kfree(map);
+}
+
+static void mse_ring_put(struct mse_ring_map *map)
+{
+	kref_put(&map->ref, mse_ring_release);
+}
+
+/* Los mapeos no apuntan a mse_dev, que se libera en mse_remove */
+static void mse_vm_open(struct vm_area_struct *vma)
+{
+	struct mse_ring_map *map = vma->vm_private_data;
+
+	kref_get(&map->ref);
+	atomic_inc(&map->users);
+}
+
+static void mse_vm_close(struct vm_area_struct *vma)
+{
+	struct mse_ring_map *map = vma->vm_private_data;
+
+	atomic_dec(&map->users);
+	mse_ring_put(map);
+}
+
+static const struct vm_operations_struct mse_vm_ops = {
+	.open = mse_vm_open,
+	.close = mse_vm_close,
+};
+
+/* Mapea el anillo de muestras en el espacio del usuario, sin copias ni syscalls por muestra */
+static int mse_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct mse_dev *mse;
+	int ret;
+
+	mse = mse_file_dev(file);
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > mse->ring_map->bytes)
+		return -EINVAL;
+
+	ret = remap_vmalloc_range(vma, mse->ring, 0);
+	if (ret)
+		return ret;
+
+	vma->vm_private_data = mse->ring_map;
+	vma->vm_ops = &mse_vm_ops;
+	mse_vm_open(vma);
+
+	return 0;
+}
+
+/*
+ * debugfs: /sys/kernel/debug/mseXX/stats con los contadores y xfer_latency con el
+ * histograma de duracion de las transferencias (limite inferior y superior en us, cantidad).
+ * Se copian con mse->lock tomado para que cada lectura sea consistente.
+ */
+static int mse_stats_show(struct seq_file *s, void *unused)
+{
+	struct mse_dev *mse = s->private;
+	struct mse_stats stats;
+	unsigned long overflows;
+	u32 seq, dropped;
+
+	mutex_lock(&mse->lock);
+	stats = mse->stats;
+	overflows = mse->overflows;
+	seq = mse->seq;
+	dropped = mse->dropped;
+	mutex_unlock(&mse->lock);
+
+	seq_printf(s, "transfers: %llu\n", stats.transfers);
+	seq_printf(s, "bytes: %llu\n", stats.bytes);
+	seq_printf(s, "errors: %llu\n", stats.errors);
+	seq_printf(s, "xfer_ns_mean: %llu\n", stats.transfers ? div64_u64(stats.xfer_ns_total, stats.transfers) : 0);
+	seq_printf(s, "xfer_ns_max: %llu\n", stats.xfer_ns_max);
+	seq_printf(s, "samples: %u\n", seq);
+	seq_printf(s, "fifo_overflows: %lu\n", overflows);
+	seq_printf(s, "dropped: %u\n", dropped);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mse_stats);
+
+static int mse_xfer_latency_show(struct seq_file *s, void *unused)
+{
+	struct mse_dev *mse = s->private;
+	u64 hist[MSE_XFER_HIST_BUCKETS];
+	unsigned int i;
+
+	mutex_lock(&mse->lock);
+	memcpy(hist, mse->stats.xfer_hist, sizeof(hist));
+	mutex_unlock(&mse->lock);
+
+	for (i = 0; i < MSE_XFER_HIST_BUCKETS - 1; i++)
+		seq_printf(s, "%u %u %llu\n", i ? 1U << (i - 1) : 0, 1U << i, hist[i]);
+	seq_printf(s, "%u inf %llu\n", 1U << (i - 1), hist[i]);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mse_xfer_latency);
+
+static void mse_debugfs_init(struct mse_dev *mse)
+{
+	/* debugfs es opcional, los errores no impiden usar el dispositivo */
+	mse->debugfs = debugfs_create_dir(mse->name, NULL);
+	debugfs_create_file("stats", 0444, mse->debugfs, mse, &mse_stats_fops);
+	debugfs_create_file("xfer_latency", 0444, mse->debugfs, mse, &mse_xfer_latency_fops);
+}
+
+/* misc_open deja la miscdevice en private_data, se reemplaza por el estado del archivo */
+static int mse_open(struct inode *inode, struct file *file)
+{
+	struct mse_dev *mse = container_of(file->private_data, struct mse_dev, mse_miscdevice);
+	struct mse_file *mf;
+
+	mf = kzalloc(sizeof(*mf), GFP_KERNEL);
+	if (!mf)
+		return -ENOMEM;
+
+	mf->mse = mse;
+	mf->latest_gen = READ_ONCE(mse->latest_gen);
+	file->private_data = mf;
+
+	return 0;
+}
+
+static int mse_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
 	return 0;
 }
 
@@ -109,19 +1241,70 @@ static long mse_ioctl(struct file *file, unsigned int cmd, unsigned long arg)  {
 
 static const struct file_operations mse_fops = {
 	.owner = THIS_MODULE,
+	.open = mse_open,
+	.release = mse_release,
 	.read = mse_read,
 	.write = mse_write,
 	.unlocked_ioctl = mse_ioctl,
+	.mmap = mse_mmap,
+	.poll = mse_poll,
 };
 
 /*--------------------------------------------------------------------------------*/
-static int mse_probe(struct i2c_client *client, const struct i2c_device_id *id)  {
+static int mse_probe(MSE_PROBE_ARGS)  {
 	struct mse_dev * mse;
 	static int counter = 0;
 	int ret_val;
 	
 	/* Allocate new private structure */
 	mse = devm_kzalloc(&client->dev, sizeof(struct mse_dev), GFP_KERNEL);
+	if (!mse)
+		return -ENOMEM;
+
+	mse->burst = devm_kmalloc(&client->dev, MSE_BURST_FRAMES * MSE_FRAME_SIZE, GFP_KERNEL);
+	if (!mse->burst)
+		return -ENOMEM;
+
+	mse->ring_map = mse_ring_alloc();
+	if (!mse->ring_map)
+		return -ENOMEM;
+	mse->ring = mse->ring_map->ring;
+
+	ret_val = kfifo_alloc(&mse->samples, MSE_KFIFO_SAMPLES, GFP_KERNEL);
+	if (ret_val) {
+		mse_ring_put(mse->ring_map);
+		return ret_val;
+	}
+
+	mutex_init(&mse->lock);
+	INIT_DELAYED_WORK(&mse->poll_work, mse_poll_work);
+	init_waitqueue_head(&mse->wait);
+	seqlock_init(&mse->latest_lock);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&mse->latest_timer, mse_latest_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&mse->latest_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	mse->latest_timer.function = mse_latest_timer;
+#endif
+
+	/* Linea de interrupcion opcional del device tree (pin INT del sensor) */
+	if (client->irq > 0) {
+		unsigned int type = irq_get_trigger_type(client->irq);
+
+		mse->int_pin_cfg = MPU9250_INT_LATCH_EN | MPU9250_INT_ANYRD_2CLEAR;
+		if (type & (IRQ_TYPE_LEVEL_LOW | IRQ_TYPE_EDGE_FALLING))
+			mse->int_pin_cfg |= MPU9250_INT_ACTL;
+
+		ret_val = request_threaded_irq(client->irq, mse_irq_handler, mse_irq_thread,
+					       IRQF_ONESHOT, dev_name(&client->dev), mse);
+		if (ret_val) {
+			dev_err(&client->dev, "No se pudo pedir la irq %d\n", client->irq);
+			kfifo_free(&mse->samples);
+			mse_ring_put(mse->ring_map);
+			return ret_val;
+		}
+		mse->irq_mode = true;
+	}
 	
 	/* Store pointer to the device-structure in bus device context */
 	i2c_set_clientdata(client,mse);
@@ -140,32 +1323,58 @@ static int mse_probe(struct i2c_client *client, const struct i2c_device_id *id)
 	ret_val = misc_register(&mse->mse_miscdevice);
 	if (ret_val != 0) {
 		pr_err("No se pudo registrar el dispositivo %s\n", mse->mse_miscdevice.name);
+		if (mse->irq_mode)
+			free_irq(client->irq, mse);
+		kfifo_free(&mse->samples);
+		mse_ring_put(mse->ring_map);
 		return ret_val;
 	}
 	
+	mse_debugfs_init(mse);
+
 	pr_info("Dispositivo %s: minor asignado: %i\n", mse->mse_miscdevice.name, mse->mse_miscdevice.minor);
 
 	return 0;
 }
 
-static int mse_remove(struct i2c_client * client)  {
+static MSE_REMOVE_RET mse_remove(struct i2c_client * client)  {
 	struct mse_dev * mse;
 
 	/* Get device structure from bus device context */
 	mse = i2c_get_clientdata(client);
 
+	debugfs_remove_recursive(mse->debugfs);
+
 	/* Deregister misc device */
 	misc_deregister(&mse->mse_miscdevice);
 
-	return 0;
+	if (mse->streaming)
+		mse_stream_stop(mse);
+	mse_latest_stop(mse);
+	if (mse->irq_mode)
+		free_irq(client->irq, mse);
+	kfifo_free(&mse->samples);
+	/* Si queda un mapeo el anillo se libera en su munmap */
+	mse_ring_put(mse->ring_map);
+
+	return MSE_REMOVE_OK;
 }
 
 /*--------------------------------------------------------------------------------*/
 
+/* Alta sin device tree (i2c-stub, pruebas): echo IMD 0x68 > /sys/bus/i2c/devices/i2c-N/new_device */
+static const struct i2c_device_id mse_id[] = {
+	{ "IMD", 0 },
+	{ /* sentinel */ }
+};
+
+MODULE_DEVICE_TABLE(i2c, mse_id);
+
 static struct i2c_driver mse_driver = {
 
 	.probe= mse_probe,
 	.remove= mse_remove,
+	.id_table = mse_id,
 	.driver = {
 		.name = "mse_driver",
 		.owner = THIS_MODULE,
@@ -192,6 +1401,11 @@ MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Este modulo es un driver para EK_IMD");
 MODULE_INFO(mse_imd, "Esto no es para simples mortales");
 
+/* Suite KUnit: se compila dentro del modulo para llegar a las funciones static (make MSE_KUNIT=1) */
+#ifdef MSE_KUNIT_TEST
+#include "mpu9250_driver_kunit.c"
+#endif
+
 
 
 
@@ -0,0 +1,117 @@
+/*
+ * Interfaz compartida entre mpu9250_driver.c y los programas de usuario.
+ * Solo usa tipos de <linux/types.h> para poder incluirse desde ambos lados.
+ */
+#ifndef MPU9250_DRIVER_H
+#define MPU9250_DRIVER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Bloque de datos del sensor: accel(6) + temp(2) + gyro(6) + AK8963 HXL..ST2(7) */
+#define MSE_FRAME_SIZE		21
+
+/* Una muestra tal cual sale de la FIFO del MPU9250 (big endian, mag little endian) */
+struct mse_frame {
+	__u8 data[MSE_FRAME_SIZE];
+};
+
+/*
+ * Registro de una muestra tal como lo entrega el driver en streaming, en el anillo y en
+ * el modo ultimo valor. Tamano fijo de 40 bytes sin relleno implicito.
+ * seq crece de a uno por muestra adquirida, incluidas las que se pierden, asi que un
+ * salto en seq junto con dropped (acumulado) permite detectar desbordes.
+ */
+struct mse_sample {
+	__u64 timestamp_ns;	/* ktime_get_ns en la adquisicion o en la irq de data-ready */
+	__u32 seq;
+	__u32 dropped;
+	__s16 accel[3];		/* cuentas crudas en los ejes del MPU9250 */
+	__s16 temp;
+	__s16 gyro[3];
+	__s16 mag[3];		/* cuentas crudas en los ejes del AK8963 */
+	__u8 mag_st2;		/* ST2 del AK8963 (bit HOFL = desborde magnetico) */
+	__u8 reserved[3];
+};
+
+/*
+ * Anillo compartido que se obtiene con mmap() sobre /dev/mseXX. El kernel es el unico
+ * productor (avanza head) y el programa el unico consumidor (avanza tail). Los indices
+ * corren libres y se enmascaran con size - 1. head se lee con acquire y tail se escribe
+ * con release; cada uno esta en su propia linea de cache.
+ */
+#define MSE_RING_VERSION	2
+#define MSE_RING_SAMPLES	4096
+
+struct mse_ring {
+	__u32 version;
+	__u32 size;		/* cantidad de muestras, potencia de 2 */
+	__u32 sample_size;	/* sizeof(struct mse_sample) */
+	__u32 dropped;		/* muestras perdidas por anillo lleno */
+	__u8 pad0[48];
+	__u32 head;
+	__u8 pad1[60];
+	__u32 tail;
+	__u8 pad2[60];
+	struct mse_sample samples[];
+};
+
+/* Lectura de registros consecutivos a partir de reg (MSE_IOC_READ_REGS) */
+struct mse_reg_xfer {
+	__u8 reg;
+	__u8 reserved;
+	__u16 len;		/* hasta MSE_REG_XFER_MAX bytes */
+	__u32 reserved2;
+	__u64 buf;		/* puntero de usuario al destino */
+};
+
+#define MSE_REG_XFER_MAX	4096
+
+/* Una operacion de una secuencia de configuracion (MSE_IOC_WRITE_BATCH) */
+struct mse_reg_op {
+	__u8 reg;
+	__u8 val;
+	__u8 mask;		/* bits que se comparan al verificar */
+	__u8 flags;
+	__u32 delay_us;		/* espera despues de la operacion, hasta MSE_REG_OP_DELAY_MAX */
+};
+
+#define MSE_REG_OP_VERIFY	0x01	/* relee el registro despues de escribirlo */
+#define MSE_REG_OP_EXPECT	0x02	/* no escribe, solo lee y compara con val */
+
+#define MSE_REG_OP_DELAY_MAX	1000000
+
+struct mse_reg_batch {
+	__u32 count;		/* hasta MSE_REG_BATCH_MAX operaciones */
+	__u32 done;		/* salida: operaciones completadas antes de un error */
+	__u64 ops;		/* puntero de usuario a struct mse_reg_op[count] */
+};
+
+#define MSE_REG_BATCH_MAX	256
+
+/* Comandos ioctl de /dev/mseXX */
+#define MSE_IOC_MAGIC		'm'
+
+/*
+ * Inicia la adquisicion continua (por data-ready si hay pin INT, si no por la FIFO del
+ * sensor); read() devuelve muchas struct mse_sample por llamada
+ */
+#define MSE_IOC_STREAM_START	_IO(MSE_IOC_MAGIC, 1)
+/* Vuelve al modo directo (un i2c_master_recv por read()) */
+#define MSE_IOC_STREAM_STOP	_IO(MSE_IOC_MAGIC, 2)
+/* Ejecuta el handler del data-ready como si hubiera llegado la interrupcion */
+#define MSE_IOC_SW_TRIGGER	_IO(MSE_IOC_MAGIC, 3)
+/* Escribe reg y lee len bytes en una sola i2c_transfer con repeated start */
+#define MSE_IOC_READ_REGS	_IOW(MSE_IOC_MAGIC, 4, struct mse_reg_xfer)
+/* Ejecuta una secuencia de escrituras/verificaciones con el bus tomado una sola vez */
+#define MSE_IOC_WRITE_BATCH	_IOWR(MSE_IOC_MAGIC, 5, struct mse_reg_batch)
+/* Olvida la copia de los registros (por ejemplo si el sensor perdio alimentacion) */
+#define MSE_IOC_REGCACHE_DROP	_IO(MSE_IOC_MAGIC, 6)
+/*
+ * Modo ultimo valor: el driver adquiere con un hrtimer cada arg microsegundos (0 = tasa
+ * del sensor) y read() devuelve al instante una struct mse_sample con la muestra mas nueva
+ */
+#define MSE_IOC_LATEST_START	_IO(MSE_IOC_MAGIC, 7)
+#define MSE_IOC_LATEST_STOP	_IO(MSE_IOC_MAGIC, 8)
+
+#endif /* MPU9250_DRIVER_H */
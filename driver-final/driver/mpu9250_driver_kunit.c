@@ -0,0 +1,647 @@
+/*
+ * Pruebas KUnit y mediciones de mpu9250_driver.c sin la Raspberry Pi.
+ *
+ * Se incluye al final de mpu9250_driver.c cuando se compila con make MSE_KUNIT=1, asi llega
+ * a mse_read, mse_write, mse_ioctl, mse_poll y los show de debugfs, que son static. Cada caso registra un adaptador i2c
+ * falso con un archivo de registros al estilo de i2c-stub (puntero que se autoincrementa),
+ * mas FIFO_COUNT / FIFO_R_W para el modo streaming, y da de alta un cliente "IMD" en 0x68
+ * al que se asocia mse_driver como con cualquier otro bus.
+ *
+ * Necesita un kernel 6.10 o posterior con CONFIG_KUNIT (kunit_vm_mmap da la memoria de
+ * usuario que piden copy_to_user/copy_from_user). Uso en la VM:
+ *
+ *	make MSE_KUNIT=1 KDIR=/lib/modules/$(uname -r)/build
+ *	insmod mpu9250_driver.ko [fake_bus_khz=400]
+ *	cat /sys/kernel/debug/kunit/mse_driver/results | tools/testing/kunit/kunit.py parse
+ *
+ * o todo junto con make kunit (ver el Makefile).
+ *
+ * Las mediciones informan media, p50, p99 y maximo por llamada y el caudal en KB/s. Con
+ * fake_bus_khz = 0 el adaptador responde al instante y se mide solo el costo del driver;
+ * con la velocidad del bus se agrega el tiempo que tardarian los bytes en el cable.
+ */
+#include <kunit/test.h>
+#include <linux/mman.h>
+#include <linux/sort.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0)
+#error "La suite KUnit de mse necesita un kernel 6.10 o posterior (kunit_vm_mmap); compilar sin MSE_KUNIT=1"
+#endif
+
+#define MSE_FAKE_ADDR		0x68
+#define MSE_FAKE_WHO_AM_I	0x75
+#define MSE_FAKE_I2C_SLV0_DO	0x63
+
+/* Llamadas medidas por caso, menos si se simula el tiempo del bus */
+#define MSE_BENCH_ITERS		1000
+#define MSE_BENCH_ITERS_BUS	100
+
+/* Memoria de usuario: argumento del ioctl en la primera pagina, datos desde la segunda */
+#define MSE_USER_BYTES		(4 * PAGE_SIZE)
+#define MSE_USER_DATA		PAGE_SIZE
+
+static unsigned int fake_bus_khz;
+module_param(fake_bus_khz, uint, 0644);
+MODULE_PARM_DESC(fake_bus_khz, "Velocidad simulada del bus en las pruebas KUnit (0 = sin demora)");
+
+/* Sensor falso detras del adaptador */
+struct mse_fake {
+	struct i2c_adapter adap;
+	u8 regs[MPU9250_NUM_REGS];
+	u8 ptr;				/* registro de la proxima lectura o escritura */
+	u8 frame[MSE_FRAME_SIZE];	/* contenido de cada muestra de la FIFO */
+	unsigned int fifo_bytes;	/* lo que informa FIFO_COUNT */
+	unsigned int fifo_pos;
+	bool fifo_sticky;		/* la FIFO nunca se vacia (mediciones) */
+	unsigned long xfers;		/* llamadas a master_xfer */
+	unsigned long bytes;
+};
+
+struct mse_test_ctx {
+	struct mse_fake fake;
+	struct i2c_client *client;
+	struct mse_dev *mse;
+	struct file file;
+	unsigned long ubuf;
+};
+
+static u8 mse_fake_read(struct mse_fake *fake)
+{
+	u8 reg = fake->ptr, val;
+
+	switch (reg) {
+	case MPU9250_FIFO_COUNT:
+		fake->ptr++;
+		return (fake->fifo_bytes >> 8) & 0x1F;
+	case MPU9250_FIFO_COUNT + 1:
+		fake->ptr++;
+		return fake->fifo_bytes & 0xFF;
+	case MPU9250_FIFO_READ:
+		/* FIFO_R_W no avanza el puntero */
+		if (fake->fifo_bytes == 0)
+			return 0xFF;
+		val = fake->frame[fake->fifo_pos];
+		fake->fifo_pos = (fake->fifo_pos + 1) % MSE_FRAME_SIZE;
+		if (!fake->fifo_sticky)
+			fake->fifo_bytes--;
+		return val;
+	}
+
+	fake->ptr = (reg + 1) % MPU9250_NUM_REGS;
+	return fake->regs[reg % MPU9250_NUM_REGS];
+}
+
+static void mse_fake_write(struct mse_fake *fake, u8 val)
+{
+	u8 reg = fake->ptr % MPU9250_NUM_REGS;
+
+	fake->ptr = (reg + 1) % MPU9250_NUM_REGS;
+	if (reg == MPU9250_PWR_MGMNT_1 && (val & MPU9250_PWR_RESET)) {
+		memset(fake->regs, 0, sizeof(fake->regs));
+		fake->regs[MSE_FAKE_WHO_AM_I] = 0x71;
+		return;
+	}
+	if (reg == MPU9250_USER_CTRL && (val & MPU9250_USER_FIFO_RST))
+		fake->fifo_bytes = fake->fifo_sticky ? fake->fifo_bytes : 0;
+	if (reg == MSE_FAKE_WHO_AM_I || reg == MPU9250_FIFO_READ)
+		return;
+	fake->regs[reg] = val & ~mse_reg_self_clear(reg);
+}
+
+/* Un mensaje de escritura fija el registro y escribe el resto, uno de lectura recorre registros */
+static int mse_fake_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	struct mse_fake *fake = i2c_get_adapdata(adap);
+	unsigned long bits = 0;
+	int i, j;
+
+	fake->xfers++;
+	for (i = 0; i < num; i++) {
+		struct i2c_msg *msg = &msgs[i];
+
+		if (msg->addr != MSE_FAKE_ADDR)
+			return -ENXIO;
+
+		fake->bytes += msg->len;
+		bits += (msg->len + 1) * 9;
+		if (msg->flags & I2C_M_RD) {
+			for (j = 0; j < msg->len; j++)
+				msg->buf[j] = mse_fake_read(fake);
+		} else if (msg->len > 0) {
+			fake->ptr = msg->buf[0];
+			for (j = 1; j < msg->len; j++)
+				mse_fake_write(fake, msg->buf[j]);
+		}
+	}
+
+	if (fake_bus_khz)
+		fsleep(DIV_ROUND_UP(bits * 1000, fake_bus_khz));
+
+	return num;
+}
+
+static u32 mse_fake_functionality(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm mse_fake_algo = {
+	.master_xfer = mse_fake_xfer,
+	.functionality = mse_fake_functionality,
+};
+
+/* Adaptador y cliente nuevos por caso, mse_driver se asocia al registrar el cliente */
+static int mse_test_init(struct kunit *test)
+{
+	struct i2c_board_info info = { I2C_BOARD_INFO("IMD", MSE_FAKE_ADDR) };
+	struct mse_test_ctx *ctx;
+	int ret;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+
+	ctx->ubuf = kunit_vm_mmap(test, NULL, 0, MSE_USER_BYTES, PROT_READ | PROT_WRITE,
+				  MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_NE_MSG(test, ctx->ubuf, 0, "No se pudo mapear memoria de usuario");
+
+	ctx->fake.regs[MSE_FAKE_WHO_AM_I] = 0x71;
+	ctx->fake.adap.owner = THIS_MODULE;
+	ctx->fake.adap.algo = &mse_fake_algo;
+	strscpy(ctx->fake.adap.name, "mse kunit", sizeof(ctx->fake.adap.name));
+	i2c_set_adapdata(&ctx->fake.adap, &ctx->fake);
+	ret = i2c_add_adapter(&ctx->fake.adap);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+
+	ctx->client = i2c_new_client_device(&ctx->fake.adap, &info);
+	if (IS_ERR(ctx->client) || !i2c_get_clientdata(ctx->client)) {
+		if (!IS_ERR(ctx->client))
+			i2c_unregister_device(ctx->client);
+		i2c_del_adapter(&ctx->fake.adap);
+		KUNIT_FAIL(test, "mse_driver no se asocio al cliente falso");
+		return -ENODEV;
+	}
+	ctx->mse = i2c_get_clientdata(ctx->client);
+
+	/* Lo unico que usan las operaciones del driver de struct file, como lo deja misc_open */
+	ctx->file.private_data = &ctx->mse->mse_miscdevice;
+	ctx->file.f_flags = O_NONBLOCK;
+	ret = mse_open(NULL, &ctx->file);
+	if (ret) {
+		i2c_unregister_device(ctx->client);
+		i2c_del_adapter(&ctx->fake.adap);
+		KUNIT_FAIL(test, "mse_open fallo = %d", ret);
+		return ret;
+	}
+
+	test->priv = ctx;
+	return 0;
+}
+
+static void mse_test_exit(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+
+	if (!ctx)
+		return;
+	mse_release(NULL, &ctx->file);
+	i2c_unregister_device(ctx->client);
+	i2c_del_adapter(&ctx->fake.adap);
+}
+
+static void __user *mse_test_user(struct mse_test_ctx *ctx, size_t offset)
+{
+	return (void __user *)(ctx->ubuf + offset);
+}
+
+/* Copia arg a la memoria de usuario, ejecuta el ioctl y devuelve arg actualizado */
+static long mse_test_ioctl(struct mse_test_ctx *ctx, unsigned int cmd, void *arg, size_t size)
+{
+	long ret;
+
+	if (copy_to_user(mse_test_user(ctx, 0), arg, size))
+		return -EFAULT;
+	ret = mse_ioctl(&ctx->file, cmd, ctx->ubuf);
+	if (copy_from_user(arg, mse_test_user(ctx, 0), size))
+		return -EFAULT;
+	return ret;
+}
+
+/* Comandos sin estructura (streaming, ultimo valor): arg va tal cual */
+static long mse_test_cmd(struct mse_test_ctx *ctx, unsigned int cmd, unsigned long arg)
+{
+	return mse_ioctl(&ctx->file, cmd, arg);
+}
+
+static long mse_test_read_regs(struct mse_test_ctx *ctx, u8 reg, u16 len)
+{
+	struct mse_reg_xfer xfer = {
+		.reg = reg,
+		.len = len,
+		.buf = ctx->ubuf + MSE_USER_DATA,
+	};
+
+	return mse_test_ioctl(ctx, MSE_IOC_READ_REGS, &xfer, sizeof(xfer));
+}
+
+static long mse_test_batch(struct mse_test_ctx *ctx, const struct mse_reg_op *ops, u32 count, u32 *done)
+{
+	struct mse_reg_batch batch = {
+		.count = count,
+		.ops = ctx->ubuf + MSE_USER_DATA,
+	};
+	long ret;
+
+	if (copy_to_user(mse_test_user(ctx, MSE_USER_DATA), ops, count * sizeof(*ops)))
+		return -EFAULT;
+	ret = mse_test_ioctl(ctx, MSE_IOC_WRITE_BATCH, &batch, sizeof(batch));
+	if (done)
+		*done = batch.done;
+	return ret;
+}
+
+static void mse_test_probe(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+
+	KUNIT_EXPECT_EQ(test, strncmp(ctx->mse->name, "mse", 3), 0);
+	KUNIT_EXPECT_PTR_EQ(test, ctx->mse->client, ctx->client);
+	KUNIT_EXPECT_FALSE(test, ctx->mse->irq_mode);
+	KUNIT_EXPECT_EQ(test, ctx->mse->ring->version, (u32)MSE_RING_VERSION);
+}
+
+static void mse_test_read_regs_ioctl(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+	u8 expected[MSE_FRAME_SIZE], got[MSE_FRAME_SIZE];
+	unsigned long xfers;
+	int i;
+
+	for (i = 0; i < MSE_FRAME_SIZE; i++)
+		expected[i] = ctx->fake.regs[MPU9250_ACCEL_OUT + i] = i * 7 + 1;
+
+	KUNIT_ASSERT_EQ(test, mse_test_read_regs(ctx, MPU9250_ACCEL_OUT, MSE_FRAME_SIZE), 0);
+	KUNIT_ASSERT_EQ(test, copy_from_user(got, mse_test_user(ctx, MSE_USER_DATA), sizeof(got)), 0);
+	KUNIT_EXPECT_MEMEQ(test, got, expected, sizeof(got));
+
+	/* Los registros de configuracion se sirven desde la cache la segunda vez */
+	ctx->fake.regs[MPU9250_SMPDIV] = 4;
+	KUNIT_ASSERT_EQ(test, mse_test_read_regs(ctx, MPU9250_SMPDIV, 5), 0);
+	xfers = ctx->fake.xfers;
+	KUNIT_ASSERT_EQ(test, mse_test_read_regs(ctx, MPU9250_SMPDIV, 5), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.xfers, regcache ? xfers : xfers + 1);
+
+	KUNIT_EXPECT_EQ(test, mse_test_read_regs(ctx, MPU9250_ACCEL_OUT, 0), -EINVAL);
+	KUNIT_EXPECT_EQ(test, mse_test_read_regs(ctx, MPU9250_ACCEL_OUT, MSE_REG_XFER_MAX + 1), -EINVAL);
+}
+
+static void mse_test_write_batch_ioctl(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+	struct mse_reg_op ops[] = {
+		{ .reg = MPU9250_SMPDIV, .val = 9, .mask = 0xFF, .flags = MSE_REG_OP_VERIFY },
+		{ .reg = MSE_FAKE_WHO_AM_I, .val = 0x71, .mask = 0xFD, .flags = MSE_REG_OP_EXPECT },
+	};
+	struct mse_reg_op bad = { .reg = MSE_FAKE_WHO_AM_I, .val = 0x48, .mask = 0xFF, .flags = MSE_REG_OP_EXPECT };
+	u32 done = 0;
+
+	KUNIT_EXPECT_EQ(test, mse_test_batch(ctx, ops, ARRAY_SIZE(ops), &done), 0);
+	KUNIT_EXPECT_EQ(test, done, (u32)ARRAY_SIZE(ops));
+	KUNIT_EXPECT_EQ(test, ctx->fake.regs[MPU9250_SMPDIV], 9);
+
+	KUNIT_EXPECT_EQ(test, mse_test_batch(ctx, &bad, 1, &done), -EIO);
+	KUNIT_EXPECT_EQ(test, done, 0U);
+}
+
+static void mse_test_write(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+	u8 buf[] = { MPU9250_SMPDIV, 3, 0x01 };
+
+	KUNIT_ASSERT_EQ(test, copy_to_user(mse_test_user(ctx, MSE_USER_DATA), buf, sizeof(buf)), 0);
+	KUNIT_EXPECT_EQ(test, mse_write(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), sizeof(buf), NULL), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.regs[MPU9250_SMPDIV], 3);
+	KUNIT_EXPECT_EQ(test, ctx->fake.regs[MPU9250_SMPDIV + 1], 0x01);
+	KUNIT_EXPECT_EQ(test, mse_write(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), MSE_FRAME_SIZE + 1, NULL),
+			(ssize_t)-EINVAL);
+}
+
+/* Contadores de debugfs: solo cuentan las transferencias que llegan al bus */
+static void mse_test_stats(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+	struct mse_stats *stats = &ctx->mse->stats;
+	u64 hist = 0;
+	int i;
+
+	KUNIT_ASSERT_EQ(test, mse_test_read_regs(ctx, MPU9250_ACCEL_OUT, MSE_FRAME_SIZE), 0);
+	KUNIT_ASSERT_EQ(test, mse_test_read_regs(ctx, MPU9250_SMPDIV, 1), 0);
+	KUNIT_ASSERT_EQ(test, mse_test_read_regs(ctx, MPU9250_SMPDIV, 1), 0);
+	KUNIT_EXPECT_EQ(test, stats->transfers, regcache ? 2ULL : 3ULL);
+	KUNIT_EXPECT_EQ(test, stats->bytes, regcache ? MSE_FRAME_SIZE + 1ULL : MSE_FRAME_SIZE + 2ULL);
+	KUNIT_EXPECT_EQ(test, stats->errors, 0ULL);
+
+	for (i = 0; i < MSE_XFER_HIST_BUCKETS; i++)
+		hist += stats->xfer_hist[i];
+	KUNIT_EXPECT_EQ(test, hist, stats->transfers);
+	KUNIT_EXPECT_LE(test, stats->xfer_ns_max, stats->xfer_ns_total);
+
+	/* Un cliente en otra direccion hace fallar la transferencia */
+	ctx->client->addr = MSE_FAKE_ADDR + 1;
+	KUNIT_EXPECT_LT(test, mse_test_read_regs(ctx, MPU9250_ACCEL_OUT, MSE_FRAME_SIZE), 0);
+	ctx->client->addr = MSE_FAKE_ADDR;
+	KUNIT_EXPECT_EQ(test, stats->errors, 1ULL);
+	KUNIT_EXPECT_EQ(test, stats->bytes, regcache ? MSE_FRAME_SIZE + 1ULL : MSE_FRAME_SIZE + 2ULL);
+}
+
+/* Ultima transferencia vista por el tracepoint mse_xfer_done */
+struct mse_trace_hit {
+	unsigned int count;
+	int op;
+	u8 reg;
+	u16 len;
+	int err;
+};
+
+static void mse_test_xfer_probe(void *data, const char *name, int op, u8 reg, u16 len, int err,
+				u64 duration_ns)
+{
+	struct mse_trace_hit *hit = data;
+
+	hit->count++;
+	hit->op = op;
+	hit->reg = reg;
+	hit->len = len;
+	hit->err = err;
+}
+
+/* Los archivos de debugfs tal como los genera seq_file, y los tracepoints con una sonda propia */
+static void mse_test_debugfs_trace(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+	struct seq_file s = { .private = ctx->mse, .size = PAGE_SIZE };
+	struct mse_trace_hit hit = { 0 };
+	unsigned int lines = 0;
+	size_t i;
+	int ret;
+
+	s.buf = kunit_kzalloc(test, s.size, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, s.buf);
+
+	KUNIT_ASSERT_EQ(test, mse_test_read_regs(ctx, MPU9250_ACCEL_OUT, MSE_FRAME_SIZE), 0);
+	KUNIT_ASSERT_EQ(test, mse_stats_show(&s, NULL), 0);
+	KUNIT_EXPECT_FALSE(test, seq_has_overflowed(&s));
+	KUNIT_EXPECT_NOT_NULL(test, strstr(s.buf, "transfers: 1\n"));
+	KUNIT_EXPECT_NOT_NULL(test, strstr(s.buf, "bytes: 21\n"));
+	KUNIT_EXPECT_NOT_NULL(test, strstr(s.buf, "errors: 0\n"));
+
+	memset(s.buf, 0, s.size);
+	s.count = 0;
+	KUNIT_ASSERT_EQ(test, mse_xfer_latency_show(&s, NULL), 0);
+	for (i = 0; i < s.count; i++)
+		lines += s.buf[i] == '\n';
+	KUNIT_EXPECT_EQ(test, lines, (unsigned int)MSE_XFER_HIST_BUCKETS);
+	KUNIT_EXPECT_NOT_NULL(test, strstr(s.buf, " inf "));
+
+	ret = register_trace_mse_xfer_done(mse_test_xfer_probe, &hit);
+	if (ret == -ENOSYS)
+		kunit_skip(test, "kernel sin CONFIG_TRACEPOINTS");
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	ret = mse_test_read_regs(ctx, MPU9250_ACCEL_OUT, 6);
+	unregister_trace_mse_xfer_done(mse_test_xfer_probe, &hit);
+	tracepoint_synchronize_unregister();
+
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, hit.count, 1U);
+	KUNIT_EXPECT_EQ(test, hit.op, MSE_XFER_READ);
+	KUNIT_EXPECT_EQ(test, hit.reg, MPU9250_ACCEL_OUT);
+	KUNIT_EXPECT_EQ(test, hit.len, 6);
+	KUNIT_EXPECT_EQ(test, hit.err, 0);
+}
+
+/* Streaming por FIFO: cada rafaga se convierte en struct mse_sample con seq consecutivos */
+static void mse_test_stream_read(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+	struct mse_sample samples[4];
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < MSE_FRAME_SIZE; i++)
+		ctx->fake.frame[i] = i;
+
+	KUNIT_ASSERT_EQ(test, mse_test_cmd(ctx, MSE_IOC_STREAM_START, 0), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.regs[MPU9250_FIFO_EN], MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO |
+			MPU9250_FIFO_ACCEL | MPU9250_FIFO_MAG);
+
+	ctx->fake.fifo_bytes = 3 * MSE_FRAME_SIZE;
+	ret = mse_read(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), sizeof(samples), NULL);
+	KUNIT_EXPECT_EQ(test, ret, (ssize_t)(3 * sizeof(struct mse_sample)));
+	KUNIT_ASSERT_EQ(test, copy_from_user(samples, mse_test_user(ctx, MSE_USER_DATA), sizeof(samples)), 0);
+	for (i = 0; i < 3; i++) {
+		KUNIT_EXPECT_EQ(test, samples[i].seq, (u32)i);
+		KUNIT_EXPECT_EQ(test, samples[i].accel[0], (s16)0x0001);
+		KUNIT_EXPECT_EQ(test, samples[i].mag[0], (s16)0x0F0E);
+		KUNIT_EXPECT_EQ(test, samples[i].mag_st2, 20);
+	}
+
+	/* Sin muestras y con O_NONBLOCK no espera */
+	ret = mse_read(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), sizeof(samples), NULL);
+	KUNIT_EXPECT_EQ(test, ret, (ssize_t)-EAGAIN);
+
+	KUNIT_EXPECT_EQ(test, mse_test_cmd(ctx, MSE_IOC_STREAM_STOP, 0), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.regs[MPU9250_FIFO_EN], 0);
+}
+
+/* Periodo largo para que no llegue una muestra entre la lectura y el poll() siguiente */
+static void mse_test_latest(struct kunit *test)
+{
+	struct mse_test_ctx *ctx = test->priv;
+	struct mse_sample sample;
+
+	KUNIT_ASSERT_EQ(test, mse_test_cmd(ctx, MSE_IOC_LATEST_START, 100000), 0);
+	KUNIT_EXPECT_EQ(test, mse_test_cmd(ctx, MSE_IOC_STREAM_START, 0), -EBUSY);
+	KUNIT_EXPECT_FALSE(test, mse_poll(&ctx->file, NULL) & EPOLLIN);
+	msleep(150);
+	KUNIT_EXPECT_TRUE(test, mse_poll(&ctx->file, NULL) & EPOLLIN);
+	KUNIT_EXPECT_EQ(test, mse_read(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), sizeof(sample), NULL),
+			(ssize_t)sizeof(sample));
+	KUNIT_ASSERT_EQ(test, copy_from_user(&sample, mse_test_user(ctx, MSE_USER_DATA), sizeof(sample)), 0);
+	KUNIT_EXPECT_NE(test, sample.timestamp_ns, 0ULL);
+	/* Ya leida: sin EPOLLIN hasta la proxima */
+	KUNIT_EXPECT_FALSE(test, mse_poll(&ctx->file, NULL) & EPOLLIN);
+	KUNIT_EXPECT_EQ(test, mse_test_cmd(ctx, MSE_IOC_LATEST_STOP, 0), 0);
+	KUNIT_EXPECT_TRUE(test, mse_poll(&ctx->file, NULL) & EPOLLIN);
+}
+
+/* Mediciones */
+
+static int mse_bench_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned int mse_bench_iters(void)
+{
+	return fake_bus_khz ? MSE_BENCH_ITERS_BUS : MSE_BENCH_ITERS;
+}
+
+static void mse_bench_report(struct kunit *test, const char *what, size_t bytes, u64 *ns, unsigned int n)
+{
+	u64 total = 0;
+	unsigned int i;
+
+	sort(ns, n, sizeof(*ns), mse_bench_cmp, NULL);
+	for (i = 0; i < n; i++)
+		total += ns[i];
+
+	kunit_info(test, "%s %zu B: media %llu ns, p50 %llu ns, p99 %llu ns, max %llu ns, %llu KB/s\n",
+		   what, bytes, div_u64(total, n), ns[n / 2], ns[n * 99 / 100], ns[n - 1],
+		   total ? div64_u64((u64)bytes * n * NSEC_PER_SEC, total * 1024) : 0);
+}
+
+/* Tiempo de cada una de n ejecuciones de call */
+#define MSE_BENCH(ns, n, call)					\
+	do {								\
+		unsigned int __i;					\
+		u64 __t;						\
+									\
+		for (__i = 0; __i < (n); __i++) {			\
+			__t = ktime_get_ns();				\
+			call;						\
+			(ns)[__i] = ktime_get_ns() - __t;		\
+		}							\
+	} while (0)
+
+/* MSE_IOC_READ_REGS sobre FIFO_R_W (nunca en la cache) y sobre registros en la cache */
+static void mse_bench_read_regs(struct kunit *test)
+{
+	static const u16 sizes[] = { 1, 2, 6, 21, 64, 256, 1024, MSE_REG_XFER_MAX };
+	struct mse_test_ctx *ctx = test->priv;
+	unsigned int n = mse_bench_iters(), s;
+	long ret = 0;
+	u64 *ns;
+
+	ns = kunit_kmalloc_array(test, n, sizeof(*ns), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ns);
+
+	ctx->fake.fifo_sticky = true;
+	ctx->fake.fifo_bytes = MSE_BURST_FRAMES * MSE_FRAME_SIZE;
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		MSE_BENCH(ns, n, ret |= mse_test_read_regs(ctx, MPU9250_FIFO_READ, sizes[s]));
+		mse_bench_report(test, "ioctl READ_REGS", sizes[s], ns, n);
+	}
+	MSE_BENCH(ns, n, ret |= mse_test_read_regs(ctx, MPU9250_SMPDIV, 5));
+	mse_bench_report(test, "ioctl READ_REGS (cache)", 5, ns, n);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+}
+
+/* MSE_IOC_WRITE_BATCH con escrituras verificadas, alternando el valor para no pegarle a la cache */
+static void mse_bench_write_batch(struct kunit *test)
+{
+	static const u32 sizes[] = { 1, 8, 32, 128, MSE_REG_BATCH_MAX };
+	struct mse_test_ctx *ctx = test->priv;
+	unsigned int n = mse_bench_iters(), s, i;
+	struct mse_reg_op *ops;
+	long ret = 0;
+	u64 *ns;
+
+	ns = kunit_kmalloc_array(test, n, sizeof(*ns), GFP_KERNEL);
+	ops = kunit_kcalloc(test, MSE_REG_BATCH_MAX, sizeof(*ops), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ns);
+	KUNIT_ASSERT_NOT_NULL(test, ops);
+
+	for (i = 0; i < MSE_REG_BATCH_MAX; i++) {
+		ops[i].reg = MSE_FAKE_I2C_SLV0_DO;
+		ops[i].val = (i & 1) ? 0x55 : 0xAA;
+		ops[i].mask = 0xFF;
+		ops[i].flags = MSE_REG_OP_VERIFY;
+	}
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		MSE_BENCH(ns, n, ret |= mse_test_batch(ctx, ops, sizes[s], NULL));
+		mse_bench_report(test, "ioctl WRITE_BATCH", sizes[s] * sizeof(*ops), ns, n);
+	}
+
+	/* Todas iguales: despues de la primera las resuelve la cache */
+	for (i = 0; i < MSE_REG_BATCH_MAX; i++)
+		ops[i].val = 0x5A;
+	MSE_BENCH(ns, n, ret |= mse_test_batch(ctx, ops, MSE_REG_BATCH_MAX, NULL));
+	mse_bench_report(test, "ioctl WRITE_BATCH (cache)", MSE_REG_BATCH_MAX * sizeof(*ops), ns, n);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+}
+
+/* read() directo (i2c_master_recv) y en streaming (rafaga completa de la FIFO por llamada) */
+static void mse_bench_read(struct kunit *test)
+{
+	static const size_t sizes[] = { 1, 6, 14, MSE_FRAME_SIZE };
+	struct mse_test_ctx *ctx = test->priv;
+	unsigned int n = mse_bench_iters(), s;
+	size_t burst = MSE_BURST_FRAMES * sizeof(struct mse_sample);
+	ssize_t ret, bad = 0;
+	u64 *ns;
+
+	ns = kunit_kmalloc_array(test, n, sizeof(*ns), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ns);
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		MSE_BENCH(ns, n, ret = mse_read(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), sizes[s], NULL);
+			  bad |= (ret != sizes[s]));
+		mse_bench_report(test, "read directo", sizes[s], ns, n);
+	}
+
+	ctx->fake.fifo_sticky = true;
+	ctx->fake.fifo_bytes = MSE_BURST_FRAMES * MSE_FRAME_SIZE;
+	KUNIT_ASSERT_EQ(test, mse_test_cmd(ctx, MSE_IOC_STREAM_START, 0), 0);
+	MSE_BENCH(ns, n, ret = mse_read(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), burst, NULL);
+		  bad |= (ret <= 0));
+	mse_bench_report(test, "read streaming", burst, ns, n);
+	KUNIT_EXPECT_EQ(test, mse_test_cmd(ctx, MSE_IOC_STREAM_STOP, 0), 0);
+	KUNIT_EXPECT_EQ(test, bad, 0);
+}
+
+/* write() crudo: registro + datos en un i2c_master_send */
+static void mse_bench_write(struct kunit *test)
+{
+	static const size_t sizes[] = { 2, 8, MSE_FRAME_SIZE };
+	struct mse_test_ctx *ctx = test->priv;
+	unsigned int n = mse_bench_iters(), s;
+	u8 buf[MSE_FRAME_SIZE] = { MSE_FAKE_I2C_SLV0_DO };
+	ssize_t ret = 0;
+	u64 *ns;
+
+	ns = kunit_kmalloc_array(test, n, sizeof(*ns), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ns);
+	KUNIT_ASSERT_EQ(test, copy_to_user(mse_test_user(ctx, MSE_USER_DATA), buf, sizeof(buf)), 0);
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		MSE_BENCH(ns, n, ret |= mse_write(&ctx->file, mse_test_user(ctx, MSE_USER_DATA), sizes[s], NULL));
+		mse_bench_report(test, "write", sizes[s], ns, n);
+	}
+	KUNIT_EXPECT_EQ(test, ret, 0);
+}
+
+static struct kunit_case mse_test_cases[] = {
+	KUNIT_CASE(mse_test_probe),
+	KUNIT_CASE(mse_test_read_regs_ioctl),
+	KUNIT_CASE(mse_test_write_batch_ioctl),
+	KUNIT_CASE(mse_test_write),
+	KUNIT_CASE(mse_test_stream_read),
+	KUNIT_CASE(mse_test_latest),
+	KUNIT_CASE(mse_test_stats),
+	KUNIT_CASE(mse_test_debugfs_trace),
+	KUNIT_CASE_SLOW(mse_bench_read_regs),
+	KUNIT_CASE_SLOW(mse_bench_write_batch),
+	KUNIT_CASE_SLOW(mse_bench_read),
+	KUNIT_CASE_SLOW(mse_bench_write),
+	{}
+};
+
+static struct kunit_suite mse_test_suite = {
+	.name = "mse_driver",
+	.init = mse_test_init,
+	.exit = mse_test_exit,
+	.test_cases = mse_test_cases,
+};
+
+kunit_test_suite(mse_test_suite);
@@ -0,0 +1,159 @@
+/*
+ * Tracepoints de mpu9250_driver.c. Con el modulo cargado:
+ *
+ *	echo 1 > /sys/kernel/tracing/events/mse/enable
+ *	cat /sys/kernel/tracing/trace_pipe
+ *
+ * o perf record -e 'mse:*'. Deshabilitados cuestan una rama por transferencia.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mse
+
+#if !defined(MPU9250_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define MPU9250_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Tipos de transferencia i2c del driver */
+#ifndef MSE_XFER_READ
+#define MSE_XFER_READ		0	/* registro + lectura con repeated start */
+#define MSE_XFER_WRITE		1	/* registro + valor */
+#define MSE_XFER_RECV		2	/* read() directo, desde el registro que haya quedado */
+#define MSE_XFER_SEND		3	/* write() crudo */
+
+/* Donde se perdio una muestra */
+#define MSE_DROP_KFIFO		0
+#define MSE_DROP_RING		1
+#endif
+
+#define show_mse_xfer(op)						\
+	__print_symbolic(op,						\
+			 { MSE_XFER_READ, "read" },			\
+			 { MSE_XFER_WRITE, "write" },			\
+			 { MSE_XFER_RECV, "recv" },			\
+			 { MSE_XFER_SEND, "send" })
+
+/* El nombre del dispositivo (mseXX) se copia entero, es corto */
+#define MSE_TRACE_NAME		9
+
+TRACE_EVENT(mse_xfer_start,
+	TP_PROTO(const char *name, int op, u8 reg, u16 len),
+	TP_ARGS(name, op, reg, len),
+
+	TP_STRUCT__entry(
+		__array(char, name, MSE_TRACE_NAME)
+		__field(int, op)
+		__field(u8, reg)
+		__field(u16, len)
+	),
+
+	TP_fast_assign(
+		strscpy(__entry->name, name, MSE_TRACE_NAME);
+		__entry->op = op;
+		__entry->reg = reg;
+		__entry->len = len;
+	),
+
+	TP_printk("%s %s reg=0x%02x len=%u", __entry->name, show_mse_xfer(__entry->op),
+		  __entry->reg, __entry->len)
+);
+
+TRACE_EVENT(mse_xfer_done,
+	TP_PROTO(const char *name, int op, u8 reg, u16 len, int err, u64 duration_ns),
+	TP_ARGS(name, op, reg, len, err, duration_ns),
+
+	TP_STRUCT__entry(
+		__array(char, name, MSE_TRACE_NAME)
+		__field(int, op)
+		__field(u8, reg)
+		__field(u16, len)
+		__field(int, err)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		strscpy(__entry->name, name, MSE_TRACE_NAME);
+		__entry->op = op;
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->err = err;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("%s %s reg=0x%02x len=%u err=%d ns=%llu", __entry->name,
+		  show_mse_xfer(__entry->op), __entry->reg, __entry->len, __entry->err,
+		  __entry->duration_ns)
+);
+
+/* Una pasada de vaciado de la FIFO del sensor: bytes informados y muestras leidas */
+TRACE_EVENT(mse_fifo_drain,
+	TP_PROTO(const char *name, unsigned int bytes, unsigned int frames),
+	TP_ARGS(name, bytes, frames),
+
+	TP_STRUCT__entry(
+		__array(char, name, MSE_TRACE_NAME)
+		__field(unsigned int, bytes)
+		__field(unsigned int, frames)
+	),
+
+	TP_fast_assign(
+		strscpy(__entry->name, name, MSE_TRACE_NAME);
+		__entry->bytes = bytes;
+		__entry->frames = frames;
+	),
+
+	TP_printk("%s bytes=%u frames=%u", __entry->name, __entry->bytes, __entry->frames)
+);
+
+TRACE_EVENT(mse_fifo_overflow,
+	TP_PROTO(const char *name, unsigned long overflows, u32 dropped),
+	TP_ARGS(name, overflows, dropped),
+
+	TP_STRUCT__entry(
+		__array(char, name, MSE_TRACE_NAME)
+		__field(unsigned long, overflows)
+		__field(u32, dropped)
+	),
+
+	TP_fast_assign(
+		strscpy(__entry->name, name, MSE_TRACE_NAME);
+		__entry->overflows = overflows;
+		__entry->dropped = dropped;
+	),
+
+	TP_printk("%s overflows=%lu dropped=%u", __entry->name, __entry->overflows,
+		  __entry->dropped)
+);
+
+/* Muestra descartada porque el consumidor no llego a leer (kfifo o anillo llenos) */
+TRACE_EVENT(mse_sample_drop,
+	TP_PROTO(const char *name, int where, u32 seq, u32 dropped),
+	TP_ARGS(name, where, seq, dropped),
+
+	TP_STRUCT__entry(
+		__array(char, name, MSE_TRACE_NAME)
+		__field(int, where)
+		__field(u32, seq)
+		__field(u32, dropped)
+	),
+
+	TP_fast_assign(
+		strscpy(__entry->name, name, MSE_TRACE_NAME);
+		__entry->where = where;
+		__entry->seq = seq;
+		__entry->dropped = dropped;
+	),
+
+	TP_printk("%s %s seq=%u dropped=%u", __entry->name,
+		  __print_symbolic(__entry->where, { MSE_DROP_KFIFO, "kfifo" }, { MSE_DROP_RING, "ring" }),
+		  __entry->seq, __entry->dropped)
+);
+
+#endif /* MPU9250_TRACE_H */
+
+/* Fuera de la guarda: define_trace.h vuelve a incluir este archivo desde el directorio del modulo */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mpu9250_trace
+#include <trace/define_trace.h>
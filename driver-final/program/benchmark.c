@@ -0,0 +1,440 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "mpu9250.h"
+
+// Usage: benchmark [device] [seconds] [read|fifo|ring|latest ...]
+// device as in execute (/dev/mseXX, /dev/i2c-N[:address], emu[:options]), by default /dev/mse00.
+// Runs each read strategy for the given seconds (2 by default) and prints one JSON document:
+//   read    streaming, one sample per read()
+//   fifo    streaming, every buffered sample per read()
+//   ring    streaming into the mmap ring (/dev/mseXX only)
+//   latest  latest value mode, polled once per sample period
+// For every strategy: sustained sample rate, backend calls, register transfers and syscalls per
+// sample, CPU per sample and the latency histogram of each stage (wait, read, convert, output and
+// age, the time from the acquisition timestamp to the end of the output; with emu only at speed=1).
+
+#define BENCH_SECONDS          2.0
+#define BENCH_MAX_SAMPLES      MSE_RING_SAMPLES
+#define BENCH_WAIT_MS          100
+#define BENCH_LINE_BYTES       160
+
+enum { STAGE_WAIT, STAGE_READ, STAGE_CONVERT, STAGE_OUTPUT, STAGE_AGE, STAGE_COUNT };
+
+static const char *const stageNames[STAGE_COUNT] = { "wait", "read", "convert", "output", "age" };
+
+typedef struct {
+	const char *name;
+	bool supported;
+	uint64_t samples;
+	uint64_t calls;
+	uint64_t transfers;
+	double seconds;
+	double userNs;
+	double sysNs;
+	MPU9250_histogram_t stage[STAGE_COUNT];
+} result_t;
+
+typedef struct {
+	MPU9250_control_t imu;
+	MPU9250_rawBlock_t raw;
+	MPU9250_block_t converted;
+	struct mse_sample samples[BENCH_MAX_SAMPLES];
+	int ringCount;
+	char output[BENCH_MAX_SAMPLES * BENCH_LINE_BYTES];
+	int outputFd;
+	result_t *result;
+} bench_t;
+
+static bench_t bench;
+
+// Backend of the device wrapped to count what the library asks from it
+static const MPU9250_transport_t *base;
+static MPU9250_transport_t counting;
+static uint64_t calls, transfers;
+
+
+static bool countOpen(MPU9250_control_t *handler, const char *device)
+{
+	return base->open(handler, device);
+}
+
+static void countClose(MPU9250_control_t *handler)
+{
+	base->close(handler);
+}
+
+// Register level backends do their transfers themselves, the character device in the driver
+static bool countReadRegs(MPU9250_control_t *handler, unsigned char reg, unsigned short count, unsigned char *dest)
+{
+	if (base->writeReg != NULL) {
+		transfers++;
+	} else {
+		calls++;
+	}
+	return base->readRegs(handler, reg, count, dest);
+}
+
+static bool countWriteReg(MPU9250_control_t *handler, unsigned char reg, unsigned char value)
+{
+	transfers++;
+	return base->writeReg(handler, reg, value);
+}
+
+static bool countRunBatch(MPU9250_control_t *handler, const struct mse_reg_op *ops, unsigned int count, unsigned int *done)
+{
+	calls++;
+	return base->runBatch(handler, ops, count, done);
+}
+
+static bool countCommand(MPU9250_control_t *handler, unsigned int cmd, unsigned long arg)
+{
+	calls++;
+	return base->command(handler, cmd, arg);
+}
+
+static int countReadSamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples)
+{
+	calls++;
+	return base->readSamples(handler, samples, maxSamples);
+}
+
+static int countWait(MPU9250_control_t *handler, int timeoutMs)
+{
+	calls++;
+	return base->wait(handler, timeoutMs);
+}
+
+static bool countMapRing(MPU9250_control_t *handler)
+{
+	calls++;
+	return base->mapRing(handler);
+}
+
+static void countingTransport(const char *device)
+{
+	base = mpu9250TransportFor(device);
+	counting = *base;
+	counting.open = countOpen;
+	counting.close = countClose;
+	counting.readRegs = countReadRegs;
+	counting.writeReg = base->writeReg ? countWriteReg : NULL;
+	counting.runBatch = countRunBatch;
+	counting.command = countCommand;
+	counting.readSamples = countReadSamples;
+	counting.wait = countWait;
+	counting.mapRing = base->mapRing ? countMapRing : NULL;
+}
+
+// Convert and print a batch of samples, the same work for every strategy
+static void processSamples(const struct mse_sample *samples, int count)
+{
+	result_t *result = bench.result;
+	size_t used = 0;
+	uint64_t t0, t1, t2;
+	int i;
+
+	t0 = mpu9250MetricsNow();
+	bench.raw.count = 0;
+	mpu9250RawBlockAppend(&bench.raw, samples, count);
+	mpu9250ConvertBlock(&bench.imu, &bench.raw, &bench.converted);
+	t1 = mpu9250MetricsNow();
+	for (i = 0; i < count; i++) {
+		used += snprintf(bench.output + used, sizeof(bench.output) - used,
+		                 "%llu %u %.4f %.4f %.4f %.5f %.5f %.5f %.3f %.3f %.3f %.2f\n",
+		                 (unsigned long long)samples[i].timestamp_ns, samples[i].seq,
+		                 bench.converted.ax[i], bench.converted.ay[i], bench.converted.az[i],
+		                 bench.converted.gx[i], bench.converted.gy[i], bench.converted.gz[i],
+		                 bench.converted.hx[i], bench.converted.hy[i], bench.converted.hz[i], bench.converted.t[i]);
+	}
+	if (write(bench.outputFd, bench.output, used) < 0) {
+		perror("write");
+	}
+	t2 = mpu9250MetricsNow();
+
+	mpu9250MetricsHistogramAdd(&result->stage[STAGE_CONVERT], t1 - t0);
+	mpu9250MetricsHistogramAdd(&result->stage[STAGE_OUTPUT], t2 - t1);
+	for (i = 0; i < count; i++) {
+		mpu9250MetricsHistogramAdd(&result->stage[STAGE_AGE], (t2 > samples[i].timestamp_ns) ? t2 - samples[i].timestamp_ns : 0);
+	}
+	result->samples += count;
+}
+
+// Ring callback: gather the samples so they are converted and printed as one batch, like the others
+static void ringCollect(MPU9250_control_t *handler, const struct mse_sample *sample)
+{
+	bench_t *owner = (bench_t *)((char *)handler - offsetof(bench_t, imu));
+
+	if (owner->ringCount < BENCH_MAX_SAMPLES) {
+		owner->samples[owner->ringCount++] = *sample;
+	}
+}
+
+// read, fifo and ring: wait for the driver, then take everything it has
+static bool runStreaming(double seconds, int perRead, bool ring)
+{
+	MPU9250_control_t *handler = &bench.imu;
+	result_t *result = bench.result;
+	uint64_t end, t0, t1;
+	int count;
+
+	if (ring && !mpu9250MapRing(handler)) {
+		return false;
+	}
+	if (!mpu9250StartStreaming(handler)) {
+		mpu9250UnmapRing(handler);
+		return false;
+	}
+
+	end = mpu9250MetricsNow() + (uint64_t)(seconds * 1e9);
+	while (mpu9250MetricsNow() < end) {
+		t0 = mpu9250MetricsNow();
+		count = mpu9250WaitData(handler, BENCH_WAIT_MS);
+		mpu9250MetricsHistogramAdd(&result->stage[STAGE_WAIT], mpu9250MetricsNow() - t0);
+		if (count <= 0) {
+			continue;
+		}
+		do {
+			t0 = mpu9250MetricsNow();
+			if (ring) {
+				bench.ringCount = 0;
+				mpu9250ConsumeRing(handler, ringCollect);
+				count = bench.ringCount;
+			} else {
+				count = mpu9250ReadSamples(handler, bench.samples, perRead);
+			}
+			t1 = mpu9250MetricsNow();
+			if (count <= 0) {
+				break;
+			}
+			mpu9250MetricsHistogramAdd(&result->stage[STAGE_READ], t1 - t0);
+			processSamples(bench.samples, count);
+		} while (!ring && count == perRead);
+	}
+
+	mpu9250StopStreaming(handler);
+	mpu9250UnmapRing(handler);
+	return true;
+}
+
+// latest: one read per sample period, only new samples (by seq) go on
+static bool runLatest(double seconds)
+{
+	MPU9250_control_t *handler = &bench.imu;
+	result_t *result = bench.result;
+	uint64_t period = (uint64_t)(handler->_srd + 1) * 1000000, end, next, t0, t1;
+	struct timespec wake;
+	struct mse_sample sample;
+	bool first = true;
+	uint32_t lastSeq = 0;
+
+	if (!mpu9250StartLatest(handler, 0)) {
+		return false;
+	}
+	next = mpu9250MetricsNow();
+	end = next + (uint64_t)(seconds * 1e9);
+	while (mpu9250MetricsNow() < end) {
+		t0 = mpu9250MetricsNow();
+		next += period;
+		wake.tv_sec = next / 1000000000ull;
+		wake.tv_nsec = next % 1000000000ull;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+		t1 = mpu9250MetricsNow();
+		mpu9250MetricsHistogramAdd(&result->stage[STAGE_WAIT], t1 - t0);
+
+		if (mpu9250ReadSamples(handler, &sample, 1) != 1) {
+			continue;
+		}
+		mpu9250MetricsHistogramAdd(&result->stage[STAGE_READ], mpu9250MetricsNow() - t1);
+		if (first || sample.seq != lastSeq) {
+			processSamples(&sample, 1);
+		}
+		first = false;
+		lastSeq = sample.seq;
+	}
+	mpu9250StopLatest(handler);
+	return true;
+}
+
+static double rusageNs(const struct timeval *tv)
+{
+	return tv->tv_sec * 1e9 + tv->tv_usec * 1e3;
+}
+
+static void runStrategy(result_t *result, double seconds)
+{
+	struct rusage before, after;
+	uint64_t start, callsBefore = calls, transfersBefore = transfers;
+
+	memset(result->stage, 0, sizeof(result->stage));
+	bench.result = result;
+	getrusage(RUSAGE_SELF, &before);
+	start = mpu9250MetricsNow();
+
+	if (strcmp(result->name, "read") == 0) {
+		result->supported = runStreaming(seconds, 1, false);
+	} else if (strcmp(result->name, "fifo") == 0) {
+		result->supported = runStreaming(seconds, BENCH_MAX_SAMPLES, false);
+	} else if (strcmp(result->name, "ring") == 0) {
+		result->supported = runStreaming(seconds, 0, true);
+	} else if (strcmp(result->name, "latest") == 0) {
+		result->supported = runLatest(seconds);
+	}
+
+	result->seconds = (mpu9250MetricsNow() - start) / 1e9;
+	getrusage(RUSAGE_SELF, &after);
+	result->userNs = rusageNs(&after.ru_utime) - rusageNs(&before.ru_utime);
+	result->sysNs = rusageNs(&after.ru_stime) - rusageNs(&before.ru_stime);
+	result->calls = calls - callsBefore;
+	result->transfers = transfers - transfersBefore;
+}
+
+static void printString(const char *text)
+{
+	putchar('"');
+	for (; *text != '\0'; text++) {
+		if (*text == '"' || *text == '\\') {
+			putchar('\\');
+		}
+		putchar(*text);
+	}
+	putchar('"');
+}
+
+static void printHistogram(const MPU9250_histogram_t *hist)
+{
+	unsigned int i;
+	bool first = true;
+
+	printf("{\"count\": %llu, \"mean_ns\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+	       "\"max_ns\": %llu, \"histogram\": [",
+	       (unsigned long long)hist->count, hist->count ? (double)hist->sumNs / hist->count : 0.0,
+	       (unsigned long long)mpu9250MetricsPercentile(hist, 0.50),
+	       (unsigned long long)mpu9250MetricsPercentile(hist, 0.99),
+	       (unsigned long long)mpu9250MetricsPercentile(hist, 0.999), (unsigned long long)hist->maxNs);
+	// [largest value of the bucket, count] for every bucket used
+	for (i = 0; i < MPU9250_METRICS_BUCKETS; i++) {
+		if (hist->buckets[i] != 0) {
+			printf("%s[%llu, %llu]", first ? "" : ", ", (unsigned long long)mpu9250MetricsBucketUpper(i),
+			       (unsigned long long)hist->buckets[i]);
+			first = false;
+		}
+	}
+	printf("]}");
+}
+
+static void printResult(const result_t *result, bool last)
+{
+	double samples = result->samples ? (double)result->samples : 1.0;
+	// the character device does one syscall per call, /dev/i2c-N one per register transfer
+	double syscalls = (base == &mpu9250CharDevTransport) ? result->calls :
+	                  (base == &mpu9250I2cDevTransport) ? result->transfers : 0.0;
+	int i;
+
+	printf("    {\"name\": ");
+	printString(result->name);
+	printf(", \"supported\": %s", result->supported ? "true" : "false");
+	if (result->supported) {
+		printf(", \"samples\": %llu, \"seconds\": %.3f, \"sample_rate\": %.1f,\n",
+		       (unsigned long long)result->samples, result->seconds, result->samples / result->seconds);
+		printf("     \"calls_per_sample\": %.3f, \"transfers_per_sample\": %.3f, \"syscalls_per_sample\": %.3f,\n",
+		       result->calls / samples, result->transfers / samples, syscalls / samples);
+		printf("     \"cpu_ns_per_sample\": %.0f, \"user_ns_per_sample\": %.0f, \"sys_ns_per_sample\": %.0f,\n",
+		       (result->userNs + result->sysNs) / samples, result->userNs / samples, result->sysNs / samples);
+		printf("     \"stages\": {");
+		for (i = 0; i < STAGE_COUNT; i++) {
+			printf("%s\n       \"%s\": ", i ? "," : "", stageNames[i]);
+			printHistogram(&result->stage[i]);
+		}
+		printf("}");
+	}
+	printf("}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *const allStrategies[] = { "read", "fifo", "ring", "latest" };
+	static result_t results[4];
+	const char *device = (argc > 1) ? argv[1] : "/dev/mse00";
+	double seconds = (argc > 2) ? strtod(argv[2], NULL) : BENCH_SECONDS;
+	MPU9250_control_t *handler = &bench.imu;
+	int count = 0, i, j, jsonFd;
+	uint64_t t0, initNs, calNs;
+	char status;
+
+	for (i = 3; i < argc && count < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			if (strcmp(argv[i], allStrategies[j]) == 0) {
+				results[count++].name = allStrategies[j];
+			}
+		}
+	}
+	if (count == 0) {
+		for (j = 0; j < 4; j++) {
+			results[count++].name = allStrategies[j];
+		}
+	}
+	if (seconds <= 0) {
+		seconds = BENCH_SECONDS;
+	}
+
+	bench.outputFd = open("/dev/null", O_WRONLY);
+	if (bench.outputFd < 0 || !mpu9250RawBlockAlloc(&bench.raw, BENCH_MAX_SAMPLES) ||
+	    !mpu9250BlockAlloc(&bench.converted, BENCH_MAX_SAMPLES)) {
+		fprintf(stderr, "Error preparing the benchmark\n");
+		return -1;
+	}
+
+	// the library reports its errors on stdout, keep it for the JSON only
+	fflush(stdout);
+	jsonFd = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	// initialization and calibration without the calibration cache, the full cold start
+	countingTransport(device);
+	t0 = mpu9250MetricsNow();
+	if (!mpu9250OpenTransport(handler, &counting, device)) {
+		return -1;
+	}
+	mpu9250SetCalibrationFile(handler, NULL);
+	status = mpu9250Init(handler);
+	initNs = mpu9250MetricsNow() - t0;
+	if (status < 0) {
+		fprintf(stderr, "Error on initialization of %s with error = %d\n", device, status);
+		mpu9250Close(handler);
+		return -1;
+	}
+	t0 = mpu9250MetricsNow();
+	status = mpu9250CalibrateGyroFast(handler, MPU9250_FAST_CAL_SAMPLES);
+	calNs = mpu9250MetricsNow() - t0;
+
+	for (i = 0; i < count; i++) {
+		runStrategy(&results[i], seconds);
+	}
+	fflush(stdout);
+	dup2(jsonFd, STDOUT_FILENO);
+	close(jsonFd);
+
+	printf("{\n  \"device\": ");
+	printString(device);
+	printf(",\n  \"transport\": ");
+	printString(base->name);
+	printf(",\n  \"sample_period_us\": %u, \"init_ms\": %.3f, \"calibration_ms\": %.3f, \"calibration_status\": %d,\n",
+	       (handler->_srd + 1) * 1000, initNs / 1e6, calNs / 1e6, status);
+	printf("  \"strategies\": [\n");
+	for (i = 0; i < count; i++) {
+		printResult(&results[i], i == count - 1);
+	}
+	printf("  ]\n}\n");
+
+	mpu9250Close(handler);
+	mpu9250RawBlockFree(&bench.raw);
+	mpu9250BlockFree(&bench.converted);
+	close(bench.outputFd);
+	return 0;
+}
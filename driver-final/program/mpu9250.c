@@ -0,0 +1,1079 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "mpu9250.h"
+
+// physical constants
+#define MPU9250_G                     9.807f
+#define MPU9250_D2R                   3.14159265359f/180.0f
+
+// MPU9250 registers
+#define MPU9250_ACCEL_OUT             0x3B
+#define MPU9250_GYRO_OUT              0x43
+#define MPU9250_TEMP_OUT              0x41
+#define MPU9250_EXT_SENS_DATA_00      0x49
+#define MPU9250_ACCEL_CONFIG 	      0x1C
+#define MPU9250_ACCEL_FS_SEL_2G       0x00
+#define MPU9250_ACCEL_FS_SEL_4G       0x08
+#define MPU9250_ACCEL_FS_SEL_8G       0x10
+#define MPU9250_ACCEL_FS_SEL_16G      0x18
+#define MPU9250_GYRO_CONFIG           0x1B
+#define MPU9250_GYRO_FS_SEL_250DPS    0x00
+#define MPU9250_GYRO_FS_SEL_500DPS    0x08
+#define MPU9250_GYRO_FS_SEL_1000DPS   0x10
+#define MPU9250_GYRO_FS_SEL_2000DPS   0x18
+
+#define MPU9250_ACCEL_CONFIG2         0x1D
+#define MPU9250_ACCEL_DLPF_184        0x01
+#define MPU9250_ACCEL_DLPF_92         0x02
+#define MPU9250_ACCEL_DLPF_41         0x03
+#define MPU9250_ACCEL_DLPF_20         0x04
+#define MPU9250_ACCEL_DLPF_10         0x05
+#define MPU9250_ACCEL_DLPF_5          0x06
+#define MPU9250_CONFIG                0x1A
+#define MPU9250_GYRO_DLPF_184         0x01
+#define MPU9250_GYRO_DLPF_92          0x02
+#define MPU9250_GYRO_DLPF_41          0x03
+#define MPU9250_GYRO_DLPF_20          0x04
+#define MPU9250_GYRO_DLPF_10          0x05
+#define MPU9250_GYRO_DLPF_5           0x06
+#define MPU9250_SMPDIV                0x19
+#define MPU9250_INT_PIN_CFG           0x37
+#define MPU9250_INT_ENABLE            0x38
+#define MPU9250_INT_DISABLE           0x00
+#define MPU9250_INT_PULSE_50US        0x00
+#define MPU9250_INT_WOM_EN            0x40
+#define MPU9250_INT_RAW_RDY_EN        0x01
+#define MPU9250_PWR_MGMNT_1           0x6B
+#define MPU9250_PWR_CYCLE             0x20
+#define MPU9250_PWR_RESET             0x80
+#define MPU9250_CLOCK_SEL_PLL         0x01
+#define MPU9250_PWR_MGMNT_2           0x6C
+#define MPU9250_SEN_ENABLE            0x00
+#define MPU9250_DIS_GYRO              0x07
+#define MPU9250_USER_CTRL             0x6A
+#define MPU9250_I2C_MST_EN            0x20
+#define MPU9250_I2C_MST_CLK           0x0D
+#define MPU9250_I2C_MST_CTRL          0x24
+#define MPU9250_I2C_SLV0_ADDR         0x25
+#define MPU9250_I2C_SLV0_REG          0x26
+#define MPU9250_I2C_SLV0_DO           0x63
+#define MPU9250_I2C_SLV0_CTRL         0x27
+#define MPU9250_I2C_SLV0_EN           0x80
+#define MPU9250_I2C_READ_FLAG         0x80
+#define MPU9250_MOT_DETECT_CTRL       0x69
+#define MPU9250_ACCEL_INTEL_EN        0x80
+#define MPU9250_ACCEL_INTEL_MODE      0x40
+#define MPU9250_LP_ACCEL_ODR          0x1E
+#define MPU9250_WOM_THR               0x1F
+#define MPU9250_WHO_AM_I              0x75
+#define MPU9250_FIFO_EN               0x23
+#define MPU9250_FIFO_TEMP             0x80
+#define MPU9250_FIFO_GYRO             0x70
+#define MPU9250_FIFO_ACCEL            0x08
+#define MPU9250_FIFO_MAG              0x01
+#define MPU9250_FIFO_COUNT            0x72
+#define MPU9250_FIFO_READ             0x74
+
+// AK8963 registers
+#define MPU9250_AK8963_I2C_ADDR       0x0C
+#define MPU9250_AK8963_HXL            0x03
+#define MPU9250_AK8963_CNTL1          0x0A
+#define MPU9250_AK8963_PWR_DOWN       0x00
+#define MPU9250_AK8963_CNT_MEAS1      0x12
+#define MPU9250_AK8963_CNT_MEAS2      0x16
+#define MPU9250_AK8963_FUSE_ROM       0x0F
+#define MPU9250_AK8963_CNTL2          0x0B
+#define MPU9250_AK8963_RESET          0x01
+#define MPU9250_AK8963_ASA            0x10
+#define MPU9250_AK8963_WHO_AM_I       0x00
+#define MPU9250_AK8963_HOFL           0x08
+
+// Scale of each range, the FS_SEL field of ACCEL_CONFIG/GYRO_CONFIG is the range enum value
+#define MPU9250_ACCEL_SCALE(range)    (MPU9250_G * (float)(2 << (range)) / 32767.5f)
+#define MPU9250_GYRO_SCALE(range)     ((float)(250 << (range)) / 32767.5f * MPU9250_D2R)
+#define MPU9250_FS_SEL(range)         ((unsigned char)((range) << 3))
+
+// Ranges written by mpu9250Init, the fixed ones when the build pins them
+#ifdef MPU9250_FIXED_ACCEL_RANGE
+#define MPU9250_INIT_ACCEL_RANGE      MPU9250_FIXED_ACCEL_RANGE
+#else
+#define MPU9250_INIT_ACCEL_RANGE      MPU9250_ACCEL_RANGE_16G
+#endif
+#ifdef MPU9250_FIXED_GYRO_RANGE
+#define MPU9250_INIT_GYRO_RANGE       MPU9250_FIXED_GYRO_RANGE
+#else
+#define MPU9250_INIT_GYRO_RANGE       MPU9250_GYRO_RANGE_2000DPS
+#endif
+
+// Fast gyro calibration: samples skipped after the range change and largest standard deviation
+// accepted while still (the sensor noise is around 0.14 dps and 0.04 m/s2 at 184 Hz)
+#define MPU9250_FAST_CAL_SETTLE       8
+#define MPU9250_FAST_CAL_GYRO_STD     (0.5f * MPU9250_D2R)
+#define MPU9250_FAST_CAL_ACCEL_STD    0.2f
+#define MPU9250_FAST_CAL_TIMEOUT_MS   100
+
+// Waits used inside the register batches executed by the driver
+#define MPU9250_SLV0_DELAY_US(srd)    (((srd) + 2) * 1000) // SLV0 runs once per sample
+#define MPU9250_AK8963_MODE_DELAY_US  10000                // datasheet asks for 100 us
+#define MPU9250_RESET_DELAY_US        10000
+
+//Register sequence executed by the driver in a single ioctl (MSE_IOC_WRITE_BATCH)
+typedef struct {
+   struct mse_reg_op ops[MSE_REG_BATCH_MAX];
+   unsigned int count;
+   unsigned int slv0Delay;
+} MPU9250_batch_t;
+
+static bool mpu9250ReadRegisters(MPU9250_control_t *handler, unsigned char subAddress, unsigned char count);
+static bool mpu9250ReadRegistersTo(MPU9250_control_t *handler, unsigned char subAddress, unsigned short count, unsigned char *dest);
+static bool mpu9250WriteRegister(MPU9250_control_t *handler, unsigned char subAddress, unsigned char data);
+static void mpu9250BatchBegin(MPU9250_batch_t *batch, unsigned char srd);
+static void mpu9250BatchAdd(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data,
+                            unsigned char mask, unsigned char flags, unsigned int delayUs);
+static void mpu9250BatchWrite(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data);
+static void mpu9250BatchExpect(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data, unsigned char mask);
+static void mpu9250BatchDelay(MPU9250_batch_t *batch, unsigned int delayUs);
+static void mpu9250BatchReadAK8963(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char count);
+static void mpu9250BatchWriteAK8963(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data, bool verify);
+static bool mpu9250BatchRun(MPU9250_control_t *handler, MPU9250_batch_t *batch);
+static void mpu9250InitializeControlStructure(MPU9250_control_t *handler);
+static void mpu9250ConvertCounts(MPU9250_control_t *handler);
+
+
+// Open one IMU, every other function works on the returned handle
+bool mpu9250Open(MPU9250_control_t *handler, const char *device)
+{
+	return mpu9250OpenTransport(handler, mpu9250TransportFor(device), device);
+}
+
+// Open one IMU through the given backend, whatever its name looks like
+bool mpu9250OpenTransport(MPU9250_control_t *handler, const MPU9250_transport_t *transport, const char *device)
+{
+	memset(handler, 0, sizeof(*handler));
+	snprintf(handler->_device, sizeof(handler->_device), "%s", device);
+	handler->_fd = -1;
+	handler->_transport = transport;
+	if (!transport->open(handler, device)) {
+		handler->_transport = NULL;
+		return false;
+	}
+	return true;
+}
+
+void mpu9250Close(MPU9250_control_t *handler)
+{
+	mpu9250ReplayClose(handler);
+	mpu9250UnmapRing(handler);
+	if (handler->_transport != NULL) {
+		handler->_transport->close(handler);
+		handler->_transport = NULL;
+	}
+}
+
+static bool mpu9250ReadRegisters(MPU9250_control_t *handler, unsigned char subAddress, unsigned char count)
+{
+	if (count > sizeof(handler->_buffer)) {
+		return false;
+	}
+	return mpu9250ReadRegistersTo(handler, subAddress, count, handler->_buffer);
+}
+
+// Write the sub address and read count bytes with a repeated start, one transfer
+static bool mpu9250ReadRegistersTo(MPU9250_control_t *handler, unsigned char subAddress, unsigned short count, unsigned char *dest)
+{
+	uint64_t start = (handler->_metrics != NULL) ? mpu9250MetricsNow() : 0;
+	bool ok = handler->_transport->readRegs(handler, subAddress, count, dest);
+
+	if (handler->_metrics != NULL) {
+		mpu9250MetricsRegisterRead(handler, start, ok);
+	}
+	if (!ok) {
+		printf("Error mpu9250ReadRegisters on reading operation\n ");
+		return false;
+	}
+
+	return true;
+}
+
+static bool mpu9250WriteRegister(MPU9250_control_t *handler, unsigned char subAddress, unsigned char data)
+{
+	MPU9250_batch_t batch;
+
+	/* the driver writes and reads back the register in the same call */
+	mpu9250BatchBegin(&batch, handler->_srd);
+	mpu9250BatchWrite(&batch, subAddress, data);
+	return mpu9250BatchRun(handler, &batch);
+}
+
+static void mpu9250BatchBegin(MPU9250_batch_t *batch, unsigned char srd)
+{
+	batch->count = 0;
+	batch->slv0Delay = MPU9250_SLV0_DELAY_US(srd);
+}
+
+static void mpu9250BatchAdd(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data,
+                            unsigned char mask, unsigned char flags, unsigned int delayUs)
+{
+	struct mse_reg_op *op;
+
+	// an overflowed batch is rejected by mpu9250BatchRun(handler)
+	if (batch->count >= MSE_REG_BATCH_MAX) {
+		batch->count = MSE_REG_BATCH_MAX + 1;
+		return;
+	}
+	op = &batch->ops[batch->count++];
+	op->reg = subAddress;
+	op->val = data;
+	op->mask = mask;
+	op->flags = flags;
+	op->delay_us = delayUs;
+}
+
+// Queue a register write checked by reading it back
+static void mpu9250BatchWrite(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data)
+{
+	mpu9250BatchAdd(batch, subAddress, data, 0xFF, MSE_REG_OP_VERIFY, 0);
+}
+
+// Queue a register check (only the bits in mask) without writing it
+static void mpu9250BatchExpect(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data, unsigned char mask)
+{
+	mpu9250BatchAdd(batch, subAddress, data, mask, MSE_REG_OP_EXPECT, 0);
+}
+
+// Wait after the last queued operation
+static void mpu9250BatchDelay(MPU9250_batch_t *batch, unsigned int delayUs)
+{
+	if ((batch->count > 0) && (batch->count <= MSE_REG_BATCH_MAX)) {
+		batch->ops[batch->count - 1].delay_us += delayUs;
+	}
+}
+
+// Queue the SLV0 setup that reads count bytes of the AK8963 into EXT_SENS_DATA at the sample rate
+static void mpu9250BatchReadAK8963(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char count)
+{
+	// set slave 0 to the AK8963 and set for read
+	mpu9250BatchWrite(batch, MPU9250_I2C_SLV0_ADDR, MPU9250_AK8963_I2C_ADDR | MPU9250_I2C_READ_FLAG);
+	// set the register to the desired AK8963 sub address
+	mpu9250BatchWrite(batch, MPU9250_I2C_SLV0_REG, subAddress);
+	// enable I2C and request the bytes, takes some time for these registers to fill
+	mpu9250BatchAdd(batch, MPU9250_I2C_SLV0_CTRL, MPU9250_I2C_SLV0_EN | count, 0xFF, MSE_REG_OP_VERIFY,
+	                batch->slv0Delay);
+}
+
+// Queue an AK8963 register write through SLV0, optionally confirmed by reading it back
+static void mpu9250BatchWriteAK8963(MPU9250_batch_t *batch, unsigned char subAddress, unsigned char data, bool verify)
+{
+	// set slave 0 to the AK8963 and set for write
+	mpu9250BatchWrite(batch, MPU9250_I2C_SLV0_ADDR, MPU9250_AK8963_I2C_ADDR);
+	// set the register to the desired AK8963 sub address
+	mpu9250BatchWrite(batch, MPU9250_I2C_SLV0_REG, subAddress);
+	// store the data for write
+	mpu9250BatchWrite(batch, MPU9250_I2C_SLV0_DO, data);
+	// enable I2C and send 1 byte
+	mpu9250BatchAdd(batch, MPU9250_I2C_SLV0_CTRL, MPU9250_I2C_SLV0_EN | (uint8_t)1, 0xFF, MSE_REG_OP_VERIFY,
+	                batch->slv0Delay);
+	if (verify) {
+		// read the register and confirm
+		mpu9250BatchReadAK8963(batch, subAddress, 1);
+		mpu9250BatchExpect(batch, MPU9250_EXT_SENS_DATA_00, data, 0xFF);
+	}
+}
+
+// Run the whole sequence at once (in the driver under one bus lock for the character device)
+static bool mpu9250BatchRun(MPU9250_control_t *handler, MPU9250_batch_t *batch)
+{
+	unsigned int done = 0;
+
+	if (batch->count > MSE_REG_BATCH_MAX) {
+		printf("Register batch too long\n");
+		return false;
+	}
+
+	if (!handler->_transport->runBatch(handler, batch->ops, batch->count, &done)) {
+		if (done < batch->count) {
+			printf("Error in register batch at entry %u (register 0x%02X)\n", done,
+			       batch->ops[done].reg);
+		} else {
+			printf("Error running register batch\n");
+		}
+		return false;
+	}
+	return true;
+}
+
+char mpu9250SetSrd(MPU9250_control_t *handler, unsigned char srd)
+{
+	MPU9250_batch_t batch;
+
+	/* setting the sample rate divider to 19 to facilitate setting up 
+      magnetometer */
+	mpu9250BatchBegin(&batch, 19);
+	mpu9250BatchWrite(&batch, MPU9250_SMPDIV, 19);
+	// set AK8963 to Power Down
+	mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN, true);
+	mpu9250BatchDelay(&batch, MPU9250_AK8963_MODE_DELAY_US);
+	if (srd > 9) {
+		// set AK8963 to 16 bit resolution, 8 Hz update rate
+		mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS1, true);
+	} else {
+		// set AK8963 to 16 bit resolution, 100 Hz update rate
+		mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS2, true);
+	}
+	mpu9250BatchDelay(&batch, MPU9250_AK8963_MODE_DELAY_US);
+	// instruct the MPU9250 to get 7 bytes of data from the AK8963 at the sample rate
+	mpu9250BatchReadAK8963(&batch, MPU9250_AK8963_HXL, 7);
+	/* setting the sample rate divider */
+	mpu9250BatchWrite(&batch, MPU9250_SMPDIV, srd);
+
+	if (!mpu9250BatchRun(handler, &batch)) {
+		return -1;
+	}
+	handler->_srd = srd;
+	return 1;
+}
+
+char mpu9250SetDlpfBandwidth(MPU9250_control_t *handler, MPU9250_DlpfBandwidth_t bandwidth)
+{
+	MPU9250_batch_t batch;
+
+	mpu9250BatchBegin(&batch, handler->_srd);
+	switch (bandwidth) {
+		case MPU9250_DLPF_BANDWIDTH_184HZ: {
+         // setting accel bandwidth to 184Hz
+			mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_184);
+         // setting gyro bandwidth to 184Hz
+			mpu9250BatchWrite(&batch, MPU9250_CONFIG, MPU9250_GYRO_DLPF_184);
+			break;
+		}
+		case MPU9250_DLPF_BANDWIDTH_92HZ: {
+         // setting accel bandwidth to 92Hz
+			mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_92);
+         // setting gyro bandwidth to 92Hz
+			mpu9250BatchWrite(&batch, MPU9250_CONFIG, MPU9250_GYRO_DLPF_92);
+			break;
+		}
+		case MPU9250_DLPF_BANDWIDTH_41HZ: {
+         // setting accel bandwidth to 41Hz
+			mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_41);
+         // setting gyro bandwidth to 41Hz
+			mpu9250BatchWrite(&batch, MPU9250_CONFIG, MPU9250_GYRO_DLPF_41);
+			break;
+		}
+		case MPU9250_DLPF_BANDWIDTH_20HZ: {
+         // setting accel bandwidth to 20Hz
+			mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_20);
+         // setting gyro bandwidth to 20Hz
+			mpu9250BatchWrite(&batch, MPU9250_CONFIG, MPU9250_GYRO_DLPF_20);
+			break;
+		}
+		case MPU9250_DLPF_BANDWIDTH_10HZ: {
+         // setting accel bandwidth to 10Hz
+			mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_10);
+         // setting gyro bandwidth to 10Hz
+			mpu9250BatchWrite(&batch, MPU9250_CONFIG, MPU9250_GYRO_DLPF_10);
+			break;
+		}
+		case MPU9250_DLPF_BANDWIDTH_5HZ: {
+         // setting accel bandwidth to 5Hz
+			mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_5);
+         // setting gyro bandwidth to 5Hz
+			mpu9250BatchWrite(&batch, MPU9250_CONFIG, MPU9250_GYRO_DLPF_5);
+			break;
+		}
+	}
+	if (!mpu9250BatchRun(handler, &batch)) {
+		return -1;
+	}
+	handler->_bandwidth = bandwidth;
+	return 1;
+}
+
+bool mpu9250SetGyroRange(MPU9250_control_t *handler, MPU9250_GyroRange_t range)
+{
+#ifdef MPU9250_FIXED_GYRO_RANGE
+	// the scale is part of the build, only the fixed range is accepted
+	if (range != MPU9250_FIXED_GYRO_RANGE) {
+		return false;
+	}
+#endif
+	switch(range) {
+		case MPU9250_GYRO_RANGE_250DPS: {
+		  // setting the gyro range to 250DPS
+		  if(!mpu9250WriteRegister(handler, MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_250DPS)){
+			return false;
+		  }
+        // setting the gyro scale to 250DPS
+		  handler->_gyroScale = MPU9250_GYRO_SCALE(MPU9250_GYRO_RANGE_250DPS);
+		  break;
+		}
+		case MPU9250_GYRO_RANGE_500DPS: {
+		  // setting the gyro range to 500DPS
+		  if(!mpu9250WriteRegister(handler, MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_500DPS)){
+			return false;
+		  }
+        // setting the gyro scale to 500DPS
+		  handler->_gyroScale = MPU9250_GYRO_SCALE(MPU9250_GYRO_RANGE_500DPS);
+		  break;
+		}
+		case MPU9250_GYRO_RANGE_1000DPS: {
+		  // setting the gyro range to 1000DPS
+		  if(!mpu9250WriteRegister(handler, MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_1000DPS)){
+			return false;
+		  }
+        // setting the gyro scale to 1000DPS
+		  handler->_gyroScale = MPU9250_GYRO_SCALE(MPU9250_GYRO_RANGE_1000DPS);
+		  break;
+		}
+		case MPU9250_GYRO_RANGE_2000DPS: {
+		  // setting the gyro range to 2000DPS
+		  if(!mpu9250WriteRegister(handler, MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_2000DPS)){
+			return false;
+		  }
+        // setting the gyro scale to 2000DPS
+		  handler->_gyroScale = MPU9250_GYRO_SCALE(MPU9250_GYRO_RANGE_2000DPS);
+		  break;
+		}
+	}
+	handler->_gyroRange = range;
+	mpu9250UpdateConversion(handler);
+	return true;
+}
+
+char mpu9250CalibrateGyro(MPU9250_control_t *handler)
+{
+	// set the range, bandwidth, and srd (a fixed gyro range is kept as it is)
+#ifndef MPU9250_FIXED_GYRO_RANGE
+	if (!mpu9250SetGyroRange(handler, MPU9250_GYRO_RANGE_250DPS)) {
+		return -1;
+	}
+#endif
+
+	if (mpu9250SetDlpfBandwidth(handler, MPU9250_DLPF_BANDWIDTH_20HZ) < 0) {
+		return -2;
+	}
+
+	if (mpu9250SetSrd(handler, 19) < 0) {
+		return -3;
+	}
+
+	// take samples and find bias
+	handler->_gxbD = 0;
+	handler->_gybD = 0;
+	handler->_gzbD = 0;
+
+	for (uint8_t i=0; i < handler->_numSamples; i++) {
+		mpu9250Read(handler);
+		handler->_gxbD += ((mpu9250GetGyroX_rads(handler) + handler->_gxb)/handler->_numSamples);
+		handler->_gybD += ((mpu9250GetGyroY_rads(handler) + handler->_gyb)/handler->_numSamples);
+		handler->_gzbD += ((mpu9250GetGyroZ_rads(handler) + handler->_gzb)/handler->_numSamples);
+		usleep(20000);
+	}
+
+	handler->_gxb = (float)handler->_gxbD;
+	handler->_gyb = (float)handler->_gybD;
+	handler->_gzb = (float)handler->_gzbD;
+	mpu9250UpdateConversion(handler);
+
+	// set the range, bandwidth, and srd back to what they were
+	if (!mpu9250SetGyroRange(handler, handler->_gyroRange)) {
+		return -4;
+	}
+
+	if (mpu9250SetDlpfBandwidth(handler, handler->_bandwidth) < 0) {
+		return -5;
+	}
+
+	if (mpu9250SetSrd(handler, handler->_srd) < 0) {
+		return -6;
+	}
+	return 1;
+}
+
+// Gyro bias from one streamed burst at the configured rate, with bias and variance computed in a
+// single pass (Welford). Returns MPU9250_CAL_MOTION and keeps the old bias if the IMU was moving.
+char mpu9250CalibrateGyroFast(MPU9250_control_t *handler, unsigned short numSamples)
+{
+	struct mse_sample samples[64];
+	MPU9250_GyroRange_t range = handler->_gyroRange;
+	const float oldBias[3] = { handler->_gxb, handler->_gyb, handler->_gzb };
+	double mean[6] = { 0 }, m2[6] = { 0 };
+	unsigned int n = 0, skip = MPU9250_FAST_CAL_SETTLE;
+	int count, i, k;
+	char status = 1;
+
+	// the samples come through read(), not through the ring
+	if (handler->_ring != NULL || numSamples < 2) {
+		return -1;
+	}
+
+	// finest range, the filter and sample rate already configured are kept
+#ifndef MPU9250_FIXED_GYRO_RANGE
+	if (!mpu9250SetGyroRange(handler, MPU9250_GYRO_RANGE_250DPS)) {
+		return -1;
+	}
+#endif
+	handler->_gxb = handler->_gyb = handler->_gzb = 0.0f;
+	mpu9250UpdateConversion(handler);
+
+	if (!mpu9250StartStreaming(handler)) {
+		status = -2;
+	}
+
+	while (status > 0 && n < numSamples) {
+		if (mpu9250WaitData(handler, MPU9250_FAST_CAL_TIMEOUT_MS) <= 0) {
+			printf("Timeout waiting for calibration samples\n");
+			status = -3;
+			break;
+		}
+		count = mpu9250ReadSamples(handler, samples, sizeof(samples) / sizeof(samples[0]));
+		if (count < 0) {
+			status = -3;
+			break;
+		}
+		for (i = 0; i < count && n < numSamples; i++) {
+			float x[6];
+
+			if (skip > 0) {
+				skip--;
+				continue;
+			}
+			mpu9250ProcessSample(handler, &samples[i]);
+			x[0] = handler->_gx; x[1] = handler->_gy; x[2] = handler->_gz;
+			x[3] = handler->_ax; x[4] = handler->_ay; x[5] = handler->_az;
+			n++;
+			for (k = 0; k < 6; k++) {
+				double delta = x[k] - mean[k];
+
+				mean[k] += delta / n;
+				m2[k] += delta * (x[k] - mean[k]);
+			}
+		}
+	}
+
+	if (status != -2) {
+		mpu9250StopStreaming(handler);
+	}
+
+	if (status > 0) {
+		for (k = 0; k < 6; k++) {
+			float limit = (k < 3) ? MPU9250_FAST_CAL_GYRO_STD : MPU9250_FAST_CAL_ACCEL_STD;
+
+			if (m2[k] / (n - 1) > (double)limit * limit) {
+				printf("Motion detected during gyro calibration\n");
+				status = MPU9250_CAL_MOTION;
+				break;
+			}
+		}
+	}
+
+	if (status > 0) {
+		handler->_gxb = (float)mean[0];
+		handler->_gyb = (float)mean[1];
+		handler->_gzb = (float)mean[2];
+		handler->_gxv = (float)(m2[0] / (n - 1));
+		handler->_gyv = (float)(m2[1] / (n - 1));
+		handler->_gzv = (float)(m2[2] / (n - 1));
+	} else {
+		handler->_gxb = oldBias[0];
+		handler->_gyb = oldBias[1];
+		handler->_gzb = oldBias[2];
+	}
+
+	// set the range back to what it was
+	if (!mpu9250SetGyroRange(handler, range) && status > 0) {
+		status = -4;
+	}
+	mpu9250UpdateConversion(handler);
+	return status;
+}
+
+char mpu9250WhoAmIAK8963(MPU9250_control_t *handler)
+{
+	// read the WHO AM I register
+	if (mpu9250ReadAK8963Registers(handler, MPU9250_AK8963_WHO_AM_I,1) < 0) {
+		return -1;
+	}
+	// return the register value
+	return handler->_buffer[0];
+}
+
+char mpu9250WhoAmI(MPU9250_control_t *handler)
+{
+	// read the WHO AM I register
+	if (!mpu9250ReadRegisters(handler, MPU9250_WHO_AM_I, 1)) {
+		return -1;
+	}
+
+	// return the register value
+	return handler->_buffer[0];
+}
+
+
+char mpu9250ReadAK8963Registers(MPU9250_control_t *handler, unsigned char subAddress, unsigned char data)
+{
+	MPU9250_batch_t batch;
+
+	mpu9250BatchBegin(&batch, handler->_srd);
+	mpu9250BatchReadAK8963(&batch, subAddress, data);
+	if (!mpu9250BatchRun(handler, &batch)) {
+		return -1;
+	}
+	// read the bytes off the MPU9250 EXT_SENS_DATA registers
+	handler->_status = mpu9250ReadRegisters(handler, MPU9250_EXT_SENS_DATA_00, data);
+	return handler->_status;
+}
+
+
+char mpu9250WriteAK8963Register(MPU9250_control_t *handler, unsigned char subAddress, unsigned char data)
+{
+	MPU9250_batch_t batch;
+
+	mpu9250BatchBegin(&batch, handler->_srd);
+	mpu9250BatchWriteAK8963(&batch, subAddress, data, true);
+	if (!mpu9250BatchRun(handler, &batch)) {
+		return -1;
+	}
+	return 1;
+}
+
+
+static void mpu9250InitializeControlStructure(MPU9250_control_t *handler)
+{
+	handler->_tempScale = 333.87f;
+	handler->_tempOffset = 21.0f;
+	handler->_numSamples = 100;
+	handler->_axs = 1.0f;
+	handler->_ays = 1.0f;
+	handler->_azs = 1.0f;
+	handler->_maxCounts = 1000;
+	handler->_deltaThresh = 0.3f;
+	handler->_coeff = 8;
+	handler->_hxs = 1.0f;
+	handler->_hys = 1.0f;
+	handler->_hzs = 1.0f;
+#ifdef MPU9250_FIXED_MOUNT
+	for (int j = 0; j < 3; j++) {
+		handler->tX[j] = MPU9250_MOUNT_T(MPU9250_MOUNT_X, j);
+		handler->tY[j] = MPU9250_MOUNT_T(MPU9250_MOUNT_Y, j);
+		handler->tZ[j] = MPU9250_MOUNT_T(MPU9250_MOUNT_Z, j);
+	}
+#else
+	handler->tX[0] = 0;
+	handler->tX[1] = 1;
+	handler->tX[2] = 0;
+	handler->tY[0] = 1;
+	handler->tY[1] = 0;
+	handler->tY[2] = 0;
+	handler->tZ[0] = 0;
+	handler->tZ[1] = 0;
+	handler->tZ[2] = -1;
+#endif
+}
+	
+char  mpu9250Init(MPU9250_control_t *handler)
+{
+	MPU9250_batch_t batch;
+
+	mpu9250InitializeControlStructure(handler);
+
+	// the scales and calibration of a replay come from its capture
+	if (handler->_replay != NULL) {
+		mpu9250ReplayInit(handler);
+		return true;
+	}
+
+	/* first sequence, up to reading the magnetometer calibration */
+	mpu9250BatchBegin(&batch, 0);
+
+	// select clock source to gyro
+	mpu9250BatchWrite(&batch, MPU9250_PWR_MGMNT_1, MPU9250_CLOCK_SEL_PLL);
+	// enable I2C master mode
+	mpu9250BatchWrite(&batch, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN);
+	// set the I2C bus speed to 400 kHz
+	mpu9250BatchWrite(&batch, MPU9250_I2C_MST_CTRL, MPU9250_I2C_MST_CLK);
+	// set AK8963 to Power Down
+	mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN, false);
+	// reset the MPU9250 (self clearing bit, not verified) and wait for it to come back up
+	mpu9250BatchAdd(&batch, MPU9250_PWR_MGMNT_1, MPU9250_PWR_RESET, 0xFF, 0, MPU9250_RESET_DELAY_US);
+	// reset the AK8963
+	mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL2, MPU9250_AK8963_RESET, false);
+	// select clock source to gyro
+	mpu9250BatchWrite(&batch, MPU9250_PWR_MGMNT_1, MPU9250_CLOCK_SEL_PLL);
+	// check the WHO AM I byte, expected value is 0x71 (decimal 113) or 0x73 (decimal 115)
+	mpu9250BatchExpect(&batch, MPU9250_WHO_AM_I, 0x71, 0xFD);
+	// enable accelerometer and gyro
+	mpu9250BatchWrite(&batch, MPU9250_PWR_MGMNT_2, MPU9250_SEN_ENABLE);
+	// setting accel range to 16G as default (or the one fixed at build time)
+	mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG, MPU9250_FS_SEL(MPU9250_INIT_ACCEL_RANGE));
+	// setting the gyro range to 2000DPS as default (or the one fixed at build time)
+	mpu9250BatchWrite(&batch, MPU9250_GYRO_CONFIG, MPU9250_FS_SEL(MPU9250_INIT_GYRO_RANGE));
+	// setting bandwidth to 184Hz as default
+	mpu9250BatchWrite(&batch, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_184);
+	// setting gyro bandwidth to 184Hz
+	mpu9250BatchWrite(&batch, MPU9250_CONFIG, MPU9250_GYRO_DLPF_184);
+	// setting the sample rate divider to 0 as default
+	mpu9250BatchWrite(&batch, MPU9250_SMPDIV, 0x00);
+	// enable I2C master mode
+	mpu9250BatchWrite(&batch, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN);
+	// set the I2C bus speed to 400 kHz
+	mpu9250BatchWrite(&batch, MPU9250_I2C_MST_CTRL, MPU9250_I2C_MST_CLK);
+	// check AK8963 WHO AM I register, expected value is 0x48 (decimal 72)
+	mpu9250BatchReadAK8963(&batch, MPU9250_AK8963_WHO_AM_I, 1);
+	mpu9250BatchExpect(&batch, MPU9250_EXT_SENS_DATA_00, 72, 0xFF);
+	/* get the magnetometer calibration */
+	// set AK8963 to Power Down
+	mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN, true);
+	mpu9250BatchDelay(&batch, MPU9250_AK8963_MODE_DELAY_US);
+	// ask for the AK8963 ASA registers
+	mpu9250BatchReadAK8963(&batch, MPU9250_AK8963_ASA, 3);
+
+	if (!mpu9250BatchRun(handler, &batch)) {
+		return -1;
+	}
+
+	handler->_accelScale = MPU9250_ACCEL_SCALE(MPU9250_INIT_ACCEL_RANGE); // setting the accel scale
+	handler->_accelRange = MPU9250_INIT_ACCEL_RANGE;
+	// setting the gyro scale
+	handler->_gyroScale = MPU9250_GYRO_SCALE(MPU9250_INIT_GYRO_RANGE);
+	handler->_gyroRange = MPU9250_INIT_GYRO_RANGE;
+	handler->_bandwidth = MPU9250_DLPF_BANDWIDTH_184HZ;
+	handler->_srd = 0;
+
+	// read the AK8963 ASA registers and compute magnetometer scale factors
+	if (!mpu9250ReadRegisters(handler, MPU9250_EXT_SENS_DATA_00, 3)) {
+		return -16;
+	}
+	handler->_magScaleX = ((((float) handler->_buffer[0]) - 128.0f) / (256.0f) + 1.0f) * 4912.0f
+			/ 32760.0f; // micro Tesla
+	handler->_magScaleY = ((((float) handler->_buffer[1]) - 128.0f) / (256.0f) + 1.0f) * 4912.0f
+			/ 32760.0f; // micro Tesla
+	handler->_magScaleZ = ((((float) handler->_buffer[2]) - 128.0f) / (256.0f) + 1.0f) * 4912.0f
+			/ 32760.0f; // micro Tesla
+	memcpy(handler->_asa, handler->_buffer, sizeof(handler->_asa)); // identifies the chip in the calibration cache
+	mpu9250UpdateConversion(handler);
+
+	/* second sequence, start the magnetometer measurements */
+	mpu9250BatchBegin(&batch, 0);
+
+	// set AK8963 to Power Down
+	mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN, true);
+	mpu9250BatchDelay(&batch, MPU9250_AK8963_MODE_DELAY_US); // wait between AK8963 mode changes
+	// set AK8963 to 16 bit resolution, 100 Hz update rate
+	mpu9250BatchWriteAK8963(&batch, MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS2, true);
+	mpu9250BatchDelay(&batch, MPU9250_AK8963_MODE_DELAY_US); // wait between AK8963 mode changes
+	// select clock source to gyro
+	mpu9250BatchWrite(&batch, MPU9250_PWR_MGMNT_1, MPU9250_CLOCK_SEL_PLL);
+	// instruct the MPU9250 to get 7 bytes of data from the AK8963 at the sample rate
+	mpu9250BatchReadAK8963(&batch, MPU9250_AK8963_HXL, 7);
+
+	if (!mpu9250BatchRun(handler, &batch)) {
+		return -18;
+	}
+	
+	// warm start: reuse the calibration saved for this chip, configuration and temperature
+	if (mpu9250Read(handler) && mpu9250CalibrationLoad(handler)) {
+		return true;
+	}
+
+	// estimate gyro bias from one FIFO burst (the IMU must be still)
+	if (mpu9250CalibrateGyroFast(handler, MPU9250_FAST_CAL_SAMPLES) < 0) {
+		return -20;
+	}
+	mpu9250CalibrationSave(handler);
+
+	return true;
+}
+
+// Funciones para obtener los datos.
+
+//Read sensor registers and store data at control structure
+bool mpu9250Read(MPU9250_control_t *handler)
+{
+	// a replayed capture gives its next sample
+	if (handler->_replay != NULL) {
+		struct mse_sample sample;
+
+		if (mpu9250ReplaySamples(handler, &sample, 1, false) != 1) {
+			return false;
+		}
+		mpu9250ProcessSample(handler, &sample);
+		return true;
+	}
+
+	// grab the data from the MPU9250
+	if(!mpu9250ReadRegisters(handler, MPU9250_ACCEL_OUT, 21)) {
+		return false;
+	}
+	mpu9250ProcessFrame(handler, handler->_buffer);
+	return true;
+}
+
+//Convert one 21 byte block (direct read or FIFO frame) and store data at control structure
+void mpu9250ProcessFrame(MPU9250_control_t *handler, const unsigned char *buffer)
+{
+	// combine into 16 bit values
+	handler->_axcounts = (((int16_t)buffer[0]) << 8)  | buffer[1];
+	handler->_aycounts = (((int16_t)buffer[2]) << 8)  | buffer[3];
+	handler->_azcounts = (((int16_t)buffer[4]) << 8)  | buffer[5];
+	handler->_tcounts  = (((int16_t)buffer[6]) << 8)  | buffer[7];
+	handler->_gxcounts = (((int16_t)buffer[8]) << 8)  | buffer[9];
+	handler->_gycounts = (((int16_t)buffer[10]) << 8) | buffer[11];
+	handler->_gzcounts = (((int16_t)buffer[12]) << 8) | buffer[13];
+	handler->_hxcounts = (((int16_t)buffer[15]) << 8) | buffer[14];
+	handler->_hycounts = (((int16_t)buffer[17]) << 8) | buffer[16];
+	handler->_hzcounts = (((int16_t)buffer[19]) << 8) | buffer[18];
+	mpu9250ConvertCounts(handler);
+	// buffer[20] is ST2 of the AK8963, same check as mpu9250ProcessSample
+	if (handler->_magCalEnabled && !(buffer[20] & MPU9250_AK8963_HOFL)) {
+		mpu9250MagCalibrationUpdate(handler);
+	}
+}
+
+//Take one record produced by the driver (counts already combined) and store data at control structure
+void mpu9250ProcessSample(MPU9250_control_t *handler, const struct mse_sample *sample)
+{
+	handler->_axcounts = sample->accel[0];
+	handler->_aycounts = sample->accel[1];
+	handler->_azcounts = sample->accel[2];
+	handler->_tcounts  = sample->temp;
+	handler->_gxcounts = sample->gyro[0];
+	handler->_gycounts = sample->gyro[1];
+	handler->_gzcounts = sample->gyro[2];
+	handler->_hxcounts = sample->mag[0];
+	handler->_hycounts = sample->mag[1];
+	handler->_hzcounts = sample->mag[2];
+	handler->_timestampNs = sample->timestamp_ns;
+	handler->_seq = sample->seq;
+	handler->_dropped = sample->dropped;
+	mpu9250ConvertCounts(handler);
+	// a magnetic overflow (HOFL) is not a valid point of the envelope
+	if (handler->_magCalEnabled && !(sample->mag_st2 & MPU9250_AK8963_HOFL)) {
+		mpu9250MagCalibrationUpdate(handler);
+	}
+}
+
+//Convert the counts stored at control structure to physical units
+static void mpu9250ConvertCounts(MPU9250_control_t *handler)
+{
+	const MPU9250_conversion_t *conv = &handler->_conv;
+	const float ax = handler->_axcounts, ay = handler->_aycounts, az = handler->_azcounts;
+	const float gx = handler->_gxcounts, gy = handler->_gycounts, gz = handler->_gzcounts;
+
+	// transform and convert to float values, same coefficients as mpu9250ConvertBlock
+#ifdef MPU9250_FIXED_MOUNT
+	handler->_ax = conv->accelGain[0][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X)]*MPU9250_MOUNT_PICK(MPU9250_MOUNT_X, ax, ay, az) + conv->accelOffset[0];
+	handler->_ay = conv->accelGain[1][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y)]*MPU9250_MOUNT_PICK(MPU9250_MOUNT_Y, ax, ay, az) + conv->accelOffset[1];
+	handler->_az = conv->accelGain[2][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z)]*MPU9250_MOUNT_PICK(MPU9250_MOUNT_Z, ax, ay, az) + conv->accelOffset[2];
+	handler->_gx = conv->gyroGain[0][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X)]*MPU9250_MOUNT_PICK(MPU9250_MOUNT_X, gx, gy, gz) + conv->gyroOffset[0];
+	handler->_gy = conv->gyroGain[1][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y)]*MPU9250_MOUNT_PICK(MPU9250_MOUNT_Y, gx, gy, gz) + conv->gyroOffset[1];
+	handler->_gz = conv->gyroGain[2][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z)]*MPU9250_MOUNT_PICK(MPU9250_MOUNT_Z, gx, gy, gz) + conv->gyroOffset[2];
+#else
+	handler->_ax = conv->accelGain[0][0]*ax + conv->accelGain[0][1]*ay + conv->accelGain[0][2]*az + conv->accelOffset[0];
+	handler->_ay = conv->accelGain[1][0]*ax + conv->accelGain[1][1]*ay + conv->accelGain[1][2]*az + conv->accelOffset[1];
+	handler->_az = conv->accelGain[2][0]*ax + conv->accelGain[2][1]*ay + conv->accelGain[2][2]*az + conv->accelOffset[2];
+	handler->_gx = conv->gyroGain[0][0]*gx + conv->gyroGain[0][1]*gy + conv->gyroGain[0][2]*gz + conv->gyroOffset[0];
+	handler->_gy = conv->gyroGain[1][0]*gx + conv->gyroGain[1][1]*gy + conv->gyroGain[1][2]*gz + conv->gyroOffset[1];
+	handler->_gz = conv->gyroGain[2][0]*gx + conv->gyroGain[2][1]*gy + conv->gyroGain[2][2]*gz + conv->gyroOffset[2];
+#endif
+	handler->_hx = conv->magGain[0]*handler->_hxcounts + conv->magOffset[0];
+	handler->_hy = conv->magGain[1]*handler->_hycounts + conv->magOffset[1];
+	handler->_hz = conv->magGain[2]*handler->_hzcounts + conv->magOffset[2];
+	handler->_t = conv->tempGain*handler->_tcounts + conv->tempOffset;
+}
+
+// Funciones para el modo streaming (FIFO del sensor drenada por el driver)
+
+// Start continuous acquisition, from now on read() returns whole struct mse_sample records
+bool mpu9250StartStreaming(MPU9250_control_t *handler)
+{
+	if (handler->_replay != NULL) {
+		return true;
+	}
+	if (!handler->_transport->command(handler, MSE_IOC_STREAM_START, 0)) {
+		printf("Error starting FIFO streaming\n");
+		return false;
+	}
+	return true;
+}
+
+bool mpu9250StopStreaming(MPU9250_control_t *handler)
+{
+	if (handler->_replay != NULL) {
+		return true;
+	}
+	if (!handler->_transport->command(handler, MSE_IOC_STREAM_STOP, 0)) {
+		printf("Error stopping FIFO streaming\n");
+		return false;
+	}
+	return true;
+}
+
+// Read up to maxSamples buffered records in a single syscall, returns the number of samples or -1
+int mpu9250ReadSamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples)
+{
+	uint64_t start = (handler->_metrics != NULL) ? mpu9250MetricsNow() : 0;
+	int ret;
+
+	if (handler->_replay != NULL) {
+		ret = mpu9250ReplaySamples(handler, samples, maxSamples, false);
+	} else {
+		ret = handler->_transport->readSamples(handler, samples, maxSamples);
+	}
+	if (handler->_metrics != NULL) {
+		mpu9250MetricsSampleRead(handler, start, ret);
+		mpu9250MetricsSamples(handler, samples, ret);
+	}
+	if (ret < 0) {
+		printf("Error mpu9250ReadSamples on reading operation\n");
+		return -1;
+	}
+	return ret;
+}
+
+// Map the driver sample ring, while it is mapped the driver produces there instead of read()
+bool mpu9250MapRing(MPU9250_control_t *handler)
+{
+	// a replay has no driver ring, its samples come through mpu9250ReadSamples
+	if (handler->_replay != NULL) {
+		return false;
+	}
+	// only the character device has a ring, the other backends read the FIFO in mpu9250ReadSamples
+	if (handler->_transport->mapRing == NULL || !handler->_transport->mapRing(handler)) {
+		printf("Error mapping the sample ring\n");
+		return false;
+	}
+	if (handler->_ring->version != MSE_RING_VERSION || handler->_ring->sample_size != sizeof(struct mse_sample)) {
+		printf("Sample ring version mismatch\n");
+		mpu9250UnmapRing(handler);
+		return false;
+	}
+	return true;
+}
+
+void mpu9250UnmapRing(MPU9250_control_t *handler)
+{
+	if (handler->_ring != NULL) {
+		munmap(handler->_ring, handler->_ringBytes);
+		handler->_ring = NULL;
+	}
+}
+
+// Process in place every sample published by the driver and hand the slots back, no syscalls
+int mpu9250ConsumeRing(MPU9250_control_t *handler, void (*process)(MPU9250_control_t *handler, const struct mse_sample *sample))
+{
+	uint64_t start = (handler->_metrics != NULL) ? mpu9250MetricsNow() : 0;
+	uint32_t head, tail, mask;
+	int count = 0;
+
+	head = __atomic_load_n(&handler->_ring->head, __ATOMIC_ACQUIRE);
+	tail = handler->_ring->tail;
+	mask = handler->_ring->size - 1;
+
+	while (tail != head) {
+		if (handler->_metrics != NULL) {
+			mpu9250MetricsSamples(handler, &handler->_ring->samples[tail & mask], 1);
+		}
+		process(handler, &handler->_ring->samples[tail & mask]);
+		tail++;
+		count++;
+	}
+	__atomic_store_n(&handler->_ring->tail, tail, __ATOMIC_RELEASE);
+	if (handler->_metrics != NULL) {
+		mpu9250MetricsSampleRead(handler, start, count);
+	}
+
+	return count;
+}
+
+// Let the driver sample every periodUs (0 = sensor rate) and keep only the freshest sample
+bool mpu9250StartLatest(MPU9250_control_t *handler, unsigned int periodUs)
+{
+	if (handler->_replay == NULL && !handler->_transport->command(handler, MSE_IOC_LATEST_START, periodUs)) {
+		printf("Error starting latest value mode\n");
+		return false;
+	}
+	handler->_latestPeriodNs = periodUs ? (uint64_t)periodUs * 1000 : (uint64_t)(handler->_srd + 1) * 1000000;
+	return true;
+}
+
+bool mpu9250StopLatest(MPU9250_control_t *handler)
+{
+	handler->_latestPeriodNs = 0;
+	if (handler->_replay != NULL) {
+		return true;
+	}
+	if (!handler->_transport->command(handler, MSE_IOC_LATEST_STOP, 0)) {
+		printf("Error stopping latest value mode\n");
+		return false;
+	}
+	return true;
+}
+
+// Get the most recent sample acquired by the driver, returns at once without touching the bus
+bool mpu9250ReadLatest(MPU9250_control_t *handler)
+{
+	uint64_t start = (handler->_metrics != NULL) ? mpu9250MetricsNow() : 0;
+	struct mse_sample sample;
+	int ret;
+
+	if (handler->_replay != NULL) {
+		ret = mpu9250ReplaySamples(handler, &sample, 1, true);
+	} else {
+		ret = handler->_transport->readSamples(handler, &sample, 1);
+	}
+	if (handler->_metrics != NULL) {
+		mpu9250MetricsSampleRead(handler, start, (ret == 1) ? 1 : -1);
+		mpu9250MetricsSamples(handler, &sample, (ret == 1) ? 1 : 0);
+	}
+	if (ret != 1) {
+		if (handler->_replay == NULL) {
+			printf("Error mpu9250ReadLatest on reading operation\n");
+		}
+		return false;
+	}
+	mpu9250ProcessSample(handler, &sample);
+	return true;
+}
+
+// Block until the driver has new samples (read() or ring), returns 1, 0 on timeout or -1
+int mpu9250WaitData(MPU9250_control_t *handler, int timeoutMs)
+{
+	int ret;
+
+	if (handler->_replay != NULL) {
+		ret = mpu9250ReplayWait(handler, timeoutMs);
+	} else {
+		ret = handler->_transport->wait(handler, timeoutMs);
+	}
+	if (handler->_metrics != NULL) {
+		mpu9250MetricsWait(handler, ret);
+	}
+	if (ret < 0) {
+		printf("Error waiting for MPU9250 data\n");
+	}
+	return ret;
+}
+
+// Returns the gyroscope measurement in the x direction, rad/s
+float mpu9250GetGyroX_rads(MPU9250_control_t *handler)
+{
+	return handler->_gx;
+}
+
+// Returns the gyroscope measurement in the y direction, rad/s
+float mpu9250GetGyroY_rads(MPU9250_control_t *handler)
+{
+	return handler->_gy;
+}
+
+// Returns the gyroscope measurement in the z direction, rad/s
+float mpu9250GetGyroZ_rads(MPU9250_control_t *handler)
+{
+	return handler->_gz;
+}
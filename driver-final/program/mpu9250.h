@@ -0,0 +1,542 @@
+#ifndef MPU9250_H
+#define MPU9250_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../driver/mpu9250_driver.h"
+
+//Different options for basic MPU9250 setting registers
+typedef enum
+{
+   MPU9250_ACCEL_RANGE_2G,
+   MPU9250_ACCEL_RANGE_4G,
+   MPU9250_ACCEL_RANGE_8G,
+   MPU9250_ACCEL_RANGE_16G
+} MPU9250_AccelRange_t;
+
+typedef enum
+{
+   MPU9250_GYRO_RANGE_250DPS,
+   MPU9250_GYRO_RANGE_500DPS,
+   MPU9250_GYRO_RANGE_1000DPS,
+   MPU9250_GYRO_RANGE_2000DPS
+} MPU9250_GyroRange_t;
+
+typedef enum
+{
+   MPU9250_DLPF_BANDWIDTH_184HZ,
+   MPU9250_DLPF_BANDWIDTH_92HZ,
+   MPU9250_DLPF_BANDWIDTH_41HZ,
+   MPU9250_DLPF_BANDWIDTH_20HZ,
+   MPU9250_DLPF_BANDWIDTH_10HZ,
+   MPU9250_DLPF_BANDWIDTH_5HZ
+} MPU9250_DlpfBandwidth_t;
+
+typedef enum
+{
+   MPU9250_LP_ACCEL_ODR_0_24HZ  = 0,
+   MPU9250_LP_ACCEL_ODR_0_49HZ  = 1,
+   MPU9250_LP_ACCEL_ODR_0_98HZ  = 2,
+   MPU9250_LP_ACCEL_ODR_1_95HZ  = 3,
+   MPU9250_LP_ACCEL_ODR_3_91HZ  = 4,
+   MPU9250_LP_ACCEL_ODR_7_81HZ  = 5,
+   MPU9250_LP_ACCEL_ODR_15_63HZ = 6,
+   MPU9250_LP_ACCEL_ODR_31_25HZ = 7,
+   MPU9250_LP_ACCEL_ODR_62_50HZ = 8,
+   MPU9250_LP_ACCEL_ODR_125HZ   = 9,
+   MPU9250_LP_ACCEL_ODR_250HZ   = 10,
+   MPU9250_LP_ACCEL_ODR_500HZ   = 11
+} MPU9250_LpAccelOdr_t;
+
+//Build time specialization. Defining MPU9250_MOUNT_X, _Y and _Z fixes the mounting: each one
+//is the sensor axis that feeds that output axis, 1 = x, 2 = y, 3 = z, negative to flip the sign
+//(the default board is -DMPU9250_MOUNT_X=2 -DMPU9250_MOUNT_Y=1 -DMPU9250_MOUNT_Z=-3). Then every
+//axis is converted with one multiply-add instead of a 3 term dot product. Defining
+//MPU9250_FIXED_ACCEL_RANGE / MPU9250_FIXED_GYRO_RANGE to an enum value above pins the ranges.
+//Without them the transform and the ranges stay configurable at run time.
+#if defined(MPU9250_MOUNT_X) && defined(MPU9250_MOUNT_Y) && defined(MPU9250_MOUNT_Z)
+#define MPU9250_FIXED_MOUNT
+#define MPU9250_MOUNT_INDEX(m)        ((m) < 0 ? -(m) - 1 : (m) - 1)
+#define MPU9250_MOUNT_SIGN(m)         ((m) < 0 ? -1 : 1)
+#define MPU9250_MOUNT_T(m, j)         (MPU9250_MOUNT_INDEX(m) == (j) ? MPU9250_MOUNT_SIGN(m) : 0)
+// pick at compile time the channel that feeds output axis m
+#define MPU9250_MOUNT_PICK(m, x, y, z) \
+   (MPU9250_MOUNT_INDEX(m) == 0 ? (x) : MPU9250_MOUNT_INDEX(m) == 1 ? (y) : (z))
+_Static_assert(MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X) >= 0 && MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X) < 3 &&
+               MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y) >= 0 && MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y) < 3 &&
+               MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z) >= 0 && MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z) < 3,
+               "MPU9250_MOUNT_X/Y/Z must be one of 1, 2, 3, -1, -2, -3");
+_Static_assert(MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X) != MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y) &&
+               MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X) != MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z) &&
+               MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y) != MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z),
+               "MPU9250_MOUNT_X/Y/Z must use each sensor axis once");
+#elif defined(MPU9250_MOUNT_X) || defined(MPU9250_MOUNT_Y) || defined(MPU9250_MOUNT_Z)
+#error "MPU9250_MOUNT_X, MPU9250_MOUNT_Y and MPU9250_MOUNT_Z must be defined together"
+#endif
+
+//Conversion of raw counts to physical units with the axis transform, scale, bias and scale
+//factor folded together: out = gain * counts + offset. Rebuilt by mpu9250UpdateConversion.
+typedef struct {
+   float accelGain[3][3];
+   float accelOffset[3];
+   float gyroGain[3][3];
+   float gyroOffset[3];
+   float magGain[3];
+   float magOffset[3];
+   float tempGain;
+   float tempOffset;
+} MPU9250_conversion_t;
+
+//mpu9250CalibrateGyroFast: samples averaged by mpu9250Init and its result when the IMU was moving
+#define MPU9250_FAST_CAL_SAMPLES      200
+#define MPU9250_CAL_MOTION            -7
+
+//Acquisition health of one IMU (mpu9250SetMetrics). The acquisition thread is the only writer and
+//updates every counter with a relaxed atomic store, other threads or processes (through the shared
+//memory page of mpu9250MetricsCreateShared) read them with mpu9250MetricsRead without locking.
+//Histograms are in ns with 8 linear buckets per power of two (12.5 % resolution) up to 2^40 ns,
+//benchmark keeps its stage latencies in the same MPU9250_histogram_t.
+#define MPU9250_METRICS_MAGIC         0x5254454D    // "METR"
+#define MPU9250_METRICS_VERSION       2
+#define MPU9250_METRICS_SUB_BITS      3
+#define MPU9250_METRICS_BUCKETS       ((40 - MPU9250_METRICS_SUB_BITS + 1) << MPU9250_METRICS_SUB_BITS)
+
+typedef struct {
+   uint64_t count;
+   uint64_t sumNs;
+   uint64_t maxNs;
+   uint64_t buckets[MPU9250_METRICS_BUCKETS];
+} MPU9250_histogram_t;
+
+typedef struct {
+   // written once by mpu9250MetricsInit
+   uint32_t magic;
+   uint16_t version;
+   uint16_t reserved;
+   uint32_t size;
+   uint32_t pid;
+   char device[32];
+   // from here on only uint64_t, updated while acquiring
+   uint64_t updatedNs;          // CLOCK_MONOTONIC of the last update, a stale value means a stuck reader
+   uint64_t periodNs;           // sample period of the active mode, reference of the jitter
+   uint64_t registerReads, registerFailures;
+   uint64_t sampleReads, sampleFailures, samples;
+   uint64_t waits, waitTimeouts, waitFailures;
+   uint64_t lost;               // gaps in seq, samples the driver acquired and the program never saw
+   uint64_t seqResets;          // seq or time went back (driver reloaded, device reopened)
+   uint64_t lastSeq, lastTimestampNs;
+   MPU9250_histogram_t registerReadNs;  // mpu9250ReadRegisters and the other register reads
+   MPU9250_histogram_t sampleReadNs;    // mpu9250ReadSamples, ReadLatest and ConsumeRing
+   MPU9250_histogram_t intervalNs;      // between the kernel timestamps of consecutive samples
+   MPU9250_histogram_t jitterNs;        // |interval - periodNs * seq gap|
+} MPU9250_metrics_t;
+
+//Control structure for MPU9250 operation (one per IMU, every function works on a handle)
+typedef struct {
+   // read on every converted sample, kept together at the start of the structure
+   MPU9250_conversion_t _conv __attribute__((aligned(64)));
+
+   // scale factors
+   float _accelScale;
+   float _gyroScale;
+   float _magScaleX;
+   float _magScaleY;
+   float _magScaleZ;
+   float _tempScale;
+   float _tempOffset;
+
+   // configuration
+   MPU9250_AccelRange_t    _accelRange;
+   MPU9250_GyroRange_t     _gyroRange;
+   MPU9250_DlpfBandwidth_t _bandwidth;
+   unsigned char _srd;
+
+   // buffer for reading from sensor
+   unsigned char _buffer[21];
+
+   // data buffer
+   float _ax, _ay, _az;
+   float _gx, _gy, _gz;
+   float _hx, _hy, _hz;
+   float _t;
+
+   // gyro bias estimation
+   unsigned char _numSamples;
+   double _gxbD, _gybD, _gzbD;
+   float _gxb, _gyb, _gzb;
+   float _gxv, _gyv, _gzv;      // variance seen by the last fast calibration, (rad/s)^2
+
+   // accel bias and scale factor estimation
+   double _axbD, _aybD, _azbD;
+   float _axmax, _aymax, _azmax;
+   float _axmin, _aymin, _azmin;
+   float _axb, _ayb, _azb;
+   float _axs;
+   float _ays;
+   float _azs;
+
+   // magnetometer bias and scale factor estimation
+   unsigned short _maxCounts;
+   float _deltaThresh;
+   unsigned char _coeff;
+   unsigned short _counter;
+   float _framedelta, _delta;
+   float _hxfilt, _hyfilt, _hzfilt;
+   float _hxmax, _hymax, _hzmax;
+   float _hxmin, _hymin, _hzmin;
+   float _hxb, _hyb, _hzb;
+   float _hxs;
+   float _hys;
+   float _hzs;
+   float _avgs;
+   bool _magCalEnabled;         // online calibration in mpu9250ProcessSample and mpu9250ProcessFrame
+   bool _magCalDirty;           // the envelope grew since the last update
+   unsigned short _magCalUpdates;
+
+   // data counts
+   short _axcounts, _aycounts, _azcounts;
+   short _gxcounts, _gycounts, _gzcounts;
+   short _hxcounts, _hycounts, _hzcounts;
+   short _tcounts;
+
+   // kernel timestamp, sequence number and accumulated losses of the last sample
+   uint64_t _timestampNs;
+   uint32_t _seq;
+   uint32_t _dropped;
+
+   // transformation matrix
+   /* transform the accel and gyro axes to match the magnetometer axes */
+   short tX[3];
+   short tY[3];
+   short tZ[3];
+
+   // capture replayed instead of a device (mpu9250OpenReplay), NULL for a real IMU
+   struct mpu9250_replay *_replay;
+
+   // backend that reaches the registers (see MPU9250_transport_t) and its private state
+   const struct MPU9250_transport *_transport;
+   void *_transportData;
+
+   // file descriptor of the character device or of /dev/i2c-N, and the sample ring when it is mapped
+   int _fd;
+   struct mse_ring *_ring;
+   size_t _ringBytes;
+
+   // calibration cache: file (NULL = no cache), key of this IMU and in-band staleness check
+   const char *_calPath;
+   char _device[32];
+   unsigned char _asa[3];
+   bool _calLoaded;
+   bool _calStale;
+   unsigned int _checkCount;
+   double _checkMean[3], _checkM2[3];
+
+   // acquisition health counters, NULL when not kept (mpu9250SetMetrics)
+   MPU9250_metrics_t *_metrics;
+   uint64_t _latestPeriodNs;    // period of the latest value mode while it runs, else 0
+
+   // track success of interacting with sensor
+   bool _status;
+
+} MPU9250_control_t;
+
+//Raw counts of many samples (for example a FIFO burst), one array per channel
+typedef struct {
+   size_t count;
+   size_t capacity;
+   int16_t *ax, *ay, *az;
+   int16_t *gx, *gy, *gz;
+   int16_t *hx, *hy, *hz;
+   int16_t *t;
+   uint64_t *timestampNs;
+   uint32_t *seq;
+} MPU9250_rawBlock_t;
+
+//Physical units of many samples, same layout as MPU9250_rawBlock_t
+typedef struct {
+   size_t count;
+   size_t capacity;
+   float *ax, *ay, *az;   // m/s2
+   float *gx, *gy, *gz;   // rad/s
+   float *hx, *hy, *hz;   // uT
+   float *t;              // C
+} MPU9250_block_t;
+
+
+//Orientation filter run over converted blocks (mpu9250FusionUpdate)
+typedef enum
+{
+   MPU9250_FUSION_MADGWICK,
+   MPU9250_FUSION_MAHONY
+} MPU9250_FusionAlgorithm_t;
+
+typedef struct {
+   float w, x, y, z;
+} MPU9250_quat_t;
+
+typedef struct {
+   MPU9250_FusionAlgorithm_t algorithm;
+   MPU9250_quat_t q;
+   float beta;                  // Madgwick gradient step
+   float twoKp, twoKi;          // Mahony proportional and integral gains (times 2)
+   float ix, iy, iz;            // Mahony integral feedback, rad/s
+   uint64_t lastNs;             // timestamp of the last sample used, 0 before the first one
+} MPU9250_fusion_t;
+
+//Binary capture: MPU9250_logHeader_t followed by the samples as the driver delivers them (raw
+//counts, kernel timestamp, seq and losses), all in host byte order. With MPU9250_LOG_RAW they are
+//plain struct mse_sample records. With MPU9250_LOG_DELTA they go in blocks of up to
+//MPU9250_LOG_BLOCK_SAMPLES: the first sample as is and the rest as zigzag varint deltas per
+//channel, and the file ends with an index of the blocks so the reader can seek.
+#define MPU9250_LOG_MAGIC             0x474F4C4D    // "MLOG"
+#define MPU9250_LOG_VERSION           1
+#define MPU9250_LOG_RAW               0
+#define MPU9250_LOG_DELTA             1
+#define MPU9250_LOG_BLOCK_SAMPLES     1024
+
+typedef struct {
+   uint32_t magic;
+   uint16_t version;
+   uint16_t headerSize;
+   uint32_t recordSize;
+   uint32_t encoding;           // MPU9250_LOG_RAW or MPU9250_LOG_DELTA
+   uint64_t startRealtimeNs;
+   char device[32];
+   // everything needed to convert the counts as the live program did
+   float accelScale, gyroScale;
+   float magScale[3];
+   float tempScale, tempOffset;
+   float accelBias[3], accelFactor[3];
+   float gyroBias[3];
+   float magBias[3], magFactor[3];
+   int16_t transform[9];
+   uint8_t accelRange, gyroRange, bandwidth, srd;
+   uint8_t reserved[90];
+} MPU9250_logHeader_t;
+
+//One entry of the block index of a MPU9250_LOG_DELTA capture
+typedef struct {
+   uint64_t offset;             // file offset of the block
+   uint64_t firstSample;        // position of its first sample in the capture
+   uint64_t firstTimestampNs;
+} MPU9250_logIndex_t;
+
+typedef struct {
+   int fd;
+   uint32_t encoding;
+   unsigned char *buffer;
+   size_t used;
+   size_t size;
+   uint64_t offset;             // bytes of the file, buffered ones included
+   uint64_t records;
+   // MPU9250_LOG_DELTA: samples waiting for their block and index of the blocks written
+   struct mse_sample *pending;
+   size_t pendingCount;
+   MPU9250_logIndex_t *index;
+   size_t blocks;
+   size_t indexCapacity;
+} MPU9250_logWriter_t;
+
+typedef struct {
+   void *map;
+   size_t mapBytes;
+   const MPU9250_logHeader_t *header;
+   const struct mse_sample *samples;  // MPU9250_LOG_RAW only, NULL for compressed captures
+   size_t count;
+   // MPU9250_LOG_DELTA: block index (copied from the file and checked, or rebuilt if the capture was cut short)
+   const MPU9250_logIndex_t *index;
+   MPU9250_logIndex_t *ownIndex;
+   size_t blocks;
+   struct mse_sample *decoded;        // last block decoded by mpu9250LogRead
+   size_t decodedBlock;
+   size_t decodedCount;
+} MPU9250_logReader_t;
+
+//Single producer / single consumer queue of sample blocks, to hand what the acquisition thread
+//reads to the threads that convert and output it without locks. Same protocol as struct mse_ring:
+//free running indices, head published with release by the producer, tail by the consumer. The
+//producer never waits: when the queue is full the samples are dropped and counted.
+#define MPU9250_QUEUE_BLOCK_SAMPLES   64
+
+typedef struct {
+   uint32_t count;
+   uint32_t droppedBefore;      // samples the queue dropped between the previous block and this one
+   uint64_t readNs;             // CLOCK_MONOTONIC when the producer got them
+   struct mse_sample samples[MPU9250_QUEUE_BLOCK_SAMPLES];
+} MPU9250_sampleBlock_t;
+
+typedef struct {
+   // producer side, other threads read the counters with __atomic_load_n
+   uint32_t head __attribute__((aligned(64)));
+   uint32_t pendingDrops;       // dropped since the last published block
+   uint32_t highWater;          // most blocks ever waiting
+   uint64_t published;
+   uint64_t drops;               // times the producer found the queue full
+   uint64_t droppedSamples;
+   // consumer side
+   uint32_t tail __attribute__((aligned(64)));
+   uint32_t sleeping;           // the consumer is in mpu9250QueueWait, Publish has to wake it
+   // fixed at mpu9250QueueAlloc
+   uint32_t size __attribute__((aligned(64)));   // power of 2
+   MPU9250_sampleBlock_t *blocks;
+} MPU9250_queue_t;
+
+// Register I/O of one IMU. The character device runs batches, streaming and the latest value mode
+// in the driver; the register level backends (/dev/i2c-N and the emulator) only provide readRegs
+// and writeReg and use the mpu9250Bus functions, which do the same work in the process.
+typedef struct MPU9250_transport {
+   const char *name;
+   bool (*open)(MPU9250_control_t *handler, const char *device);
+   void (*close)(MPU9250_control_t *handler);
+   bool (*readRegs)(MPU9250_control_t *handler, unsigned char reg, unsigned short count, unsigned char *dest);
+   bool (*writeReg)(MPU9250_control_t *handler, unsigned char reg, unsigned char value);
+   bool (*runBatch)(MPU9250_control_t *handler, const struct mse_reg_op *ops, unsigned int count, unsigned int *done);
+   bool (*command)(MPU9250_control_t *handler, unsigned int cmd, unsigned long arg); // MSE_IOC_STREAM_xxx, MSE_IOC_LATEST_xxx
+   int (*readSamples)(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples);
+   int (*wait)(MPU9250_control_t *handler, int timeoutMs);
+   bool (*mapRing)(MPU9250_control_t *handler);  // NULL when there is no driver ring
+} MPU9250_transport_t;
+
+extern const MPU9250_transport_t mpu9250CharDevTransport;   // /dev/mseXX
+extern const MPU9250_transport_t mpu9250I2cDevTransport;    // /dev/i2c-N[:address], I2C_RDWR
+extern const MPU9250_transport_t mpu9250EmulatorTransport;  // emu[:noise=1,speed=1,seed=1,whoami=0x71]
+
+//State of the register level backends, first member of their _transportData
+typedef struct {
+   uint64_t epochNs;            // CLOCK_MONOTONIC at open
+   double timeScale;            // sensor time runs this many times faster than CLOCK_MONOTONIC
+   bool streaming;
+   bool latest;
+   uint64_t periodNs;
+   uint64_t latestStartNs;      // latest value mode: one sample every latestPeriodNs from here
+   uint64_t latestPeriodNs;
+   uint64_t latestTick;         // tick of latestSample, 0 before the first one
+   struct mse_sample latestSample;
+   uint32_t seq;
+   uint32_t dropped;
+   uint32_t overflows;
+} MPU9250_bus_t;
+
+// Open and close one IMU, the backend comes from the name (/dev/mseXX, /dev/i2c-N or emu)
+bool mpu9250Open(MPU9250_control_t *handler, const char *device);
+bool mpu9250OpenTransport(MPU9250_control_t *handler, const MPU9250_transport_t *transport, const char *device);
+const MPU9250_transport_t *mpu9250TransportFor(const char *device);
+void mpu9250Close(MPU9250_control_t *handler);
+
+// Driver work for the register level backends
+void mpu9250BusInit(MPU9250_bus_t *bus, double timeScale);
+uint64_t mpu9250BusNow(const MPU9250_bus_t *bus);
+bool mpu9250BusRunBatch(MPU9250_control_t *handler, const struct mse_reg_op *ops, unsigned int count, unsigned int *done);
+bool mpu9250BusCommand(MPU9250_control_t *handler, unsigned int cmd, unsigned long arg);
+int mpu9250BusReadSamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples);
+int mpu9250BusWait(MPU9250_control_t *handler, int timeoutMs);
+
+// Replay of a capture through the same functions as a real IMU: mpu9250Init takes the scales and
+// calibration of the capture, mpu9250Read/ReadSamples/ReadLatest/WaitData return its samples at the
+// recorded rate (realtime) or as fast as they are asked for. The ReplayXxx hooks are called by them.
+bool mpu9250OpenReplay(MPU9250_control_t *handler, const char *path, bool realtime);
+bool mpu9250ReplayEnd(const MPU9250_control_t *handler);
+void mpu9250ReplayInit(MPU9250_control_t *handler);
+int mpu9250ReplaySamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples, bool latest);
+int mpu9250ReplayWait(MPU9250_control_t *handler, int timeoutMs);
+void mpu9250ReplayClose(MPU9250_control_t *handler);
+
+// Calibration cache, mpu9250SetCalibrationFile goes before mpu9250Init
+void mpu9250SetCalibrationFile(MPU9250_control_t *handler, const char *path);
+bool mpu9250CalibrationLoad(MPU9250_control_t *handler);
+bool mpu9250CalibrationSave(MPU9250_control_t *handler);
+void mpu9250CalibrationCheck(MPU9250_control_t *handler, const struct mse_sample *samples, int count);
+void mpu9250MagCalibrationEnable(MPU9250_control_t *handler, bool enable);
+void mpu9250MagCalibrationUpdate(MPU9250_control_t *handler);
+
+// Configuration
+char mpu9250Init(MPU9250_control_t *handler);
+char mpu9250SetSrd(MPU9250_control_t *handler, unsigned char srd);
+char mpu9250SetDlpfBandwidth(MPU9250_control_t *handler, MPU9250_DlpfBandwidth_t bandwidth);
+bool mpu9250SetGyroRange(MPU9250_control_t *handler, MPU9250_GyroRange_t range);
+char mpu9250CalibrateGyro(MPU9250_control_t *handler);
+char mpu9250CalibrateGyroFast(MPU9250_control_t *handler, unsigned short numSamples);
+char mpu9250WhoAmI(MPU9250_control_t *handler);
+char mpu9250WhoAmIAK8963(MPU9250_control_t *handler);
+char mpu9250ReadAK8963Registers(MPU9250_control_t *handler, unsigned char subAddress, unsigned char data);
+char mpu9250WriteAK8963Register(MPU9250_control_t *handler, unsigned char subAddress, unsigned char data);
+
+// Direct read and conversion of the data to physical units
+bool mpu9250Read(MPU9250_control_t *handler);
+void mpu9250ProcessFrame(MPU9250_control_t *handler, const unsigned char *buffer);
+void mpu9250ProcessSample(MPU9250_control_t *handler, const struct mse_sample *sample);
+
+// Streaming, sample ring and latest value modes of the driver
+bool mpu9250StartStreaming(MPU9250_control_t *handler);
+bool mpu9250StopStreaming(MPU9250_control_t *handler);
+int mpu9250ReadSamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples);
+bool mpu9250MapRing(MPU9250_control_t *handler);
+void mpu9250UnmapRing(MPU9250_control_t *handler);
+int mpu9250ConsumeRing(MPU9250_control_t *handler, void (*process)(MPU9250_control_t *handler, const struct mse_sample *sample));
+int mpu9250WaitData(MPU9250_control_t *handler, int timeoutMs);
+bool mpu9250StartLatest(MPU9250_control_t *handler, unsigned int periodUs);
+bool mpu9250StopLatest(MPU9250_control_t *handler);
+bool mpu9250ReadLatest(MPU9250_control_t *handler);
+
+// Batch conversion of many samples (SSE2/AVX2/NEON when the compiler targets them)
+void mpu9250UpdateConversion(MPU9250_control_t *handler);
+bool mpu9250RawBlockAlloc(MPU9250_rawBlock_t *block, size_t capacity);
+void mpu9250RawBlockFree(MPU9250_rawBlock_t *block);
+size_t mpu9250RawBlockAppend(MPU9250_rawBlock_t *block, const struct mse_sample *samples, size_t count);
+bool mpu9250BlockAlloc(MPU9250_block_t *block, size_t capacity);
+void mpu9250BlockFree(MPU9250_block_t *block);
+void mpu9250ConvertBlock(const MPU9250_control_t *handler, const MPU9250_rawBlock_t *raw, MPU9250_block_t *out);
+const char *mpu9250ConvertKernel(void);
+
+// Sensor fusion over converted blocks, one quaternion per sample
+void mpu9250FusionInit(MPU9250_fusion_t *fusion, MPU9250_FusionAlgorithm_t algorithm);
+size_t mpu9250FusionUpdate(MPU9250_fusion_t *fusion, const MPU9250_block_t *block,
+                           const uint64_t *timestampNs, MPU9250_quat_t *quat);
+
+// Binary capture: buffered writer and memory mapped reader
+bool mpu9250LogCreate(MPU9250_logWriter_t *writer, const char *path, const MPU9250_control_t *handler,
+                      uint32_t encoding);
+bool mpu9250LogWrite(MPU9250_logWriter_t *writer, const struct mse_sample *samples, size_t count);
+bool mpu9250LogClose(MPU9250_logWriter_t *writer);
+bool mpu9250LogMap(MPU9250_logReader_t *reader, const char *path);
+void mpu9250LogUnmap(MPU9250_logReader_t *reader);
+size_t mpu9250LogRead(MPU9250_logReader_t *reader, size_t position, struct mse_sample *samples, size_t count);
+size_t mpu9250LogFind(MPU9250_logReader_t *reader, uint64_t timestampNs);
+void mpu9250LogApplyHeader(const MPU9250_logHeader_t *header, MPU9250_control_t *handler);
+
+// Block queue between the acquisition thread (Reserve/Publish/Drop) and one consumer (Peek/Release)
+bool mpu9250QueueAlloc(MPU9250_queue_t *queue, uint32_t blocks);
+void mpu9250QueueFree(MPU9250_queue_t *queue);
+MPU9250_sampleBlock_t *mpu9250QueueReserve(MPU9250_queue_t *queue);
+void mpu9250QueuePublish(MPU9250_queue_t *queue);
+void mpu9250QueueDrop(MPU9250_queue_t *queue, unsigned int samples);
+MPU9250_sampleBlock_t *mpu9250QueuePeek(MPU9250_queue_t *queue);
+MPU9250_sampleBlock_t *mpu9250QueueWait(MPU9250_queue_t *queue, int timeoutMs);
+void mpu9250QueueRelease(MPU9250_queue_t *queue);
+uint32_t mpu9250QueueUsed(const MPU9250_queue_t *queue);
+
+// Acquisition health: kept in memory or in a shared memory page (/dev/shm) for other processes
+void mpu9250MetricsInit(MPU9250_metrics_t *metrics, const char *device);
+MPU9250_metrics_t *mpu9250MetricsCreateShared(const char *name, const char *device);
+MPU9250_metrics_t *mpu9250MetricsOpenShared(const char *name);
+void mpu9250MetricsUnmap(MPU9250_metrics_t *metrics);
+void mpu9250MetricsRemoveShared(MPU9250_metrics_t *metrics, const char *name);
+void mpu9250SetMetrics(MPU9250_control_t *handler, MPU9250_metrics_t *metrics);
+void mpu9250MetricsRead(const MPU9250_metrics_t *metrics, MPU9250_metrics_t *copy);
+void mpu9250MetricsHistogramAdd(MPU9250_histogram_t *histogram, uint64_t ns);
+uint64_t mpu9250MetricsPercentile(const MPU9250_histogram_t *histogram, double fraction);
+uint64_t mpu9250MetricsBucketUpper(unsigned int bucket);
+uint64_t mpu9250MetricsNow(void);
+void mpu9250MetricsRegisterRead(MPU9250_control_t *handler, uint64_t startNs, bool ok);
+void mpu9250MetricsSampleRead(MPU9250_control_t *handler, uint64_t startNs, int count);
+void mpu9250MetricsSamples(MPU9250_control_t *handler, const struct mse_sample *samples, int count);
+void mpu9250MetricsWait(MPU9250_control_t *handler, int result);
+
+// Getters
+float mpu9250GetGyroX_rads(MPU9250_control_t *handler);
+float mpu9250GetGyroY_rads(MPU9250_control_t *handler);
+float mpu9250GetGyroZ_rads(MPU9250_control_t *handler);
+
+#endif /* MPU9250_H */
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "mpu9250.h"
+
+// Calibration cache file: a header and up to MPU9250_CAL_ENTRIES entries, one per key
+#define MPU9250_CAL_MAGIC             0x4C43534D    // "MSCL"
+#define MPU9250_CAL_VERSION           1
+#define MPU9250_CAL_ENTRIES           16
+#define MPU9250_CAL_TEMP_BAND         10.0f         // C, one cache entry per band
+
+// In-band check of a loaded calibration: window of samples, stillness and largest residual bias
+#define MPU9250_CAL_CHECK_WINDOW      256
+#define MPU9250_CAL_CHECK_STILL_STD   0.0087f       // rad/s (0.5 dps)
+#define MPU9250_CAL_CHECK_STALE_BIAS  0.0035f       // rad/s (0.2 dps)
+
+// Online magnetometer calibration: smallest span of every axis before the first update (the
+// earth field is 25 to 65 uT, so the IMU has to be turned around enough)
+#define MPU9250_MAG_CAL_MIN_SPAN      30.0f         // uT
+
+typedef struct {
+   char device[32];
+   unsigned char asa[3];
+   signed char tempBand;
+   unsigned char accelRange;
+   unsigned char gyroRange;
+   unsigned char bandwidth;
+   unsigned char srd;
+   short mount[9];
+} MPU9250_calKey_t;
+
+typedef struct {
+   MPU9250_calKey_t key;
+   int64_t savedAt;               // CLOCK_REALTIME seconds
+   float gyroBias[3];
+   float gyroVar[3];
+   float accelBias[3];
+   float accelScale[3];
+   float magBias[3];
+   float magScale[3];
+   uint32_t checksum;
+} MPU9250_calEntry_t;
+
+typedef struct {
+   uint32_t magic;
+   uint16_t version;
+   uint16_t entrySize;
+   uint32_t count;
+   uint32_t reserved;
+   MPU9250_calEntry_t entries[MPU9250_CAL_ENTRIES];
+} MPU9250_calFile_t;
+
+
+// FNV-1a over the entry up to the checksum itself
+static uint32_t calChecksum(const MPU9250_calEntry_t *entry)
+{
+	const unsigned char *p = (const unsigned char *)entry;
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < offsetof(MPU9250_calEntry_t, checksum); i++) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void calKey(MPU9250_control_t *handler, MPU9250_calKey_t *key)
+{
+	int j;
+
+	memset(key, 0, sizeof(*key));
+	memcpy(key->device, handler->_device, sizeof(key->device));
+	memcpy(key->asa, handler->_asa, sizeof(key->asa));
+	key->tempBand = (signed char)floorf(handler->_t / MPU9250_CAL_TEMP_BAND);
+	key->accelRange = handler->_accelRange;
+	key->gyroRange = handler->_gyroRange;
+	key->bandwidth = handler->_bandwidth;
+	key->srd = handler->_srd;
+	for (j = 0; j < 3; j++) {
+		key->mount[j] = handler->tX[j];
+		key->mount[3 + j] = handler->tY[j];
+		key->mount[6 + j] = handler->tZ[j];
+	}
+}
+
+// Read the whole cache file, an empty one if it is missing or from another version
+static void calReadFile(const char *path, MPU9250_calFile_t *file)
+{
+	FILE *fp = fopen(path, "rb");
+
+	memset(file, 0, sizeof(*file));
+	if (fp != NULL) {
+		if (fread(file, 1, sizeof(*file), fp) < offsetof(MPU9250_calFile_t, entries) ||
+		    file->magic != MPU9250_CAL_MAGIC || file->version != MPU9250_CAL_VERSION ||
+		    file->entrySize != sizeof(MPU9250_calEntry_t) || file->count > MPU9250_CAL_ENTRIES) {
+			memset(file, 0, sizeof(*file));
+		}
+		fclose(fp);
+	}
+	file->magic = MPU9250_CAL_MAGIC;
+	file->version = MPU9250_CAL_VERSION;
+	file->entrySize = sizeof(MPU9250_calEntry_t);
+}
+
+// Cache file used by mpu9250Init for this IMU, NULL to always calibrate
+void mpu9250SetCalibrationFile(MPU9250_control_t *handler, const char *path)
+{
+	handler->_calPath = path;
+}
+
+// Take the saved calibration for this chip, configuration and temperature band, if there is one.
+// The band comes from the temperature of the last sample processed.
+bool mpu9250CalibrationLoad(MPU9250_control_t *handler)
+{
+	MPU9250_calFile_t file;
+	MPU9250_calKey_t key;
+	const MPU9250_calEntry_t *entry;
+	uint32_t i;
+
+	if (handler->_calPath == NULL) {
+		return false;
+	}
+	calKey(handler, &key);
+	calReadFile(handler->_calPath, &file);
+
+	for (i = 0; i < file.count; i++) {
+		entry = &file.entries[i];
+		if (memcmp(&entry->key, &key, sizeof(key)) == 0 && entry->checksum == calChecksum(entry)) {
+			break;
+		}
+	}
+	if (i == file.count) {
+		return false;
+	}
+
+	handler->_gxb = entry->gyroBias[0];
+	handler->_gyb = entry->gyroBias[1];
+	handler->_gzb = entry->gyroBias[2];
+	handler->_gxv = entry->gyroVar[0];
+	handler->_gyv = entry->gyroVar[1];
+	handler->_gzv = entry->gyroVar[2];
+	handler->_axb = entry->accelBias[0];
+	handler->_ayb = entry->accelBias[1];
+	handler->_azb = entry->accelBias[2];
+	handler->_axs = entry->accelScale[0];
+	handler->_ays = entry->accelScale[1];
+	handler->_azs = entry->accelScale[2];
+	handler->_hxb = entry->magBias[0];
+	handler->_hyb = entry->magBias[1];
+	handler->_hzb = entry->magBias[2];
+	handler->_hxs = entry->magScale[0];
+	handler->_hys = entry->magScale[1];
+	handler->_hzs = entry->magScale[2];
+	mpu9250UpdateConversion(handler);
+
+	handler->_calLoaded = true;
+	handler->_calStale = false;
+	handler->_checkCount = 0;
+	return true;
+}
+
+// Store the current calibration under this chip, configuration and temperature band
+bool mpu9250CalibrationSave(MPU9250_control_t *handler)
+{
+	MPU9250_calFile_t file;
+	MPU9250_calEntry_t entry;
+	char tmpPath[256];
+	uint32_t i, slot;
+	FILE *fp;
+	bool ok;
+
+	if (handler->_calPath == NULL) {
+		return false;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	calKey(handler, &entry.key);
+	entry.savedAt = (int64_t)time(NULL);
+	entry.gyroBias[0] = handler->_gxb;
+	entry.gyroBias[1] = handler->_gyb;
+	entry.gyroBias[2] = handler->_gzb;
+	entry.gyroVar[0] = handler->_gxv;
+	entry.gyroVar[1] = handler->_gyv;
+	entry.gyroVar[2] = handler->_gzv;
+	entry.accelBias[0] = handler->_axb;
+	entry.accelBias[1] = handler->_ayb;
+	entry.accelBias[2] = handler->_azb;
+	entry.accelScale[0] = handler->_axs;
+	entry.accelScale[1] = handler->_ays;
+	entry.accelScale[2] = handler->_azs;
+	entry.magBias[0] = handler->_hxb;
+	entry.magBias[1] = handler->_hyb;
+	entry.magBias[2] = handler->_hzb;
+	entry.magScale[0] = handler->_hxs;
+	entry.magScale[1] = handler->_hys;
+	entry.magScale[2] = handler->_hzs;
+	entry.checksum = calChecksum(&entry);
+
+	// replace the entry with the same key, else append, else drop the oldest one
+	calReadFile(handler->_calPath, &file);
+	for (slot = 0; slot < file.count; slot++) {
+		if (memcmp(&file.entries[slot].key, &entry.key, sizeof(entry.key)) == 0) {
+			break;
+		}
+	}
+	if (slot == MPU9250_CAL_ENTRIES) {
+		slot = 0;
+		for (i = 1; i < file.count; i++) {
+			if (file.entries[i].savedAt < file.entries[slot].savedAt) {
+				slot = i;
+			}
+		}
+	}
+	file.entries[slot] = entry;
+	if (slot == file.count) {
+		file.count++;
+	}
+
+	// write a new file and rename it so a crash never leaves a half written cache
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", handler->_calPath);
+	fp = fopen(tmpPath, "wb");
+	if (fp == NULL) {
+		printf("Error creating the calibration cache %s\n", tmpPath);
+		return false;
+	}
+	ok = fwrite(&file, offsetof(MPU9250_calFile_t, entries) + file.count * sizeof(entry), 1, fp) == 1;
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok || rename(tmpPath, handler->_calPath) != 0) {
+		printf("Error writing the calibration cache %s\n", handler->_calPath);
+		remove(tmpPath);
+		return false;
+	}
+	return true;
+}
+
+// Cheap check of a loaded calibration, fed with the samples the application already reads.
+// Every window in which the IMU is still, the mean corrected rate should be zero; if it is not,
+// _calStale is set so the application can recalibrate and save again.
+void mpu9250CalibrationCheck(MPU9250_control_t *handler, const struct mse_sample *samples, int count)
+{
+	const MPU9250_conversion_t *conv = &handler->_conv;
+	int i, k;
+
+	if (!handler->_calLoaded || handler->_calStale) {
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		const float g[3] = { samples[i].gyro[0], samples[i].gyro[1], samples[i].gyro[2] };
+
+		handler->_checkCount++;
+		for (k = 0; k < 3; k++) {
+			double x = conv->gyroGain[k][0] * g[0] + conv->gyroGain[k][1] * g[1] +
+			           conv->gyroGain[k][2] * g[2] + conv->gyroOffset[k];
+			double delta = x - handler->_checkMean[k];
+
+			handler->_checkMean[k] += delta / handler->_checkCount;
+			handler->_checkM2[k] += delta * (x - handler->_checkMean[k]);
+		}
+		if (handler->_checkCount < MPU9250_CAL_CHECK_WINDOW) {
+			continue;
+		}
+
+		for (k = 0; k < 3; k++) {
+			if (handler->_checkM2[k] / (handler->_checkCount - 1) >
+			    (double)MPU9250_CAL_CHECK_STILL_STD * MPU9250_CAL_CHECK_STILL_STD) {
+				break;
+			}
+		}
+		// only a still window says something about the bias
+		if (k == 3) {
+			for (k = 0; k < 3; k++) {
+				if (fabs(handler->_checkMean[k]) > MPU9250_CAL_CHECK_STALE_BIAS) {
+					handler->_calStale = true;
+				}
+			}
+		}
+		handler->_checkCount = 0;
+		memset(handler->_checkMean, 0, sizeof(handler->_checkMean));
+		memset(handler->_checkM2, 0, sizeof(handler->_checkM2));
+	}
+}
+
+// Start (or stop) the online magnetometer calibration, from now on every sample goes to
+// mpu9250MagCalibrationUpdate while the application keeps reading as usual
+void mpu9250MagCalibrationEnable(MPU9250_control_t *handler, bool enable)
+{
+	handler->_magCalEnabled = enable;
+	handler->_magCalDirty = false;
+	handler->_counter = 0;
+	handler->_hxmax = handler->_hymax = handler->_hzmax = -1e9f;
+	handler->_hxmin = handler->_hymin = handler->_hzmin = 1e9f;
+	handler->_hxfilt = handler->_hyfilt = handler->_hzfilt = 0.0f;
+}
+
+// Widen the envelope of one filtered axis, returns how much it grew
+static float magCalEnvelope(float filt, float *max, float *min)
+{
+	float delta = 0.0f;
+
+	if (filt > *max) {
+		delta = (*max > -1e8f) ? filt - *max : 0.0f;
+		*max = filt;
+	}
+	if (filt < *min) {
+		delta = (*min < 1e8f) ? *min - filt : 0.0f;
+		*min = filt;
+	}
+	return delta;
+}
+
+// One step of the hard/soft-iron estimation with the last converted sample, constant memory.
+// The uncalibrated field is low pass filtered, its min/max envelope is tracked, and once the
+// envelope has grown less than _deltaThresh in total over _maxCounts samples the bias (center)
+// and the scale factor (average radius over axis radius) are updated.
+void mpu9250MagCalibrationUpdate(MPU9250_control_t *handler)
+{
+	const float coeff = handler->_coeff;
+	bool primed = handler->_hxmax > -1e8f;
+
+	// undo the current bias and scale factor to get the field in uT
+	handler->_hxfilt = (handler->_hxfilt * (coeff - 1.0f) + (handler->_hx / handler->_hxs + handler->_hxb)) / coeff;
+	handler->_hyfilt = (handler->_hyfilt * (coeff - 1.0f) + (handler->_hy / handler->_hys + handler->_hyb)) / coeff;
+	handler->_hzfilt = (handler->_hzfilt * (coeff - 1.0f) + (handler->_hz / handler->_hzs + handler->_hzb)) / coeff;
+
+	// let the filter settle before it defines the envelope
+	if (!primed && handler->_counter < handler->_coeff * 4) {
+		handler->_counter++;
+		return;
+	}
+	if (!primed) {
+		handler->_counter = 0;
+		handler->_framedelta = 0.0f;
+	}
+
+	// growth of the envelope in this sample (largest axis) and since the window started
+	handler->_delta = magCalEnvelope(handler->_hxfilt, &handler->_hxmax, &handler->_hxmin);
+	handler->_delta = fmaxf(handler->_delta, magCalEnvelope(handler->_hyfilt, &handler->_hymax, &handler->_hymin));
+	handler->_delta = fmaxf(handler->_delta, magCalEnvelope(handler->_hzfilt, &handler->_hzmax, &handler->_hzmin));
+	if (handler->_delta > 0.0f) {
+		handler->_magCalDirty = true;
+	}
+	handler->_framedelta += handler->_delta;
+
+	if (handler->_framedelta > handler->_deltaThresh) {
+		handler->_counter = 0;
+		handler->_framedelta = 0.0f;
+		return;
+	}
+	if (handler->_counter < handler->_maxCounts) {
+		handler->_counter++;
+		return;
+	}
+	if (!handler->_magCalDirty ||
+	    handler->_hxmax - handler->_hxmin < MPU9250_MAG_CAL_MIN_SPAN ||
+	    handler->_hymax - handler->_hymin < MPU9250_MAG_CAL_MIN_SPAN ||
+	    handler->_hzmax - handler->_hzmin < MPU9250_MAG_CAL_MIN_SPAN) {
+		return;
+	}
+
+	// find the magnetometer bias
+	handler->_hxb = (handler->_hxmax + handler->_hxmin) / 2.0f;
+	handler->_hyb = (handler->_hymax + handler->_hymin) / 2.0f;
+	handler->_hzb = (handler->_hzmax + handler->_hzmin) / 2.0f;
+
+	// find the magnetometer scale factor
+	handler->_hxs = (handler->_hxmax - handler->_hxmin) / 2.0f;
+	handler->_hys = (handler->_hymax - handler->_hymin) / 2.0f;
+	handler->_hzs = (handler->_hzmax - handler->_hzmin) / 2.0f;
+	handler->_avgs = (handler->_hxs + handler->_hys + handler->_hzs) / 3.0f;
+	handler->_hxs = handler->_avgs / handler->_hxs;
+	handler->_hys = handler->_avgs / handler->_hys;
+	handler->_hzs = handler->_avgs / handler->_hzs;
+
+	mpu9250UpdateConversion(handler);
+	handler->_magCalDirty = false;
+	handler->_magCalUpdates++;
+}
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpu9250.h"
+
+// Vector kernel picked at build time from what the compiler targets (-mavx2 -mfma, -msse2, NEON)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MPU9250_KERNEL        "avx2"
+#define VEC_LANES             8
+typedef __m256 vec_t;
+#define VEC_SET1(x)           _mm256_set1_ps(x)
+#define VEC_LOAD16(p)         _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(p))))
+#define VEC_STORE(p, v)       _mm256_storeu_ps(p, v)
+#if defined(__FMA__)
+#define VEC_MADD(a, b, c)     _mm256_fmadd_ps(a, b, c)
+#else
+#define VEC_MADD(a, b, c)     _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MPU9250_KERNEL        "sse2"
+#define VEC_LANES             4
+typedef __m128 vec_t;
+#define VEC_SET1(x)           _mm_set1_ps(x)
+#define VEC_LOAD16(p)         sse2Load16(p)
+#define VEC_STORE(p, v)       _mm_storeu_ps(p, v)
+#define VEC_MADD(a, b, c)     _mm_add_ps(_mm_mul_ps(a, b), c)
+static inline __m128 sse2Load16(const int16_t *p)
+{
+	__m128i v = _mm_loadl_epi64((const __m128i *)p);
+
+	// sign extend the four counts to 32 bits
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MPU9250_KERNEL        "neon"
+#define VEC_LANES             4
+typedef float32x4_t vec_t;
+#define VEC_SET1(x)           vdupq_n_f32(x)
+#define VEC_LOAD16(p)         vcvtq_f32_s32(vmovl_s16(vld1_s16(p)))
+#define VEC_STORE(p, v)       vst1q_f32(p, v)
+#if defined(__aarch64__)
+#define VEC_MADD(a, b, c)     vfmaq_f32(c, a, b)
+#else
+#define VEC_MADD(a, b, c)     vmlaq_f32(c, a, b)
+#endif
+#else
+#define MPU9250_KERNEL        "scalar"
+#endif
+
+#define BLOCK_ALIGN           64
+
+
+// out[i] = gain . (a[i], b[i], c[i]) + offset, one output axis of the accel or the gyro
+#ifndef MPU9250_FIXED_MOUNT
+static void convertRow3(const int16_t *a, const int16_t *b, const int16_t *c,
+                        const float gain[3], float offset, float *out, size_t count)
+{
+	size_t i = 0;
+
+#ifdef VEC_LANES
+	const vec_t g0 = VEC_SET1(gain[0]);
+	const vec_t g1 = VEC_SET1(gain[1]);
+	const vec_t g2 = VEC_SET1(gain[2]);
+	const vec_t off = VEC_SET1(offset);
+
+	for (; i + VEC_LANES <= count; i += VEC_LANES) {
+		vec_t r = VEC_MADD(VEC_LOAD16(a + i), g0, off);
+		r = VEC_MADD(VEC_LOAD16(b + i), g1, r);
+		r = VEC_MADD(VEC_LOAD16(c + i), g2, r);
+		VEC_STORE(out + i, r);
+	}
+#endif
+	for (; i < count; i++) {
+		out[i] = gain[0] * a[i] + gain[1] * b[i] + gain[2] * c[i] + offset;
+	}
+}
+#endif
+
+// out[i] = gain * a[i] + offset, one magnetometer axis, the temperature or a fixed mount axis
+static void convertRow1(const int16_t *a, float gain, float offset, float *out, size_t count)
+{
+	size_t i = 0;
+
+#ifdef VEC_LANES
+	const vec_t g = VEC_SET1(gain);
+	const vec_t off = VEC_SET1(offset);
+
+	for (; i + VEC_LANES <= count; i += VEC_LANES) {
+		VEC_STORE(out + i, VEC_MADD(VEC_LOAD16(a + i), g, off));
+	}
+#endif
+	for (; i < count; i++) {
+		out[i] = gain * a[i] + offset;
+	}
+}
+
+// Fold transform, scale, bias and scale factor of the control structure into handler->_conv
+void mpu9250UpdateConversion(MPU9250_control_t *handler)
+{
+	MPU9250_conversion_t *conv = &handler->_conv;
+	const short *t[3] = { handler->tX, handler->tY, handler->tZ };
+	const float accelS[3] = { handler->_axs, handler->_ays, handler->_azs };
+	const float accelB[3] = { handler->_axb, handler->_ayb, handler->_azb };
+	const float gyroB[3] = { handler->_gxb, handler->_gyb, handler->_gzb };
+	const float magScale[3] = { handler->_magScaleX, handler->_magScaleY, handler->_magScaleZ };
+	const float magS[3] = { handler->_hxs, handler->_hys, handler->_hzs };
+	const float magB[3] = { handler->_hxb, handler->_hyb, handler->_hzb };
+	int axis, j;
+
+	for (axis = 0; axis < 3; axis++) {
+		for (j = 0; j < 3; j++) {
+			conv->accelGain[axis][j] = t[axis][j] * handler->_accelScale * accelS[axis];
+			conv->gyroGain[axis][j] = t[axis][j] * handler->_gyroScale;
+		}
+		conv->accelOffset[axis] = -accelB[axis] * accelS[axis];
+		conv->gyroOffset[axis] = -gyroB[axis];
+		conv->magGain[axis] = magScale[axis] * magS[axis];
+		conv->magOffset[axis] = -magB[axis] * magS[axis];
+	}
+	// t = (counts - offset) / scale + offset
+	conv->tempGain = 1.0f / handler->_tempScale;
+	conv->tempOffset = handler->_tempOffset - handler->_tempOffset / handler->_tempScale;
+}
+
+// Bytes taken by one channel array, rounded up so every array starts on its own cache line
+static size_t blockStride(size_t capacity, size_t size)
+{
+	return (capacity * size + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1);
+}
+
+// Address of channel array number index inside an allocation of arrays of the same element size
+static void *blockArray(void *base, size_t capacity, size_t size, int index)
+{
+	return (char *)base + blockStride(capacity, size) * index;
+}
+
+bool mpu9250RawBlockAlloc(MPU9250_rawBlock_t *block, size_t capacity)
+{
+	size_t countsBytes = blockStride(capacity, sizeof(int16_t)) * 10;
+	size_t stampsBytes = blockStride(capacity, sizeof(uint64_t));
+	void *base;
+
+	memset(block, 0, sizeof(*block));
+	if (capacity == 0 || posix_memalign(&base, BLOCK_ALIGN, countsBytes + stampsBytes +
+	                                    blockStride(capacity, sizeof(uint32_t))) != 0) {
+		return false;
+	}
+	block->ax = blockArray(base, capacity, sizeof(int16_t), 0);
+	block->ay = blockArray(base, capacity, sizeof(int16_t), 1);
+	block->az = blockArray(base, capacity, sizeof(int16_t), 2);
+	block->gx = blockArray(base, capacity, sizeof(int16_t), 3);
+	block->gy = blockArray(base, capacity, sizeof(int16_t), 4);
+	block->gz = blockArray(base, capacity, sizeof(int16_t), 5);
+	block->hx = blockArray(base, capacity, sizeof(int16_t), 6);
+	block->hy = blockArray(base, capacity, sizeof(int16_t), 7);
+	block->hz = blockArray(base, capacity, sizeof(int16_t), 8);
+	block->t = blockArray(base, capacity, sizeof(int16_t), 9);
+	block->timestampNs = (uint64_t *)((char *)base + countsBytes);
+	block->seq = (uint32_t *)((char *)base + countsBytes + stampsBytes);
+	block->capacity = capacity;
+	return true;
+}
+
+void mpu9250RawBlockFree(MPU9250_rawBlock_t *block)
+{
+	free(block->ax);
+	memset(block, 0, sizeof(*block));
+}
+
+// Append driver records to the block (array of structures to structure of arrays), returns how many fit
+size_t mpu9250RawBlockAppend(MPU9250_rawBlock_t *block, const struct mse_sample *samples, size_t count)
+{
+	size_t i, n = block->capacity - block->count;
+
+	if (count < n) {
+		n = count;
+	}
+	for (i = 0; i < n; i++) {
+		size_t k = block->count + i;
+
+		block->ax[k] = samples[i].accel[0];
+		block->ay[k] = samples[i].accel[1];
+		block->az[k] = samples[i].accel[2];
+		block->gx[k] = samples[i].gyro[0];
+		block->gy[k] = samples[i].gyro[1];
+		block->gz[k] = samples[i].gyro[2];
+		block->hx[k] = samples[i].mag[0];
+		block->hy[k] = samples[i].mag[1];
+		block->hz[k] = samples[i].mag[2];
+		block->t[k] = samples[i].temp;
+		block->timestampNs[k] = samples[i].timestamp_ns;
+		block->seq[k] = samples[i].seq;
+	}
+	block->count += n;
+	return n;
+}
+
+bool mpu9250BlockAlloc(MPU9250_block_t *block, size_t capacity)
+{
+	void *base;
+
+	memset(block, 0, sizeof(*block));
+	if (capacity == 0 || posix_memalign(&base, BLOCK_ALIGN, blockStride(capacity, sizeof(float)) * 10) != 0) {
+		return false;
+	}
+	block->ax = blockArray(base, capacity, sizeof(float), 0);
+	block->ay = blockArray(base, capacity, sizeof(float), 1);
+	block->az = blockArray(base, capacity, sizeof(float), 2);
+	block->gx = blockArray(base, capacity, sizeof(float), 3);
+	block->gy = blockArray(base, capacity, sizeof(float), 4);
+	block->gz = blockArray(base, capacity, sizeof(float), 5);
+	block->hx = blockArray(base, capacity, sizeof(float), 6);
+	block->hy = blockArray(base, capacity, sizeof(float), 7);
+	block->hz = blockArray(base, capacity, sizeof(float), 8);
+	block->t = blockArray(base, capacity, sizeof(float), 9);
+	block->capacity = capacity;
+	return true;
+}
+
+void mpu9250BlockFree(MPU9250_block_t *block)
+{
+	free(block->ax);
+	memset(block, 0, sizeof(*block));
+}
+
+// Convert every sample of raw into out (up to its capacity), channel by channel
+void mpu9250ConvertBlock(const MPU9250_control_t *handler, const MPU9250_rawBlock_t *raw, MPU9250_block_t *out)
+{
+	const MPU9250_conversion_t *conv = &handler->_conv;
+	size_t n = (raw->count < out->capacity) ? raw->count : out->capacity;
+
+#ifdef MPU9250_FIXED_MOUNT
+	// the transform is a permutation with sign known at build time, one channel per output axis
+	convertRow1(MPU9250_MOUNT_PICK(MPU9250_MOUNT_X, raw->ax, raw->ay, raw->az),
+	            conv->accelGain[0][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X)], conv->accelOffset[0], out->ax, n);
+	convertRow1(MPU9250_MOUNT_PICK(MPU9250_MOUNT_Y, raw->ax, raw->ay, raw->az),
+	            conv->accelGain[1][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y)], conv->accelOffset[1], out->ay, n);
+	convertRow1(MPU9250_MOUNT_PICK(MPU9250_MOUNT_Z, raw->ax, raw->ay, raw->az),
+	            conv->accelGain[2][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z)], conv->accelOffset[2], out->az, n);
+	convertRow1(MPU9250_MOUNT_PICK(MPU9250_MOUNT_X, raw->gx, raw->gy, raw->gz),
+	            conv->gyroGain[0][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_X)], conv->gyroOffset[0], out->gx, n);
+	convertRow1(MPU9250_MOUNT_PICK(MPU9250_MOUNT_Y, raw->gx, raw->gy, raw->gz),
+	            conv->gyroGain[1][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Y)], conv->gyroOffset[1], out->gy, n);
+	convertRow1(MPU9250_MOUNT_PICK(MPU9250_MOUNT_Z, raw->gx, raw->gy, raw->gz),
+	            conv->gyroGain[2][MPU9250_MOUNT_INDEX(MPU9250_MOUNT_Z)], conv->gyroOffset[2], out->gz, n);
+#else
+	convertRow3(raw->ax, raw->ay, raw->az, conv->accelGain[0], conv->accelOffset[0], out->ax, n);
+	convertRow3(raw->ax, raw->ay, raw->az, conv->accelGain[1], conv->accelOffset[1], out->ay, n);
+	convertRow3(raw->ax, raw->ay, raw->az, conv->accelGain[2], conv->accelOffset[2], out->az, n);
+	convertRow3(raw->gx, raw->gy, raw->gz, conv->gyroGain[0], conv->gyroOffset[0], out->gx, n);
+	convertRow3(raw->gx, raw->gy, raw->gz, conv->gyroGain[1], conv->gyroOffset[1], out->gy, n);
+	convertRow3(raw->gx, raw->gy, raw->gz, conv->gyroGain[2], conv->gyroOffset[2], out->gz, n);
+#endif
+	convertRow1(raw->hx, conv->magGain[0], conv->magOffset[0], out->hx, n);
+	convertRow1(raw->hy, conv->magGain[1], conv->magOffset[1], out->hy, n);
+	convertRow1(raw->hz, conv->magGain[2], conv->magOffset[2], out->hz, n);
+	convertRow1(raw->t, conv->tempGain, conv->tempOffset, out->t, n);
+	out->count = n;
+}
+
+// Name of the kernel this build uses, to tell apart results in benchmarks
+const char *mpu9250ConvertKernel(void)
+{
+	return MPU9250_KERNEL;
+}
@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mpu9250.h"
+
+// MPU9250 registers modelled by the emulator
+#define EMU_SMPDIV                    0x19
+#define EMU_CONFIG                    0x1A
+#define EMU_GYRO_CONFIG               0x1B
+#define EMU_ACCEL_CONFIG              0x1C
+#define EMU_FIFO_EN                   0x23
+#define EMU_I2C_SLV0_ADDR             0x25
+#define EMU_I2C_SLV0_REG              0x26
+#define EMU_I2C_SLV0_CTRL             0x27
+#define EMU_INT_STATUS                0x3A
+#define EMU_ACCEL_OUT                 0x3B
+#define EMU_TEMP_OUT                  0x41
+#define EMU_GYRO_OUT                  0x43
+#define EMU_EXT_SENS_DATA_00          0x49
+#define EMU_EXT_SENS_DATA_23          0x60
+#define EMU_I2C_SLV0_DO               0x63
+#define EMU_USER_CTRL                 0x6A
+#define EMU_PWR_MGMNT_1               0x6B
+#define EMU_FIFO_COUNT                0x72
+#define EMU_FIFO_READ                 0x74
+#define EMU_WHO_AM_I                  0x75
+#define EMU_NUM_REGS                  128
+
+#define EMU_FIFO_TEMP                 0x80
+#define EMU_FIFO_GYRO_X               0x40
+#define EMU_FIFO_GYRO_Y               0x20
+#define EMU_FIFO_GYRO_Z               0x10
+#define EMU_FIFO_ACCEL                0x08
+#define EMU_FIFO_SLV0                 0x01
+#define EMU_USER_FIFO_EN              0x40
+#define EMU_USER_I2C_MST_EN           0x20
+#define EMU_USER_FIFO_RST             0x04
+#define EMU_USER_SELF_CLEAR           0x07
+#define EMU_PWR_RESET                 0x80
+#define EMU_I2C_READ_FLAG             0x80
+#define EMU_I2C_SLV0_EN               0x80
+#define EMU_FIFO_SIZE                 512
+
+// AK8963 registers
+#define EMU_AK8963_I2C_ADDR           0x0C
+#define EMU_AK8963_WIA                0x00
+#define EMU_AK8963_ST1                0x02
+#define EMU_AK8963_HXL                0x03
+#define EMU_AK8963_ST2                0x09
+#define EMU_AK8963_CNTL1              0x0A
+#define EMU_AK8963_CNTL2              0x0B
+#define EMU_AK8963_ASA                0x10
+#define EMU_AK8963_NUM_REGS           0x13
+#define EMU_AK8963_BITM               0x10    // 16 bit output (CNTL1 and ST2)
+#define EMU_AK8963_HOFL               0x08
+
+// Still board lying flat: 1 g on the sensor z axis, a small gyro bias, 25 C and the Earth field.
+// Noise at noise=1 is the one seen on the real board at 184 Hz.
+#define EMU_G                         9.807
+#define EMU_D2R                       (3.14159265359 / 180.0)
+#define EMU_GYRO_BIAS_DPS             { 0.8, -0.5, 0.3 }
+#define EMU_MAG_UT                    { 20.0, 5.0, -40.0 }
+#define EMU_TEMP_C                    25.0
+#define EMU_ACCEL_NOISE               0.04    // m/s2
+#define EMU_GYRO_NOISE                0.14    // dps
+#define EMU_MAG_NOISE                 0.4     // uT
+#define EMU_TEMP_NOISE                0.02    // C
+#define EMU_ASA                       { 0xB0, 0xB3, 0xA5 }
+// ticks caught up at once after a long pause, enough to fill the FIFO and settle SLV0
+#define EMU_MAX_CATCH_UP              64
+
+typedef struct {
+   MPU9250_bus_t bus;
+   double noise;
+   uint64_t rng;
+   unsigned char regs[EMU_NUM_REGS];
+   unsigned char ak[EMU_AK8963_NUM_REGS];
+   unsigned char fifo[EMU_FIFO_SIZE];
+   unsigned int fifoHead, fifoCount;
+   unsigned char whoAmI;
+   uint64_t nextTickNs;
+   uint64_t nextMagNs;
+} MPU9250_emulator_t;
+
+
+// xorshift64*, the same seed gives the same samples
+static double emuUniform(MPU9250_emulator_t *emu)
+{
+	emu->rng ^= emu->rng >> 12;
+	emu->rng ^= emu->rng << 25;
+	emu->rng ^= emu->rng >> 27;
+	return ((emu->rng * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double emuGauss(MPU9250_emulator_t *emu, double std)
+{
+	double u = emuUniform(emu), v = emuUniform(emu);
+
+	if (std == 0.0) {
+		return 0.0;
+	}
+	return std * sqrt(-2.0 * log(u + 1e-300)) * cos(2.0 * 3.14159265359 * v);
+}
+
+static void emuPut16(unsigned char *dest, double counts, bool bigEndian)
+{
+	long value = lround(counts);
+
+	if (value > 32767) {
+		value = 32767;
+	} else if (value < -32768) {
+		value = -32768;
+	}
+	dest[bigEndian ? 0 : 1] = (unsigned char)((uint16_t)value >> 8);
+	dest[bigEndian ? 1 : 0] = (unsigned char)value;
+}
+
+static void emuReset(MPU9250_emulator_t *emu)
+{
+	static const unsigned char asa[3] = EMU_ASA;
+
+	memset(emu->regs, 0, sizeof(emu->regs));
+	emu->regs[EMU_PWR_MGMNT_1] = 0x01;
+	emu->regs[EMU_WHO_AM_I] = emu->whoAmI;
+	emu->fifoHead = emu->fifoCount = 0;
+	memset(emu->ak, 0, sizeof(emu->ak));
+	emu->ak[EMU_AK8963_WIA] = 0x48;
+	memcpy(&emu->ak[EMU_AK8963_ASA], asa, sizeof(asa));
+}
+
+// New accel, temp and gyro output registers for the current ranges
+static void emuMeasure(MPU9250_emulator_t *emu)
+{
+	static const double gyroBias[3] = EMU_GYRO_BIAS_DPS;
+	const double accelLsb = 32768.0 / (EMU_G * (2 << ((emu->regs[EMU_ACCEL_CONFIG] >> 3) & 3)));
+	const double gyroLsb = 32768.0 / (250 << ((emu->regs[EMU_GYRO_CONFIG] >> 3) & 3));
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		double accel = (i == 2 ? EMU_G : 0.0) + emuGauss(emu, EMU_ACCEL_NOISE * emu->noise);
+		double gyro = gyroBias[i] + emuGauss(emu, EMU_GYRO_NOISE * emu->noise);
+
+		emuPut16(&emu->regs[EMU_ACCEL_OUT + 2 * i], accel * accelLsb, true);
+		emuPut16(&emu->regs[EMU_GYRO_OUT + 2 * i], gyro * gyroLsb, true);
+	}
+	emuPut16(&emu->regs[EMU_TEMP_OUT], (EMU_TEMP_C + emuGauss(emu, EMU_TEMP_NOISE * emu->noise) - 21.0) * 333.87, true);
+	emu->regs[EMU_INT_STATUS] |= 0x01;
+}
+
+// AK8963 continuous modes 1 (8 Hz) and 2 (100 Hz) produce a new field measurement
+static void emuMeasureMag(MPU9250_emulator_t *emu, uint64_t now)
+{
+	static const double field[3] = EMU_MAG_UT;
+	unsigned char mode = emu->ak[EMU_AK8963_CNTL1] & 0x0F;
+	bool bits16 = emu->ak[EMU_AK8963_CNTL1] & EMU_AK8963_BITM;
+	double lsb = bits16 ? 0.15 : 0.6;
+	int i;
+
+	if ((mode != 0x02 && mode != 0x06) || now < emu->nextMagNs) {
+		return;
+	}
+	emu->nextMagNs = now + ((mode == 0x02) ? 125000000ull : 10000000ull);
+	for (i = 0; i < 3; i++) {
+		// the output is raw, mpu9250Init corrects it with the ASA
+		double adjust = (emu->ak[EMU_AK8963_ASA + i] - 128) / 256.0 + 1.0;
+
+		emuPut16(&emu->ak[EMU_AK8963_HXL + 2 * i], (field[i] + emuGauss(emu, EMU_MAG_NOISE * emu->noise)) / lsb / adjust, false);
+	}
+	emu->ak[EMU_AK8963_ST1] |= 0x01;
+	emu->ak[EMU_AK8963_ST2] = bits16 ? EMU_AK8963_BITM : 0;
+}
+
+static void emuAk8963Write(MPU9250_emulator_t *emu, unsigned char reg, unsigned char value)
+{
+	static const unsigned char asa[3] = EMU_ASA;
+
+	if (reg == EMU_AK8963_CNTL2 && (value & 0x01)) {
+		memset(emu->ak, 0, sizeof(emu->ak));
+		emu->ak[EMU_AK8963_WIA] = 0x48;
+		memcpy(&emu->ak[EMU_AK8963_ASA], asa, sizeof(asa));
+		return;
+	}
+	if (reg == EMU_AK8963_CNTL1) {
+		emu->ak[reg] = value;
+		emu->nextMagNs = 0;
+	}
+}
+
+// The I2C master runs SLV0 once per sample: read into EXT_SENS_DATA or write SLV0_DO
+static void emuSlave0(MPU9250_emulator_t *emu)
+{
+	unsigned char ctrl = emu->regs[EMU_I2C_SLV0_CTRL], addr = emu->regs[EMU_I2C_SLV0_ADDR];
+	unsigned char reg = emu->regs[EMU_I2C_SLV0_REG];
+	unsigned int len = ctrl & 0x0F, i;
+
+	if (!(emu->regs[EMU_USER_CTRL] & EMU_USER_I2C_MST_EN) || !(ctrl & EMU_I2C_SLV0_EN) ||
+	    (addr & 0x7F) != EMU_AK8963_I2C_ADDR || len == 0) {
+		return;
+	}
+	if (!(addr & EMU_I2C_READ_FLAG)) {
+		emuAk8963Write(emu, reg, emu->regs[EMU_I2C_SLV0_DO]);
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		unsigned char akReg = reg + i;
+
+		emu->regs[EMU_EXT_SENS_DATA_00 + i] = (akReg < EMU_AK8963_NUM_REGS) ? emu->ak[akReg] : 0;
+		// reading ST2 ends the data read
+		if (akReg == EMU_AK8963_ST2) {
+			emu->ak[EMU_AK8963_ST1] &= ~0x01;
+		}
+	}
+}
+
+// Keep the FIFO in stream mode: when it is full the oldest bytes go, misaligning the frames
+static void emuFifoPush(MPU9250_emulator_t *emu, const unsigned char *data, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if (emu->fifoCount == EMU_FIFO_SIZE) {
+			emu->fifoHead = (emu->fifoHead + 1) % EMU_FIFO_SIZE;
+			emu->fifoCount--;
+		}
+		emu->fifo[(emu->fifoHead + emu->fifoCount) % EMU_FIFO_SIZE] = data[i];
+		emu->fifoCount++;
+	}
+}
+
+static void emuTick(MPU9250_emulator_t *emu, uint64_t now)
+{
+	unsigned char fifoEn = emu->regs[EMU_FIFO_EN];
+
+	emuMeasure(emu);
+	emuMeasureMag(emu, now);
+	emuSlave0(emu);
+	if (!(emu->regs[EMU_USER_CTRL] & EMU_USER_FIFO_EN)) {
+		return;
+	}
+	if (fifoEn & EMU_FIFO_ACCEL) {
+		emuFifoPush(emu, &emu->regs[EMU_ACCEL_OUT], 6);
+	}
+	if (fifoEn & EMU_FIFO_TEMP) {
+		emuFifoPush(emu, &emu->regs[EMU_TEMP_OUT], 2);
+	}
+	if (fifoEn & EMU_FIFO_GYRO_X) {
+		emuFifoPush(emu, &emu->regs[EMU_GYRO_OUT], 2);
+	}
+	if (fifoEn & EMU_FIFO_GYRO_Y) {
+		emuFifoPush(emu, &emu->regs[EMU_GYRO_OUT + 2], 2);
+	}
+	if (fifoEn & EMU_FIFO_GYRO_Z) {
+		emuFifoPush(emu, &emu->regs[EMU_GYRO_OUT + 4], 2);
+	}
+	if (fifoEn & EMU_FIFO_SLV0) {
+		emuFifoPush(emu, &emu->regs[EMU_EXT_SENS_DATA_00], emu->regs[EMU_I2C_SLV0_CTRL] & 0x0F);
+	}
+}
+
+// Run every sample period elapsed since the last register access
+static void emuAdvance(MPU9250_emulator_t *emu)
+{
+	uint64_t now = mpu9250BusNow(&emu->bus);
+	uint64_t period = (uint64_t)(emu->regs[EMU_SMPDIV] + 1) * 1000000;
+	uint64_t ticks;
+
+	if (emu->nextTickNs == 0) {
+		emu->nextTickNs = now + period;
+		return;
+	}
+	if (now < emu->nextTickNs) {
+		return;
+	}
+	ticks = (now - emu->nextTickNs) / period + 1;
+	if (ticks > EMU_MAX_CATCH_UP) {
+		emu->nextTickNs += (ticks - EMU_MAX_CATCH_UP) * period;
+		ticks = EMU_MAX_CATCH_UP;
+	}
+	while (ticks-- > 0) {
+		emuTick(emu, emu->nextTickNs);
+		emu->nextTickNs += period;
+	}
+}
+
+static unsigned char emuReadReg(MPU9250_emulator_t *emu, unsigned char reg)
+{
+	unsigned char value;
+
+	switch (reg) {
+		case EMU_FIFO_READ:
+			if (emu->fifoCount == 0) {
+				return 0xFF;
+			}
+			value = emu->fifo[emu->fifoHead];
+			emu->fifoHead = (emu->fifoHead + 1) % EMU_FIFO_SIZE;
+			emu->fifoCount--;
+			return value;
+		case EMU_FIFO_COUNT:
+			return (unsigned char)(emu->fifoCount >> 8);
+		case EMU_FIFO_COUNT + 1:
+			return (unsigned char)emu->fifoCount;
+		case EMU_INT_STATUS:
+			value = emu->regs[reg];
+			emu->regs[reg] = 0;
+			return value;
+	}
+	return (reg < EMU_NUM_REGS) ? emu->regs[reg] : 0;
+}
+
+static bool emuReadRegs(MPU9250_control_t *handler, unsigned char reg, unsigned short count, unsigned char *dest)
+{
+	MPU9250_emulator_t *emu = handler->_transportData;
+	unsigned short i;
+
+	emuAdvance(emu);
+	for (i = 0; i < count; i++) {
+		// FIFO_R_W does not auto increment, a burst on it drains the FIFO
+		dest[i] = emuReadReg(emu, (reg == EMU_FIFO_READ) ? reg : (unsigned char)(reg + i));
+	}
+	return true;
+}
+
+static bool emuWriteReg(MPU9250_control_t *handler, unsigned char reg, unsigned char value)
+{
+	MPU9250_emulator_t *emu = handler->_transportData;
+
+	emuAdvance(emu);
+	if (reg >= EMU_NUM_REGS) {
+		return false;
+	}
+	// sensor outputs, EXT_SENS_DATA, FIFO count and WHO_AM_I are read only
+	if ((reg >= EMU_INT_STATUS && reg <= EMU_EXT_SENS_DATA_23) || reg == EMU_FIFO_COUNT ||
+	    reg == EMU_FIFO_COUNT + 1 || reg == EMU_FIFO_READ || reg == EMU_WHO_AM_I) {
+		return true;
+	}
+	if (reg == EMU_PWR_MGMNT_1 && (value & EMU_PWR_RESET)) {
+		emuReset(emu);
+		return true;
+	}
+	if (reg == EMU_USER_CTRL) {
+		if (value & EMU_USER_FIFO_RST) {
+			emu->fifoHead = emu->fifoCount = 0;
+		}
+		value &= ~EMU_USER_SELF_CLEAR;
+	}
+	emu->regs[reg] = value;
+	return true;
+}
+
+// emu[:noise=1,speed=1,seed=1,whoami=0x71], speed makes the sensor time run faster than real time
+static bool emuOpen(MPU9250_control_t *handler, const char *device)
+{
+	MPU9250_emulator_t *emu;
+	char options[64], *option, *save = NULL;
+	double speed = 1.0;
+	unsigned long seed = 1;
+
+	emu = calloc(1, sizeof(*emu));
+	if (emu == NULL) {
+		return false;
+	}
+	emu->noise = 1.0;
+	emu->whoAmI = 0x71;
+
+	snprintf(options, sizeof(options), "%s", (device[3] == ':') ? device + 4 : "");
+	for (option = strtok_r(options, ",", &save); option != NULL; option = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(option, '=');
+
+		if (value == NULL) {
+			break;
+		}
+		*value++ = '\0';
+		if (strcmp(option, "noise") == 0) {
+			emu->noise = strtod(value, NULL);
+		} else if (strcmp(option, "speed") == 0) {
+			speed = strtod(value, NULL);
+		} else if (strcmp(option, "seed") == 0) {
+			seed = strtoul(value, NULL, 0);
+		} else if (strcmp(option, "whoami") == 0) {
+			emu->whoAmI = (unsigned char)strtoul(value, NULL, 0);
+		} else {
+			break;
+		}
+	}
+	if (option != NULL || speed <= 0.0 || emu->noise < 0.0) {
+		printf("Bad emulator options in %s\n", device);
+		free(emu);
+		return false;
+	}
+
+	mpu9250BusInit(&emu->bus, speed);
+	emu->rng = seed * 0x9E3779B97F4A7C15ull + 1;
+	emuReset(emu);
+	handler->_transportData = emu;
+	return true;
+}
+
+static void emuClose(MPU9250_control_t *handler)
+{
+	free(handler->_transportData);
+	handler->_transportData = NULL;
+}
+
+const MPU9250_transport_t mpu9250EmulatorTransport = {
+	.name = "emulator",
+	.open = emuOpen,
+	.close = emuClose,
+	.readRegs = emuReadRegs,
+	.writeReg = emuWriteReg,
+	.runBatch = mpu9250BusRunBatch,
+	.command = mpu9250BusCommand,
+	.readSamples = mpu9250BusReadSamples,
+	.wait = mpu9250BusWait,
+};
@@ -0,0 +1,233 @@
+#include <math.h>
+#include <string.h>
+
+#include "mpu9250.h"
+
+// Default gains: Madgwick beta for ~3 dps of gyro error, Mahony 2*Kp and 2*Ki
+#define MPU9250_FUSION_BETA           0.1f
+#define MPU9250_FUSION_TWO_KP         1.0f
+#define MPU9250_FUSION_TWO_KI         0.0f
+
+// Longest step integrated between two samples (after a gap only this much is integrated)
+#define MPU9250_FUSION_MAX_DT         0.1f
+
+// 1/sqrt(x) that stays finite for x = 0, so a missing magnetometer needs no branch
+static inline float invNorm(float x)
+{
+	return 1.0f / sqrtf(x + 1e-12f);
+}
+
+// Madgwick MARG step. A zero magnetometer vector makes its terms vanish (IMU only update).
+static inline void madgwickStep(float *q, float beta, float gx, float gy, float gz,
+                                float ax, float ay, float az, float mx, float my, float mz, float dt)
+{
+	float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	float recipNorm, s0, s1, s2, s3, hx, hy;
+	float _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz;
+	float _2q0, _2q1, _2q2, _2q3, _2q0q2, _2q2q3;
+	float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+
+	recipNorm = invNorm(ax * ax + ay * ay + az * az);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+	recipNorm = invNorm(mx * mx + my * my + mz * mz);
+	mx *= recipNorm;
+	my *= recipNorm;
+	mz *= recipNorm;
+
+	_2q0mx = 2.0f * q0 * mx;
+	_2q0my = 2.0f * q0 * my;
+	_2q0mz = 2.0f * q0 * mz;
+	_2q1mx = 2.0f * q1 * mx;
+	_2q0 = 2.0f * q0;
+	_2q1 = 2.0f * q1;
+	_2q2 = 2.0f * q2;
+	_2q3 = 2.0f * q3;
+	_2q0q2 = 2.0f * q0 * q2;
+	_2q2q3 = 2.0f * q2 * q3;
+	q0q0 = q0 * q0;
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q0q3 = q0 * q3;
+	q1q1 = q1 * q1;
+	q1q2 = q1 * q2;
+	q1q3 = q1 * q3;
+	q2q2 = q2 * q2;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+
+	// reference direction of the earth magnetic field
+	hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+	hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+	_2bx = sqrtf(hx * hx + hy * hy);
+	_2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+	_4bx = 2.0f * _2bx;
+	_4bz = 2.0f * _2bz;
+
+	// gradient descent corrective step
+	s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay)
+	     - _2bz * q2 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx)
+	     + (-_2bx * q3 + _2bz * q1) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my)
+	     + _2bx * q2 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay)
+	     - 4.0f * q1 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az)
+	     + _2bz * q3 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx)
+	     + (_2bx * q2 + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my)
+	     + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay)
+	     - 4.0f * q2 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az)
+	     + (-_4bx * q2 - _2bz * q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx)
+	     + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my)
+	     + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay)
+	     + (-_4bx * q3 + _2bz * q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx)
+	     + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my)
+	     + _2bx * q1 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	recipNorm = invNorm(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+
+	// integrate the rate of change of the quaternion
+	q0 += (0.5f * (-q1 * gx - q2 * gy - q3 * gz) - beta * s0 * recipNorm) * dt;
+	q1 += (0.5f * (q0 * gx + q2 * gz - q3 * gy) - beta * s1 * recipNorm) * dt;
+	q2 += (0.5f * (q0 * gy - q1 * gz + q3 * gx) - beta * s2 * recipNorm) * dt;
+	q3 += (0.5f * (q0 * gz + q1 * gy - q2 * gx) - beta * s3 * recipNorm) * dt;
+
+	recipNorm = invNorm(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+}
+
+// Mahony MARG step. With twoKi = 0 the integral stays at zero, so there is no branch for it.
+static inline void mahonyStep(float *q, float *integral, float twoKp, float twoKi, float gx, float gy, float gz,
+                              float ax, float ay, float az, float mx, float my, float mz, float dt)
+{
+	float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	float recipNorm, hx, hy, bx, bz, qa, qb, qc;
+	float halfvx, halfvy, halfvz, halfwx, halfwy, halfwz, halfex, halfey, halfez;
+	float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+
+	recipNorm = invNorm(ax * ax + ay * ay + az * az);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+	recipNorm = invNorm(mx * mx + my * my + mz * mz);
+	mx *= recipNorm;
+	my *= recipNorm;
+	mz *= recipNorm;
+
+	q0q0 = q0 * q0;
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q0q3 = q0 * q3;
+	q1q1 = q1 * q1;
+	q1q2 = q1 * q2;
+	q1q3 = q1 * q3;
+	q2q2 = q2 * q2;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+
+	// reference direction of the earth magnetic field
+	hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+	hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+	bx = sqrtf(hx * hx + hy * hy);
+	bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+	// estimated direction of gravity and magnetic field
+	halfvx = q1q3 - q0q2;
+	halfvy = q0q1 + q2q3;
+	halfvz = q0q0 - 0.5f + q3q3;
+	halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+	halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+	halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+	// error is the sum of the cross products between estimated and measured directions
+	halfex = (ay * halfvz - az * halfvy) + (my * halfwz - mz * halfwy);
+	halfey = (az * halfvx - ax * halfvz) + (mz * halfwx - mx * halfwz);
+	halfez = (ax * halfvy - ay * halfvx) + (mx * halfwy - my * halfwx);
+
+	integral[0] += twoKi * halfex * dt;
+	integral[1] += twoKi * halfey * dt;
+	integral[2] += twoKi * halfez * dt;
+	gx = (gx + integral[0] + twoKp * halfex) * (0.5f * dt);
+	gy = (gy + integral[1] + twoKp * halfey) * (0.5f * dt);
+	gz = (gz + integral[2] + twoKp * halfez) * (0.5f * dt);
+
+	qa = q0;
+	qb = q1;
+	qc = q2;
+	q0 += (-qb * gx - qc * gy - q3 * gz);
+	q1 += (qa * gx + qc * gz - q3 * gy);
+	q2 += (qa * gy - qb * gz + q3 * gx);
+	q3 += (qa * gz + qb * gy - qc * gx);
+
+	recipNorm = invNorm(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+}
+
+void mpu9250FusionInit(MPU9250_fusion_t *fusion, MPU9250_FusionAlgorithm_t algorithm)
+{
+	memset(fusion, 0, sizeof(*fusion));
+	fusion->algorithm = algorithm;
+	fusion->q.w = 1.0f;
+	fusion->beta = MPU9250_FUSION_BETA;
+	fusion->twoKp = MPU9250_FUSION_TWO_KP;
+	fusion->twoKi = MPU9250_FUSION_TWO_KI;
+}
+
+// Run the filter over every sample of a converted block, using the kernel timestamps for the step.
+// quat (block->count entries, may be NULL) receives the orientation after each sample.
+// The loop does not allocate and has no data dependent branches.
+size_t mpu9250FusionUpdate(MPU9250_fusion_t *fusion, const MPU9250_block_t *block,
+                           const uint64_t *timestampNs, MPU9250_quat_t *quat)
+{
+	float q[4] = { fusion->q.w, fusion->q.x, fusion->q.y, fusion->q.z };
+	float integral[3] = { fusion->ix, fusion->iy, fusion->iz };
+	uint64_t last = fusion->lastNs;
+	size_t i, n = block->count;
+
+	if (n == 0) {
+		return 0;
+	}
+	// the first sample ever only sets the time reference
+	if (last == 0) {
+		last = timestampNs[0];
+	}
+
+	if (fusion->algorithm == MPU9250_FUSION_MAHONY) {
+		for (i = 0; i < n; i++) {
+			float dt = fminf((float)(int64_t)(timestampNs[i] - last) * 1e-9f, MPU9250_FUSION_MAX_DT);
+
+			dt = fmaxf(dt, 0.0f);
+			last = timestampNs[i];
+			mahonyStep(q, integral, fusion->twoKp, fusion->twoKi, block->gx[i], block->gy[i], block->gz[i],
+			           block->ax[i], block->ay[i], block->az[i], block->hx[i], block->hy[i], block->hz[i], dt);
+			if (quat != NULL) {
+				quat[i] = (MPU9250_quat_t){ q[0], q[1], q[2], q[3] };
+			}
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			float dt = fminf((float)(int64_t)(timestampNs[i] - last) * 1e-9f, MPU9250_FUSION_MAX_DT);
+
+			dt = fmaxf(dt, 0.0f);
+			last = timestampNs[i];
+			madgwickStep(q, fusion->beta, block->gx[i], block->gy[i], block->gz[i],
+			             block->ax[i], block->ay[i], block->az[i], block->hx[i], block->hy[i], block->hz[i], dt);
+			if (quat != NULL) {
+				quat[i] = (MPU9250_quat_t){ q[0], q[1], q[2], q[3] };
+			}
+		}
+	}
+
+	fusion->q = (MPU9250_quat_t){ q[0], q[1], q[2], q[3] };
+	fusion->ix = integral[0];
+	fusion->iy = integral[1];
+	fusion->iz = integral[2];
+	fusion->lastNs = last;
+	return n;
+}
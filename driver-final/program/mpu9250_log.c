@@ -0,0 +1,680 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mpu9250.h"
+
+// Size of the writer buffer, one write() per this many bytes (about 26000 samples)
+#define MPU9250_LOG_BUFFER_BYTES      (1 << 20)
+
+_Static_assert(sizeof(MPU9250_logHeader_t) == 256, "MPU9250_logHeader_t must stay 256 bytes");
+
+// MPU9250_LOG_DELTA layout: blocks, then the index and a trailer that points to it
+#define MPU9250_LOG_BLOCK_MAGIC       0x4B4C424D    // "MBLK"
+#define MPU9250_LOG_INDEX_MAGIC       0x5844494D    // "MIDX"
+// worst case of one encoded sample: 14 varints of up to 10 bytes
+#define MPU9250_LOG_SAMPLE_MAX_BYTES  140
+
+typedef struct {
+   uint32_t magic;
+   uint32_t count;              // samples in the block, the first one included
+   uint32_t bytes;              // encoded deltas after the first sample
+   uint32_t reserved;
+   struct mse_sample first;
+} MPU9250_logBlock_t;
+
+typedef struct {
+   uint32_t magic;
+   uint32_t reserved;
+   uint64_t blocks;
+   uint64_t indexOffset;
+} MPU9250_logTrailer_t;
+
+
+// write() everything, retrying short writes and interruptions
+static bool logWriteAll(int fd, const void *data, size_t bytes)
+{
+	const unsigned char *p = data;
+	ssize_t ret;
+
+	while (bytes > 0) {
+		ret = write(fd, p, bytes);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += ret;
+		bytes -= ret;
+	}
+	return true;
+}
+
+static inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline unsigned char *putVarint(unsigned char *p, uint64_t value)
+{
+	while (value >= 0x80) {
+		*p++ = (unsigned char)value | 0x80;
+		value >>= 7;
+	}
+	*p++ = (unsigned char)value;
+	return p;
+}
+
+// Returns NULL if the varint runs past end
+static inline const unsigned char *getVarint(const unsigned char *p, const unsigned char *end, uint64_t *value)
+{
+	uint64_t result = 0;
+	int shift = 0;
+
+	while (p < end && shift < 64) {
+		result |= (uint64_t)(*p & 0x7F) << shift;
+		if (!(*p++ & 0x80)) {
+			*value = result;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+// Deltas of one sample against the previous one: timestamp as the change of the period (constant
+// rate gives 0), seq and dropped as plain steps, every count channel and ST2 as differences
+static unsigned char *encodeSample(unsigned char *p, const struct mse_sample *prev,
+                                   const struct mse_sample *cur, int64_t *period)
+{
+	int64_t step = (int64_t)(cur->timestamp_ns - prev->timestamp_ns);
+	int k;
+
+	p = putVarint(p, zigzag(step - *period));
+	*period = step;
+	p = putVarint(p, zigzag((int32_t)(cur->seq - prev->seq)));
+	p = putVarint(p, zigzag((int32_t)(cur->dropped - prev->dropped)));
+	for (k = 0; k < 3; k++) {
+		p = putVarint(p, zigzag(cur->accel[k] - prev->accel[k]));
+	}
+	p = putVarint(p, zigzag(cur->temp - prev->temp));
+	for (k = 0; k < 3; k++) {
+		p = putVarint(p, zigzag(cur->gyro[k] - prev->gyro[k]));
+	}
+	for (k = 0; k < 3; k++) {
+		p = putVarint(p, zigzag(cur->mag[k] - prev->mag[k]));
+	}
+	p = putVarint(p, zigzag(cur->mag_st2 - prev->mag_st2));
+	return p;
+}
+
+static const unsigned char *decodeSample(const unsigned char *p, const unsigned char *end,
+                                         const struct mse_sample *prev, struct mse_sample *cur, int64_t *period)
+{
+	uint64_t v[14];
+	int k;
+
+	for (k = 0; k < 14 && p != NULL; k++) {
+		p = getVarint(p, end, &v[k]);
+	}
+	if (p == NULL) {
+		return NULL;
+	}
+	*period += unzigzag(v[0]);
+	memset(cur, 0, sizeof(*cur));
+	cur->timestamp_ns = prev->timestamp_ns + *period;
+	cur->seq = prev->seq + (uint32_t)unzigzag(v[1]);
+	cur->dropped = prev->dropped + (uint32_t)unzigzag(v[2]);
+	for (k = 0; k < 3; k++) {
+		cur->accel[k] = (int16_t)(prev->accel[k] + unzigzag(v[3 + k]));
+	}
+	cur->temp = (int16_t)(prev->temp + unzigzag(v[6]));
+	for (k = 0; k < 3; k++) {
+		cur->gyro[k] = (int16_t)(prev->gyro[k] + unzigzag(v[7 + k]));
+		cur->mag[k] = (int16_t)(prev->mag[k] + unzigzag(v[10 + k]));
+	}
+	cur->mag_st2 = (uint8_t)(prev->mag_st2 + unzigzag(v[13]));
+	return p;
+}
+
+static bool logFlush(MPU9250_logWriter_t *writer)
+{
+	bool ok = logWriteAll(writer->fd, writer->buffer, writer->used);
+
+	writer->used = 0;
+	return ok;
+}
+
+// Copy bytes to the writer buffer, flushing it every time it fills up
+static bool logAppend(MPU9250_logWriter_t *writer, const void *data, size_t bytes)
+{
+	const unsigned char *p = data;
+
+	writer->offset += bytes;
+	while (bytes > 0) {
+		size_t chunk = writer->size - writer->used;
+
+		// big appends skip the copy once the buffer is empty
+		if (writer->used == 0 && bytes >= writer->size) {
+			return logWriteAll(writer->fd, p, bytes);
+		}
+		if (chunk > bytes) {
+			chunk = bytes;
+		}
+		memcpy(writer->buffer + writer->used, p, chunk);
+		writer->used += chunk;
+		p += chunk;
+		bytes -= chunk;
+		if (writer->used == writer->size && !logFlush(writer)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Encode the pending samples as one block straight into the writer buffer and index it
+static bool logWriteBlock(MPU9250_logWriter_t *writer)
+{
+	MPU9250_logBlock_t block;
+	unsigned char *start, *p;
+	int64_t period = 0;
+	size_t i, bytes;
+
+	if (writer->pendingCount == 0) {
+		return true;
+	}
+	if (writer->blocks == writer->indexCapacity) {
+		size_t capacity = writer->indexCapacity ? writer->indexCapacity * 2 : 1024;
+		MPU9250_logIndex_t *index = realloc(writer->index, capacity * sizeof(*index));
+
+		if (index == NULL) {
+			return false;
+		}
+		writer->index = index;
+		writer->indexCapacity = capacity;
+	}
+	writer->index[writer->blocks].offset = writer->offset;
+	writer->index[writer->blocks].firstSample = writer->records - writer->pendingCount;
+	writer->index[writer->blocks].firstTimestampNs = writer->pending[0].timestamp_ns;
+	writer->blocks++;
+
+	// the deltas are encoded after the block header, which is filled in once their size is known
+	bytes = sizeof(block) + (writer->pendingCount - 1) * MPU9250_LOG_SAMPLE_MAX_BYTES;
+	if (writer->size - writer->used < bytes && !logFlush(writer)) {
+		return false;
+	}
+	start = writer->buffer + writer->used + sizeof(block);
+	p = start;
+	for (i = 1; i < writer->pendingCount; i++) {
+		p = encodeSample(p, &writer->pending[i - 1], &writer->pending[i], &period);
+	}
+
+	memset(&block, 0, sizeof(block));
+	block.magic = MPU9250_LOG_BLOCK_MAGIC;
+	block.count = writer->pendingCount;
+	block.bytes = p - start;
+	block.first = writer->pending[0];
+	memcpy(writer->buffer + writer->used, &block, sizeof(block));
+	writer->used += sizeof(block) + block.bytes;
+	writer->offset += sizeof(block) + block.bytes;
+	writer->pendingCount = 0;
+	return true;
+}
+
+// Create the capture file and write the header with the conversion state of handler
+bool mpu9250LogCreate(MPU9250_logWriter_t *writer, const char *path, const MPU9250_control_t *handler,
+                      uint32_t encoding)
+{
+	MPU9250_logHeader_t header;
+	struct timespec now;
+	int j;
+
+	memset(writer, 0, sizeof(*writer));
+	memset(&header, 0, sizeof(header));
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	header.magic = MPU9250_LOG_MAGIC;
+	header.version = MPU9250_LOG_VERSION;
+	header.headerSize = sizeof(header);
+	header.recordSize = sizeof(struct mse_sample);
+	header.encoding = encoding;
+	header.startRealtimeNs = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+	memcpy(header.device, handler->_device, sizeof(header.device));
+	header.accelScale = handler->_accelScale;
+	header.gyroScale = handler->_gyroScale;
+	header.magScale[0] = handler->_magScaleX;
+	header.magScale[1] = handler->_magScaleY;
+	header.magScale[2] = handler->_magScaleZ;
+	header.tempScale = handler->_tempScale;
+	header.tempOffset = handler->_tempOffset;
+	header.accelBias[0] = handler->_axb;
+	header.accelBias[1] = handler->_ayb;
+	header.accelBias[2] = handler->_azb;
+	header.accelFactor[0] = handler->_axs;
+	header.accelFactor[1] = handler->_ays;
+	header.accelFactor[2] = handler->_azs;
+	header.gyroBias[0] = handler->_gxb;
+	header.gyroBias[1] = handler->_gyb;
+	header.gyroBias[2] = handler->_gzb;
+	header.magBias[0] = handler->_hxb;
+	header.magBias[1] = handler->_hyb;
+	header.magBias[2] = handler->_hzb;
+	header.magFactor[0] = handler->_hxs;
+	header.magFactor[1] = handler->_hys;
+	header.magFactor[2] = handler->_hzs;
+	for (j = 0; j < 3; j++) {
+		header.transform[j] = handler->tX[j];
+		header.transform[3 + j] = handler->tY[j];
+		header.transform[6 + j] = handler->tZ[j];
+	}
+	header.accelRange = handler->_accelRange;
+	header.gyroRange = handler->_gyroRange;
+	header.bandwidth = handler->_bandwidth;
+	header.srd = handler->_srd;
+
+	writer->encoding = encoding;
+	writer->buffer = malloc(MPU9250_LOG_BUFFER_BYTES);
+	if (encoding == MPU9250_LOG_DELTA) {
+		writer->pending = malloc(MPU9250_LOG_BLOCK_SAMPLES * sizeof(struct mse_sample));
+	}
+	if (writer->buffer == NULL || (encoding == MPU9250_LOG_DELTA && writer->pending == NULL) ||
+	    encoding > MPU9250_LOG_DELTA) {
+		free(writer->buffer);
+		free(writer->pending);
+		writer->buffer = NULL;
+		writer->pending = NULL;
+		return false;
+	}
+	writer->size = MPU9250_LOG_BUFFER_BYTES;
+	writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (writer->fd < 0 || !logWriteAll(writer->fd, &header, sizeof(header))) {
+		printf("Error creating the capture %s\n", path);
+		if (writer->fd >= 0) {
+			close(writer->fd);
+		}
+		free(writer->buffer);
+		free(writer->pending);
+		writer->buffer = NULL;
+		writer->pending = NULL;
+		return false;
+	}
+	writer->offset = sizeof(header);
+	return true;
+}
+
+// Append records, they reach the file in MPU9250_LOG_BUFFER_BYTES writes
+bool mpu9250LogWrite(MPU9250_logWriter_t *writer, const struct mse_sample *samples, size_t count)
+{
+	size_t chunk;
+
+	if (writer->encoding == MPU9250_LOG_RAW) {
+		writer->records += count;
+		return logAppend(writer, samples, count * sizeof(*samples));
+	}
+
+	while (count > 0) {
+		chunk = MPU9250_LOG_BLOCK_SAMPLES - writer->pendingCount;
+		if (chunk > count) {
+			chunk = count;
+		}
+		memcpy(&writer->pending[writer->pendingCount], samples, chunk * sizeof(*samples));
+		writer->pendingCount += chunk;
+		writer->records += chunk;
+		samples += chunk;
+		count -= chunk;
+		if (writer->pendingCount == MPU9250_LOG_BLOCK_SAMPLES && !logWriteBlock(writer)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool mpu9250LogClose(MPU9250_logWriter_t *writer)
+{
+	MPU9250_logTrailer_t trailer;
+	bool ok = true;
+
+	// last (partial) block, the index and the trailer that points to it
+	if (writer->encoding == MPU9250_LOG_DELTA) {
+		memset(&trailer, 0, sizeof(trailer));
+		trailer.magic = MPU9250_LOG_INDEX_MAGIC;
+		ok = logWriteBlock(writer);
+		trailer.blocks = writer->blocks;
+		trailer.indexOffset = writer->offset;
+		ok = ok && logAppend(writer, writer->index, writer->blocks * sizeof(*writer->index));
+		ok = ok && logAppend(writer, &trailer, sizeof(trailer));
+	}
+	ok = logFlush(writer) && ok;
+	ok = (close(writer->fd) == 0) && ok;
+	free(writer->buffer);
+	free(writer->pending);
+	free(writer->index);
+	memset(writer, 0, sizeof(*writer));
+	writer->fd = -1;
+	return ok;
+}
+
+// Header of the block at offset, copied out of the map since blocks are variable length and
+// end at any byte. False unless a whole valid block lies between offset and end.
+static bool logBlockAt(const MPU9250_logReader_t *reader, uint64_t offset, uint64_t end, MPU9250_logBlock_t *block)
+{
+	if (offset < reader->header->headerSize || offset > end || end - offset < sizeof(*block)) {
+		return false;
+	}
+	memcpy(block, (const unsigned char *)reader->map + offset, sizeof(*block));
+	return block->magic == MPU9250_LOG_BLOCK_MAGIC && block->count > 0 &&
+	       block->count <= MPU9250_LOG_BLOCK_SAMPLES && block->bytes <= end - offset - sizeof(*block);
+}
+
+// Copy the index the trailer points to, checking every entry against its block as the walk
+// in logLoadIndex does. False (and nothing kept) if any of them is wrong.
+static bool logCopyIndex(MPU9250_logReader_t *reader, const MPU9250_logTrailer_t *trailer)
+{
+	MPU9250_logBlock_t block;
+	uint64_t samples = 0, next = reader->header->headerSize;
+	size_t n;
+
+	reader->ownIndex = malloc((trailer->blocks ? trailer->blocks : 1) * sizeof(MPU9250_logIndex_t));
+	if (reader->ownIndex == NULL) {
+		return false;
+	}
+	memcpy(reader->ownIndex, (const unsigned char *)reader->map + trailer->indexOffset,
+	       trailer->blocks * sizeof(MPU9250_logIndex_t));
+	for (n = 0; n < trailer->blocks; n++) {
+		const MPU9250_logIndex_t *entry = &reader->ownIndex[n];
+
+		if (entry->offset < next || entry->firstSample != samples ||
+		    !logBlockAt(reader, entry->offset, trailer->indexOffset, &block) ||
+		    entry->firstTimestampNs != block.first.timestamp_ns) {
+			free(reader->ownIndex);
+			reader->ownIndex = NULL;
+			return false;
+		}
+		samples += block.count;
+		next = entry->offset + sizeof(block) + block.bytes;
+	}
+	reader->index = reader->ownIndex;
+	reader->blocks = trailer->blocks;
+	reader->count = samples;
+	return true;
+}
+
+// Find the blocks of a compressed capture: from the index at the end, or walking the block
+// headers when the capture was cut short before mpu9250LogClose or its index does not match
+static bool logLoadIndex(MPU9250_logReader_t *reader)
+{
+	MPU9250_logTrailer_t trailer;
+	MPU9250_logBlock_t block;
+	size_t offset, capacity = 0;
+	uint64_t samples = 0;
+
+	if (reader->mapBytes >= reader->header->headerSize + sizeof(trailer)) {
+		memcpy(&trailer, (const unsigned char *)reader->map + reader->mapBytes - sizeof(trailer), sizeof(trailer));
+		if (trailer.magic == MPU9250_LOG_INDEX_MAGIC && trailer.indexOffset >= reader->header->headerSize &&
+		    trailer.indexOffset <= reader->mapBytes - sizeof(trailer) &&
+		    trailer.blocks == (reader->mapBytes - sizeof(trailer) - trailer.indexOffset) / sizeof(MPU9250_logIndex_t) &&
+		    logCopyIndex(reader, &trailer)) {
+			return true;
+		}
+	}
+
+	offset = reader->header->headerSize;
+	while (logBlockAt(reader, offset, reader->mapBytes, &block)) {
+		if (reader->blocks == capacity) {
+			MPU9250_logIndex_t *index;
+
+			capacity = capacity ? capacity * 2 : 1024;
+			index = realloc(reader->ownIndex, capacity * sizeof(*index));
+			if (index == NULL) {
+				return false;
+			}
+			reader->ownIndex = index;
+		}
+		reader->ownIndex[reader->blocks].offset = offset;
+		reader->ownIndex[reader->blocks].firstSample = samples;
+		reader->ownIndex[reader->blocks].firstTimestampNs = block.first.timestamp_ns;
+		reader->blocks++;
+		samples += block.count;
+		offset += sizeof(block) + block.bytes;
+	}
+	reader->index = reader->ownIndex;
+	reader->count = samples;
+	return true;
+}
+
+// Map a capture read only. Raw records are used in place without parsing; compressed captures are
+// read through mpu9250LogRead, which decodes one block at a time.
+bool mpu9250LogMap(MPU9250_logReader_t *reader, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	memset(reader, 0, sizeof(*reader));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Error opening the capture %s\n", path);
+		return false;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(MPU9250_logHeader_t)) {
+		close(fd);
+		return false;
+	}
+	reader->mapBytes = st.st_size;
+	reader->map = mmap(NULL, reader->mapBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (reader->map == MAP_FAILED) {
+		reader->map = NULL;
+		return false;
+	}
+
+	reader->header = reader->map;
+	if (reader->header->magic != MPU9250_LOG_MAGIC || reader->header->version != MPU9250_LOG_VERSION ||
+	    reader->header->headerSize < sizeof(MPU9250_logHeader_t) ||
+	    reader->header->headerSize > reader->mapBytes || reader->header->encoding > MPU9250_LOG_DELTA ||
+	    reader->header->recordSize != sizeof(struct mse_sample)) {
+		printf("%s is not a capture this program can read\n", path);
+		mpu9250LogUnmap(reader);
+		return false;
+	}
+	madvise(reader->map, reader->mapBytes, MADV_SEQUENTIAL);
+
+	if (reader->header->encoding == MPU9250_LOG_RAW) {
+		reader->samples = (const struct mse_sample *)((const char *)reader->map + reader->header->headerSize);
+		// a capture cut short keeps every whole record
+		reader->count = (reader->mapBytes - reader->header->headerSize) / sizeof(struct mse_sample);
+		return true;
+	}
+
+	reader->decoded = malloc(MPU9250_LOG_BLOCK_SAMPLES * sizeof(struct mse_sample));
+	reader->decodedBlock = (size_t)-1;
+	if (reader->decoded == NULL || !logLoadIndex(reader)) {
+		mpu9250LogUnmap(reader);
+		return false;
+	}
+	return true;
+}
+
+void mpu9250LogUnmap(MPU9250_logReader_t *reader)
+{
+	if (reader->map != NULL) {
+		munmap(reader->map, reader->mapBytes);
+	}
+	free(reader->ownIndex);
+	free(reader->decoded);
+	memset(reader, 0, sizeof(*reader));
+}
+
+// Decode block number n into reader->decoded (kept until another block is needed)
+static bool logDecodeBlock(MPU9250_logReader_t *reader, size_t n)
+{
+	MPU9250_logBlock_t block;
+	const unsigned char *p, *end;
+	int64_t period = 0;
+	size_t i;
+
+	if (reader->decodedBlock == n) {
+		return true;
+	}
+	// checked by logLoadIndex, copied since it is not aligned in the map
+	p = (const unsigned char *)reader->map + reader->index[n].offset;
+	memcpy(&block, p, sizeof(block));
+	p += sizeof(block);
+	end = p + block.bytes;
+
+	reader->decoded[0] = block.first;
+	for (i = 1; i < block.count && p != NULL; i++) {
+		p = decodeSample(p, end, &reader->decoded[i - 1], &reader->decoded[i], &period);
+	}
+	// a damaged block keeps the samples decoded before the damage
+	reader->decodedCount = (p != NULL) ? block.count : i - 1;
+	reader->decodedBlock = n;
+	return true;
+}
+
+// Block that holds sample number position (binary search in the index)
+static size_t logBlockOf(const MPU9250_logReader_t *reader, size_t position)
+{
+	size_t low = 0, high = reader->blocks;
+
+	while (high - low > 1) {
+		size_t mid = (low + high) / 2;
+
+		if (reader->index[mid].firstSample <= position) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+// Copy up to count samples starting at sample number position, whatever the encoding.
+// Returns how many were copied (0 at the end of the capture).
+size_t mpu9250LogRead(MPU9250_logReader_t *reader, size_t position, struct mse_sample *samples, size_t count)
+{
+	size_t copied = 0, block, first, chunk;
+
+	if (position >= reader->count) {
+		return 0;
+	}
+	if (count > reader->count - position) {
+		count = reader->count - position;
+	}
+	if (reader->samples != NULL) {
+		memcpy(samples, &reader->samples[position], count * sizeof(*samples));
+		return count;
+	}
+
+	block = logBlockOf(reader, position);
+	while (copied < count && block < reader->blocks) {
+		logDecodeBlock(reader, block);
+		first = position + copied - reader->index[block].firstSample;
+		if (first >= reader->decodedCount) {
+			break;
+		}
+		chunk = reader->decodedCount - first;
+		if (chunk > count - copied) {
+			chunk = count - copied;
+		}
+		memcpy(&samples[copied], &reader->decoded[first], chunk * sizeof(*samples));
+		copied += chunk;
+		block++;
+	}
+	return copied;
+}
+
+// Position of the first sample taken at or after timestampNs (reader->count if there is none)
+size_t mpu9250LogFind(MPU9250_logReader_t *reader, uint64_t timestampNs)
+{
+	size_t low = 0, high = reader->count, block, i;
+
+	if (reader->samples != NULL) {
+		while (low < high) {
+			size_t mid = (low + high) / 2;
+
+			if (reader->samples[mid].timestamp_ns < timestampNs) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		return low;
+	}
+
+	// last block that starts before timestampNs, then a scan inside it
+	low = 0;
+	high = reader->blocks;
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+
+		if (reader->index[mid].firstTimestampNs < timestampNs) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low == 0) {
+		return 0;
+	}
+	block = low - 1;
+	logDecodeBlock(reader, block);
+	for (i = 0; i < reader->decodedCount; i++) {
+		if (reader->decoded[i].timestamp_ns >= timestampNs) {
+			return reader->index[block].firstSample + i;
+		}
+	}
+	return (block + 1 < reader->blocks) ? reader->index[block + 1].firstSample : reader->count;
+}
+
+// Restore in handler the conversion state stored in a capture, to process it offline
+void mpu9250LogApplyHeader(const MPU9250_logHeader_t *header, MPU9250_control_t *handler)
+{
+	int j;
+
+	memcpy(handler->_device, header->device, sizeof(handler->_device));
+	handler->_device[sizeof(handler->_device) - 1] = '\0';
+	handler->_accelScale = header->accelScale;
+	handler->_gyroScale = header->gyroScale;
+	handler->_magScaleX = header->magScale[0];
+	handler->_magScaleY = header->magScale[1];
+	handler->_magScaleZ = header->magScale[2];
+	handler->_tempScale = header->tempScale;
+	handler->_tempOffset = header->tempOffset;
+	handler->_axb = header->accelBias[0];
+	handler->_ayb = header->accelBias[1];
+	handler->_azb = header->accelBias[2];
+	handler->_axs = header->accelFactor[0];
+	handler->_ays = header->accelFactor[1];
+	handler->_azs = header->accelFactor[2];
+	handler->_gxb = header->gyroBias[0];
+	handler->_gyb = header->gyroBias[1];
+	handler->_gzb = header->gyroBias[2];
+	handler->_hxb = header->magBias[0];
+	handler->_hyb = header->magBias[1];
+	handler->_hzb = header->magBias[2];
+	handler->_hxs = header->magFactor[0];
+	handler->_hys = header->magFactor[1];
+	handler->_hzs = header->magFactor[2];
+	for (j = 0; j < 3; j++) {
+		handler->tX[j] = header->transform[j];
+		handler->tY[j] = header->transform[3 + j];
+		handler->tZ[j] = header->transform[6 + j];
+	}
+	handler->_accelRange = header->accelRange;
+	handler->_gyroRange = header->gyroRange;
+	handler->_bandwidth = header->bandwidth;
+	handler->_srd = header->srd;
+	mpu9250UpdateConversion(handler);
+}
@@ -0,0 +1,276 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mpu9250.h"
+
+// Everything after the header is read word by word with atomic loads
+#define MPU9250_METRICS_FIRST_WORD    offsetof(MPU9250_metrics_t, updatedNs)
+
+_Static_assert(MPU9250_METRICS_FIRST_WORD % sizeof(uint64_t) == 0, "MPU9250_metrics_t counters must be aligned");
+_Static_assert(sizeof(MPU9250_metrics_t) % sizeof(uint64_t) == 0, "MPU9250_metrics_t must be made of uint64_t");
+
+
+// The acquisition thread is the only writer, a plain store keeps the bus free of locked operations
+static inline void metricsAdd(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline void metricsSet(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline unsigned int metricsBucket(uint64_t ns)
+{
+	unsigned int msb, bucket;
+
+	if (ns < (1u << MPU9250_METRICS_SUB_BITS)) {
+		return ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	bucket = ((msb - MPU9250_METRICS_SUB_BITS + 1) << MPU9250_METRICS_SUB_BITS) +
+	         ((ns >> (msb - MPU9250_METRICS_SUB_BITS)) & ((1u << MPU9250_METRICS_SUB_BITS) - 1));
+	return (bucket < MPU9250_METRICS_BUCKETS) ? bucket : MPU9250_METRICS_BUCKETS - 1;
+}
+
+// Largest value that falls in the bucket
+uint64_t mpu9250MetricsBucketUpper(unsigned int bucket)
+{
+	unsigned int shift;
+	uint64_t mantissa;
+
+	if (bucket < (1u << MPU9250_METRICS_SUB_BITS)) {
+		return bucket;
+	}
+	shift = (bucket >> MPU9250_METRICS_SUB_BITS) - 1;
+	mantissa = (bucket & ((1u << MPU9250_METRICS_SUB_BITS) - 1)) | (1u << MPU9250_METRICS_SUB_BITS);
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void mpu9250MetricsHistogramAdd(MPU9250_histogram_t *histogram, uint64_t ns)
+{
+	metricsAdd(&histogram->count, 1);
+	metricsAdd(&histogram->sumNs, ns);
+	metricsAdd(&histogram->buckets[metricsBucket(ns)], 1);
+	if (ns > histogram->maxNs) {
+		metricsSet(&histogram->maxNs, ns);
+	}
+}
+
+uint64_t mpu9250MetricsNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void mpu9250MetricsInit(MPU9250_metrics_t *metrics, const char *device)
+{
+	memset(metrics, 0, sizeof(*metrics));
+	metrics->magic = MPU9250_METRICS_MAGIC;
+	metrics->version = MPU9250_METRICS_VERSION;
+	metrics->size = sizeof(*metrics);
+	metrics->pid = getpid();
+	snprintf(metrics->device, sizeof(metrics->device), "%s", device);
+}
+
+// Create (or take over) /dev/shm/<name> and initialize the metrics in it, name is like "/mse00"
+MPU9250_metrics_t *mpu9250MetricsCreateShared(const char *name, const char *device)
+{
+	MPU9250_metrics_t *metrics;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror("shm_open");
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(*metrics)) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return NULL;
+	}
+	metrics = mmap(NULL, sizeof(*metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (metrics == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	mpu9250MetricsInit(metrics, device);
+	return metrics;
+}
+
+// Map the metrics another process exports, read only
+MPU9250_metrics_t *mpu9250MetricsOpenShared(const char *name)
+{
+	MPU9250_metrics_t *metrics;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror("shm_open");
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*metrics)) {
+		printf("%s: no metrics there\n", name);
+		close(fd);
+		return NULL;
+	}
+	metrics = mmap(NULL, sizeof(*metrics), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (metrics == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	if (metrics->magic != MPU9250_METRICS_MAGIC || metrics->version != MPU9250_METRICS_VERSION ||
+	    metrics->size != sizeof(*metrics)) {
+		printf("%s: metrics version mismatch\n", name);
+		munmap(metrics, sizeof(*metrics));
+		return NULL;
+	}
+	return metrics;
+}
+
+void mpu9250MetricsUnmap(MPU9250_metrics_t *metrics)
+{
+	if (metrics != NULL) {
+		munmap(metrics, sizeof(*metrics));
+	}
+}
+
+// The exporting process is done: unmap and take the name out of /dev/shm
+void mpu9250MetricsRemoveShared(MPU9250_metrics_t *metrics, const char *name)
+{
+	mpu9250MetricsUnmap(metrics);
+	shm_unlink(name);
+}
+
+// Keep the metrics of this IMU from now on (NULL stops), goes after mpu9250Open
+void mpu9250SetMetrics(MPU9250_control_t *handler, MPU9250_metrics_t *metrics)
+{
+	handler->_metrics = metrics;
+}
+
+// Copy of every counter, each one read atomically; the histograms may be a few samples
+// apart from each other since the writer does not stop
+void mpu9250MetricsRead(const MPU9250_metrics_t *metrics, MPU9250_metrics_t *copy)
+{
+	const uint64_t *from = (const uint64_t *)((const char *)metrics + MPU9250_METRICS_FIRST_WORD);
+	uint64_t *to = (uint64_t *)((char *)copy + MPU9250_METRICS_FIRST_WORD);
+	size_t i, words = (sizeof(*metrics) - MPU9250_METRICS_FIRST_WORD) / sizeof(uint64_t);
+
+	memcpy(copy, metrics, MPU9250_METRICS_FIRST_WORD);
+	for (i = 0; i < words; i++) {
+		to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+	}
+}
+
+// Upper end of the bucket where fraction of the histogram is reached, capped at the maximum seen
+uint64_t mpu9250MetricsPercentile(const MPU9250_histogram_t *histogram, double fraction)
+{
+	uint64_t target = (uint64_t)(fraction * histogram->count + 0.999999), seen = 0, upper;
+	unsigned int i;
+
+	for (i = 0; i < MPU9250_METRICS_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= target && seen > 0) {
+			upper = mpu9250MetricsBucketUpper(i);
+			return (upper < histogram->maxNs) ? upper : histogram->maxNs;
+		}
+	}
+	return histogram->maxNs;
+}
+
+// Hooks of the library, called only while metrics are set
+
+void mpu9250MetricsRegisterRead(MPU9250_control_t *handler, uint64_t startNs, bool ok)
+{
+	MPU9250_metrics_t *metrics = handler->_metrics;
+	uint64_t now = mpu9250MetricsNow();
+
+	metricsAdd(&metrics->registerReads, 1);
+	if (!ok) {
+		metricsAdd(&metrics->registerFailures, 1);
+	}
+	mpu9250MetricsHistogramAdd(&metrics->registerReadNs, now - startNs);
+	metricsSet(&metrics->updatedNs, now);
+}
+
+// One read call of the sample path, count is what it returned (negative on failure)
+void mpu9250MetricsSampleRead(MPU9250_control_t *handler, uint64_t startNs, int count)
+{
+	MPU9250_metrics_t *metrics = handler->_metrics;
+	uint64_t now = mpu9250MetricsNow();
+
+	metricsAdd(&metrics->sampleReads, 1);
+	if (count < 0) {
+		metricsAdd(&metrics->sampleFailures, 1);
+	}
+	mpu9250MetricsHistogramAdd(&metrics->sampleReadNs, now - startNs);
+	metricsSet(&metrics->updatedNs, now);
+}
+
+// Sample intervals, jitter and seq gaps; the same sample read twice (latest mode) counts once.
+// The period is the one of the latest value mode while it runs, else the sensor rate. When seq or
+// the time go back the sequence started over: it is counted apart, without an interval.
+void mpu9250MetricsSamples(MPU9250_control_t *handler, const struct mse_sample *samples, int count)
+{
+	MPU9250_metrics_t *metrics = handler->_metrics;
+	uint64_t period = handler->_latestPeriodNs ? handler->_latestPeriodNs : (uint64_t)(handler->_srd + 1) * 1000000;
+	uint64_t interval, expected;
+	bool first = (metrics->samples == 0);
+	int32_t gap;
+	int i;
+
+	if (metrics->periodNs != period) {
+		metricsSet(&metrics->periodNs, period);
+	}
+	for (i = 0; i < count; i++) {
+		const struct mse_sample *sample = &samples[i];
+
+		// latest value mode before the first acquisition
+		if (sample->timestamp_ns == 0) {
+			continue;
+		}
+		if (!first) {
+			if (sample->seq == (uint32_t)metrics->lastSeq && sample->timestamp_ns == metrics->lastTimestampNs) {
+				continue;
+			}
+			gap = (int32_t)(sample->seq - (uint32_t)metrics->lastSeq);
+			if (gap <= 0 || sample->timestamp_ns <= metrics->lastTimestampNs) {
+				metricsAdd(&metrics->seqResets, 1);
+			} else {
+				interval = sample->timestamp_ns - metrics->lastTimestampNs;
+				expected = period * gap;
+				mpu9250MetricsHistogramAdd(&metrics->intervalNs, interval);
+				mpu9250MetricsHistogramAdd(&metrics->jitterNs, (interval > expected) ? interval - expected : expected - interval);
+				metricsAdd(&metrics->lost, gap - 1);
+			}
+		}
+		first = false;
+		metricsAdd(&metrics->samples, 1);
+		metricsSet(&metrics->lastSeq, sample->seq);
+		metricsSet(&metrics->lastTimestampNs, sample->timestamp_ns);
+	}
+}
+
+void mpu9250MetricsWait(MPU9250_control_t *handler, int result)
+{
+	MPU9250_metrics_t *metrics = handler->_metrics;
+
+	metricsAdd(&metrics->waits, 1);
+	if (result == 0) {
+		metricsAdd(&metrics->waitTimeouts, 1);
+	} else if (result < 0) {
+		metricsAdd(&metrics->waitFailures, 1);
+	}
+	metricsSet(&metrics->updatedNs, mpu9250MetricsNow());
+}
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "mpu9250.h"
+
+// Producer counters are single writer, other threads read them with __atomic_load_n
+static inline void queueCount(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+// blocks is rounded up to a power of 2
+bool mpu9250QueueAlloc(MPU9250_queue_t *queue, uint32_t blocks)
+{
+	uint32_t size = 1;
+
+	while (size < blocks) {
+		size <<= 1;
+	}
+	memset(queue, 0, sizeof(*queue));
+	if (posix_memalign((void **)&queue->blocks, 64, (size_t)size * sizeof(MPU9250_sampleBlock_t)) != 0) {
+		queue->blocks = NULL;
+		return false;
+	}
+	queue->size = size;
+	return true;
+}
+
+void mpu9250QueueFree(MPU9250_queue_t *queue)
+{
+	free(queue->blocks);
+	queue->blocks = NULL;
+	queue->size = 0;
+}
+
+// Producer: slot to fill in place, NULL when the consumer is a whole queue behind
+MPU9250_sampleBlock_t *mpu9250QueueReserve(MPU9250_queue_t *queue)
+{
+	uint32_t head = queue->head;
+	uint32_t used = head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+	if (used >= queue->size) {
+		return NULL;
+	}
+	if (used + 1 > queue->highWater) {
+		__atomic_store_n(&queue->highWater, used + 1, __ATOMIC_RELAXED);
+	}
+	return &queue->blocks[head & (queue->size - 1)];
+}
+
+// Producer: hand the reserved block to the consumer, with its count already set
+void mpu9250QueuePublish(MPU9250_queue_t *queue)
+{
+	MPU9250_sampleBlock_t *block = &queue->blocks[queue->head & (queue->size - 1)];
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	block->readNs = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+	block->droppedBefore = queue->pendingDrops;
+	queue->pendingDrops = 0;
+	queueCount(&queue->published, 1);
+	// ordered against the sleeping flag, a consumer that saw the old head is already in the futex
+	__atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&queue->sleeping, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &queue->head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+// Producer: samples read while the queue was full, lost for the consumer
+void mpu9250QueueDrop(MPU9250_queue_t *queue, unsigned int samples)
+{
+	queue->pendingDrops += samples;
+	queueCount(&queue->drops, 1);
+	queueCount(&queue->droppedSamples, samples);
+}
+
+// Consumer: oldest published block, NULL when there is none
+MPU9250_sampleBlock_t *mpu9250QueuePeek(MPU9250_queue_t *queue)
+{
+	uint32_t tail = queue->tail;
+
+	if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail) {
+		return NULL;
+	}
+	return &queue->blocks[tail & (queue->size - 1)];
+}
+
+// Consumer: like mpu9250QueuePeek, but sleep up to timeoutMs for the producer when there is no block.
+// The producer only makes the wake up syscall while the consumer is asleep
+MPU9250_sampleBlock_t *mpu9250QueueWait(MPU9250_queue_t *queue, int timeoutMs)
+{
+	struct timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+	MPU9250_sampleBlock_t *block = mpu9250QueuePeek(queue);
+	uint32_t tail = queue->tail;
+
+	if (block != NULL || timeoutMs <= 0) {
+		return block;
+	}
+	__atomic_store_n(&queue->sleeping, 1, __ATOMIC_SEQ_CST);
+	// a block published after this load changes head and the futex returns at once
+	if (__atomic_load_n(&queue->head, __ATOMIC_SEQ_CST) == tail) {
+		syscall(SYS_futex, &queue->head, FUTEX_WAIT_PRIVATE, tail, &timeout, NULL, 0);
+	}
+	__atomic_store_n(&queue->sleeping, 0, __ATOMIC_RELAXED);
+	return mpu9250QueuePeek(queue);
+}
+
+// Consumer: give the block from mpu9250QueuePeek back to the producer
+void mpu9250QueueRelease(MPU9250_queue_t *queue)
+{
+	__atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+}
+
+// Blocks waiting, from either side
+uint32_t mpu9250QueueUsed(const MPU9250_queue_t *queue)
+{
+	return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,139 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpu9250.h"
+
+// A capture played back in place of /dev/mseXX
+struct mpu9250_replay {
+   MPU9250_logReader_t reader;
+   size_t position;             // next sample handed out
+   bool realtime;               // keep the recorded spacing between samples
+   bool started;                // clock started by the first read
+   uint64_t firstNs;            // timestamp of the first sample of the capture
+   struct timespec start;
+};
+
+static uint64_t replayElapsedNs(const struct mpu9250_replay *replay)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - replay->start.tv_sec) * 1000000000ull + now.tv_nsec - replay->start.tv_nsec;
+}
+
+// Timestamp up to which samples are due, every sample when not in realtime
+static uint64_t replayDueNs(struct mpu9250_replay *replay)
+{
+	if (!replay->realtime) {
+		return UINT64_MAX;
+	}
+	if (!replay->started) {
+		clock_gettime(CLOCK_MONOTONIC, &replay->start);
+		replay->started = true;
+	}
+	return replay->firstNs + replayElapsedNs(replay);
+}
+
+// Open a capture instead of a device; mpu9250Init then takes the scales and calibration it was recorded with
+bool mpu9250OpenReplay(MPU9250_control_t *handler, const char *path, bool realtime)
+{
+	struct mpu9250_replay *replay;
+	struct mse_sample first;
+
+	memset(handler, 0, sizeof(*handler));
+	handler->_fd = -1;
+	replay = calloc(1, sizeof(*replay));
+	if (replay == NULL) {
+		return false;
+	}
+	if (!mpu9250LogMap(&replay->reader, path)) {
+		free(replay);
+		return false;
+	}
+	if (mpu9250LogRead(&replay->reader, 0, &first, 1) == 1) {
+		replay->firstNs = first.timestamp_ns;
+	}
+	replay->realtime = realtime;
+	handler->_replay = replay;
+	mpu9250LogApplyHeader(replay->reader.header, handler);
+	return true;
+}
+
+bool mpu9250ReplayEnd(const MPU9250_control_t *handler)
+{
+	const struct mpu9250_replay *replay = handler->_replay;
+
+	return replay == NULL || replay->position >= replay->reader.count;
+}
+
+// mpu9250Init of a replay: nothing to configure, the conversion is the one of the capture
+void mpu9250ReplayInit(MPU9250_control_t *handler)
+{
+	mpu9250LogApplyHeader(handler->_replay->reader.header, handler);
+}
+
+// Samples of the replay that are due, or only the newest one of them when latest is set
+int mpu9250ReplaySamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples, bool latest)
+{
+	struct mpu9250_replay *replay = handler->_replay;
+	uint64_t dueNs = replayDueNs(replay);
+	size_t count, due;
+
+	if (replay->position >= replay->reader.count || maxSamples <= 0) {
+		return 0;
+	}
+
+	if (latest) {
+		// skip what was acquired meanwhile, like the driver does in the latest mode
+		if (replay->realtime) {
+			due = mpu9250LogFind(&replay->reader, dueNs + 1);
+			if (due <= replay->position) {
+				return 0;
+			}
+			replay->position = due - 1;
+		}
+		maxSamples = 1;
+	}
+
+	count = mpu9250LogRead(&replay->reader, replay->position, samples, maxSamples);
+	for (due = 0; due < count && samples[due].timestamp_ns <= dueNs; due++) {
+	}
+	replay->position += due;
+	return (int)due;
+}
+
+// Wait until the next sample of the replay is due (1), or timeoutMs (0)
+int mpu9250ReplayWait(MPU9250_control_t *handler, int timeoutMs)
+{
+	struct mpu9250_replay *replay = handler->_replay;
+	uint64_t dueNs = replayDueNs(replay), waitNs, timeoutNs = (uint64_t)timeoutMs * 1000000ull;
+	struct mse_sample next;
+
+	if (mpu9250LogRead(&replay->reader, replay->position, &next, 1) != 1) {
+		// nothing left, it behaves as a device that stopped acquiring
+		usleep(timeoutMs * 1000);
+		return 0;
+	}
+	if (next.timestamp_ns <= dueNs) {
+		return 1;
+	}
+	waitNs = next.timestamp_ns - dueNs;
+	if (waitNs > timeoutNs) {
+		usleep(timeoutMs * 1000);
+		return 0;
+	}
+	usleep(waitNs / 1000 + 1);
+	return 1;
+}
+
+void mpu9250ReplayClose(MPU9250_control_t *handler)
+{
+	if (handler->_replay != NULL) {
+		mpu9250LogUnmap(&handler->_replay->reader);
+		free(handler->_replay);
+		handler->_replay = NULL;
+	}
+}
@@ -0,0 +1,526 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mpu9250.h"
+
+// MPU9250 registers used to stream from the FIFO, same sequence as the driver
+#define MPU9250_SMPDIV                0x19
+#define MPU9250_FIFO_EN               0x23
+#define MPU9250_FIFO_TEMP             0x80
+#define MPU9250_FIFO_GYRO             0x70
+#define MPU9250_FIFO_ACCEL            0x08
+#define MPU9250_FIFO_MAG              0x01
+#define MPU9250_ACCEL_OUT             0x3B
+#define MPU9250_USER_CTRL             0x6A
+#define MPU9250_USER_FIFO_EN          0x40
+#define MPU9250_I2C_MST_EN            0x20
+#define MPU9250_USER_FIFO_RST         0x04
+#define MPU9250_FIFO_COUNT            0x72
+#define MPU9250_FIFO_READ             0x74
+
+// The sensor FIFO has 512 bytes, 24 whole frames
+#define MPU9250_FIFO_SIZE             512
+#define MPU9250_BURST_FRAMES          (MPU9250_FIFO_SIZE / MSE_FRAME_SIZE)
+
+// Default address of the MPU9250 (AD0 low) for /dev/i2c-N
+#define MPU9250_I2C_ADDR              0x68
+
+typedef struct {
+   MPU9250_bus_t bus;
+   unsigned short addr;
+} MPU9250_i2cDev_t;
+
+
+// Backend of a device name: /dev/i2c-N[:address], emu[:options] or else the character device
+const MPU9250_transport_t *mpu9250TransportFor(const char *device)
+{
+	if (strncmp(device, "/dev/i2c-", 9) == 0) {
+		return &mpu9250I2cDevTransport;
+	}
+	if (strncmp(device, "emu", 3) == 0 && (device[3] == '\0' || device[3] == ':')) {
+		return &mpu9250EmulatorTransport;
+	}
+	return &mpu9250CharDevTransport;
+}
+
+// Character device: every operation is one syscall served by mpu9250_driver
+
+static bool charDevOpen(MPU9250_control_t *handler, const char *device)
+{
+	handler->_fd = open(device, O_RDWR | O_NONBLOCK);
+	if (handler->_fd < 0) {
+		printf("Error opening %s\n", device);
+		return false;
+	}
+	return true;
+}
+
+static void charDevClose(MPU9250_control_t *handler)
+{
+	if (handler->_fd >= 0) {
+		close(handler->_fd);
+		handler->_fd = -1;
+	}
+}
+
+// Write the sub address and read count bytes with a repeated start, one syscall and one transfer
+static bool charDevReadRegs(MPU9250_control_t *handler, unsigned char reg, unsigned short count, unsigned char *dest)
+{
+	struct mse_reg_xfer xfer = {
+		.reg = reg,
+		.len = count,
+		.buf = (uintptr_t)dest,
+	};
+
+	return ioctl(handler->_fd, MSE_IOC_READ_REGS, &xfer) == 0;
+}
+
+// Run the whole sequence in the driver under one bus lock
+static bool charDevRunBatch(MPU9250_control_t *handler, const struct mse_reg_op *ops, unsigned int count, unsigned int *done)
+{
+	struct mse_reg_batch request = {
+		.count = count,
+		.ops = (uintptr_t)ops,
+	};
+	int ret;
+
+	ret = ioctl(handler->_fd, MSE_IOC_WRITE_BATCH, &request);
+	*done = request.done;
+	return ret == 0;
+}
+
+static bool charDevCommand(MPU9250_control_t *handler, unsigned int cmd, unsigned long arg)
+{
+	return ioctl(handler->_fd, cmd, arg) == 0;
+}
+
+static int charDevReadSamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples)
+{
+	ssize_t ret;
+
+	ret = read(handler->_fd, samples, maxSamples * sizeof(struct mse_sample));
+	if (ret < 0) {
+		return (errno == EAGAIN) ? 0 : -1;
+	}
+	return ret / sizeof(struct mse_sample);
+}
+
+static int charDevWait(MPU9250_control_t *handler, int timeoutMs)
+{
+	struct pollfd pfd = {
+		.fd = handler->_fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	ret = poll(&pfd, 1, timeoutMs);
+	if (ret < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+	return (ret > 0) ? 1 : 0;
+}
+
+static bool charDevMapRing(MPU9250_control_t *handler)
+{
+	handler->_ringBytes = sizeof(struct mse_ring) + MSE_RING_SAMPLES * sizeof(struct mse_sample);
+	handler->_ring = mmap(NULL, handler->_ringBytes, PROT_READ | PROT_WRITE, MAP_SHARED, handler->_fd, 0);
+	if (handler->_ring == MAP_FAILED) {
+		handler->_ring = NULL;
+		return false;
+	}
+	return true;
+}
+
+const MPU9250_transport_t mpu9250CharDevTransport = {
+	.name = "chardev",
+	.open = charDevOpen,
+	.close = charDevClose,
+	.readRegs = charDevReadRegs,
+	.runBatch = charDevRunBatch,
+	.command = charDevCommand,
+	.readSamples = charDevReadSamples,
+	.wait = charDevWait,
+	.mapRing = charDevMapRing,
+};
+
+// Register level backends: what mpu9250_driver does, done in the process over readRegs/writeReg
+
+void mpu9250BusInit(MPU9250_bus_t *bus, double timeScale)
+{
+	struct timespec now;
+
+	memset(bus, 0, sizeof(*bus));
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	bus->epochNs = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+	bus->timeScale = timeScale;
+	bus->periodNs = 1000000;
+}
+
+// Time of the sensor: CLOCK_MONOTONIC, or the emulator clock when it runs faster
+uint64_t mpu9250BusNow(const MPU9250_bus_t *bus)
+{
+	struct timespec now;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+	if (bus->timeScale == 1.0) {
+		return ns;
+	}
+	return bus->epochNs + (uint64_t)((ns - bus->epochNs) * bus->timeScale);
+}
+
+// Sleep an interval of sensor time
+static void busSleep(const MPU9250_bus_t *bus, uint64_t ns)
+{
+	ns = (uint64_t)(ns / bus->timeScale);
+	if (ns >= 1000) {
+		usleep(ns / 1000);
+	}
+}
+
+// Same semantics as MSE_IOC_WRITE_BATCH, without the register cache of the driver
+bool mpu9250BusRunBatch(MPU9250_control_t *handler, const struct mse_reg_op *ops, unsigned int count, unsigned int *done)
+{
+	const MPU9250_transport_t *transport = handler->_transport;
+	MPU9250_bus_t *bus = handler->_transportData;
+	unsigned int i;
+	unsigned char readback;
+
+	for (i = 0; i < count; i++) {
+		const struct mse_reg_op *op = &ops[i];
+		bool check = op->flags & (MSE_REG_OP_VERIFY | MSE_REG_OP_EXPECT);
+
+		if (op->delay_us > MSE_REG_OP_DELAY_MAX) {
+			break;
+		}
+		readback = op->val;
+		if (!(op->flags & MSE_REG_OP_EXPECT) && !transport->writeReg(handler, op->reg, op->val)) {
+			break;
+		}
+		if (check && !transport->readRegs(handler, op->reg, 1, &readback)) {
+			break;
+		}
+		if (check && ((readback ^ op->val) & op->mask)) {
+			break;
+		}
+		if (op->delay_us) {
+			busSleep(bus, (uint64_t)op->delay_us * 1000);
+		}
+	}
+	*done = i;
+	return i == count;
+}
+
+// With the DLPF enabled the internal rate is 1 kHz divided by SMPLRT_DIV + 1
+static bool busUpdatePeriod(MPU9250_control_t *handler)
+{
+	const MPU9250_transport_t *transport = handler->_transport;
+	MPU9250_bus_t *bus = handler->_transportData;
+	unsigned char div;
+
+	if (!transport->readRegs(handler, MPU9250_SMPDIV, 1, &div)) {
+		return false;
+	}
+	bus->periodNs = (uint64_t)(div + 1) * 1000000;
+	return true;
+}
+
+static bool busStreamStart(MPU9250_control_t *handler)
+{
+	const MPU9250_transport_t *transport = handler->_transport;
+	MPU9250_bus_t *bus = handler->_transportData;
+
+	if (bus->latest) {
+		errno = EBUSY;
+		return false;
+	}
+	if (bus->streaming) {
+		return true;
+	}
+	if (!busUpdatePeriod(handler)) {
+		return false;
+	}
+
+	if (!transport->writeReg(handler, MPU9250_FIFO_EN, 0) ||
+	    !transport->writeReg(handler, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN | MPU9250_USER_FIFO_RST) ||
+	    !transport->writeReg(handler, MPU9250_FIFO_EN, MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO |
+	                         MPU9250_FIFO_ACCEL | MPU9250_FIFO_MAG) ||
+	    !transport->writeReg(handler, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN | MPU9250_USER_FIFO_EN)) {
+		return false;
+	}
+	bus->streaming = true;
+	return true;
+}
+
+static bool busStreamStop(MPU9250_control_t *handler)
+{
+	const MPU9250_transport_t *transport = handler->_transport;
+	MPU9250_bus_t *bus = handler->_transportData;
+
+	bus->streaming = false;
+	return transport->writeReg(handler, MPU9250_FIFO_EN, 0) &&
+	       transport->writeReg(handler, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN);
+}
+
+// Latest value mode with the timing of the driver: a sample every periodUs (0 = sensor rate)
+static bool busLatestStart(MPU9250_control_t *handler, unsigned long periodUs)
+{
+	MPU9250_bus_t *bus = handler->_transportData;
+
+	if (bus->streaming || bus->latest) {
+		errno = EBUSY;
+		return false;
+	}
+	if (!busUpdatePeriod(handler)) {
+		return false;
+	}
+	bus->latestPeriodNs = periodUs ? (uint64_t)periodUs * 1000 : bus->periodNs;
+	bus->latestStartNs = mpu9250BusNow(bus);
+	bus->latestTick = 0;
+	memset(&bus->latestSample, 0, sizeof(bus->latestSample));
+	bus->latest = true;
+	return true;
+}
+
+// MSE_IOC_STREAM_xxx and MSE_IOC_LATEST_xxx
+bool mpu9250BusCommand(MPU9250_control_t *handler, unsigned int cmd, unsigned long arg)
+{
+	MPU9250_bus_t *bus = handler->_transportData;
+
+	switch (cmd) {
+		case MSE_IOC_STREAM_START:
+			return busStreamStart(handler);
+		case MSE_IOC_STREAM_STOP:
+			return busStreamStop(handler);
+		case MSE_IOC_LATEST_START:
+			return busLatestStart(handler, arg);
+		case MSE_IOC_LATEST_STOP:
+			bus->latest = false;
+			return true;
+	}
+	errno = ENOTTY;
+	return false;
+}
+
+// Record of one 21 byte frame (accel, temp and gyro big endian, magnetometer little endian and ST2)
+static void busBuildSample(MPU9250_bus_t *bus, const unsigned char *d, uint64_t ts, struct mse_sample *sample)
+{
+	int i;
+
+	sample->timestamp_ns = ts;
+	sample->seq = bus->seq++;
+	sample->dropped = bus->dropped;
+	for (i = 0; i < 3; i++) {
+		sample->accel[i] = (int16_t)((d[2 * i] << 8) | d[2 * i + 1]);
+		sample->gyro[i] = (int16_t)((d[8 + 2 * i] << 8) | d[9 + 2 * i]);
+		sample->mag[i] = (int16_t)((d[15 + 2 * i] << 8) | d[14 + 2 * i]);
+	}
+	sample->temp = (int16_t)((d[6] << 8) | d[7]);
+	sample->mag_st2 = d[20];
+	memset(sample->reserved, 0, sizeof(sample->reserved));
+}
+
+// Frames waiting in the sensor FIFO, or -1 (the FIFO is reset after an overflow, as in the driver)
+static int busFifoFrames(MPU9250_control_t *handler)
+{
+	const MPU9250_transport_t *transport = handler->_transport;
+	MPU9250_bus_t *bus = handler->_transportData;
+	unsigned char count[2];
+	unsigned int bytes;
+
+	if (!transport->readRegs(handler, MPU9250_FIFO_COUNT, sizeof(count), count)) {
+		return -1;
+	}
+	bytes = ((count[0] & 0x1F) << 8) | count[1];
+	if (bytes >= MPU9250_FIFO_SIZE) {
+		// the frames are no longer aligned, at least a whole FIFO is lost
+		bus->overflows++;
+		bus->seq += MPU9250_BURST_FRAMES;
+		bus->dropped += MPU9250_BURST_FRAMES;
+		if (!transport->writeReg(handler, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN |
+		                         MPU9250_USER_FIFO_EN | MPU9250_USER_FIFO_RST)) {
+			return -1;
+		}
+		return 0;
+	}
+	return bytes / MSE_FRAME_SIZE;
+}
+
+// Ticks of the latest value mode since it started, the driver acquires one sample at the end of each
+static uint64_t busLatestTick(const MPU9250_bus_t *bus, uint64_t now)
+{
+	return (now - bus->latestStartNs) / bus->latestPeriodNs;
+}
+
+// The sample of the current tick, read from the sensor only the first time it is asked for.
+// Before the first tick it is all zeros, as in the driver.
+static int busReadLatest(MPU9250_control_t *handler, struct mse_sample *sample)
+{
+	const MPU9250_transport_t *transport = handler->_transport;
+	MPU9250_bus_t *bus = handler->_transportData;
+	unsigned char frame[MSE_FRAME_SIZE];
+	uint64_t tick = busLatestTick(bus, mpu9250BusNow(bus));
+
+	if (tick != bus->latestTick) {
+		if (!transport->readRegs(handler, MPU9250_ACCEL_OUT, MSE_FRAME_SIZE, frame)) {
+			return -1;
+		}
+		// the ticks nobody read were acquired all the same
+		bus->seq += tick - bus->latestTick - 1;
+		busBuildSample(bus, frame, bus->latestStartNs + tick * bus->latestPeriodNs, &bus->latestSample);
+		bus->latestTick = tick;
+	}
+	*sample = bus->latestSample;
+	return 1;
+}
+
+int mpu9250BusReadSamples(MPU9250_control_t *handler, struct mse_sample *samples, int maxSamples)
+{
+	const MPU9250_transport_t *transport = handler->_transport;
+	MPU9250_bus_t *bus = handler->_transportData;
+	unsigned char burst[MPU9250_BURST_FRAMES * MSE_FRAME_SIZE];
+	int frames, n, i;
+	uint64_t now;
+
+	if (bus->latest) {
+		return (maxSamples < 1) ? -1 : busReadLatest(handler, &samples[0]);
+	}
+	if (!bus->streaming) {
+		return 0;
+	}
+
+	frames = busFifoFrames(handler);
+	if (frames <= 0) {
+		return frames;
+	}
+	n = (frames < maxSamples) ? frames : maxSamples;
+	if (!transport->readRegs(handler, MPU9250_FIFO_READ, n * MSE_FRAME_SIZE, burst)) {
+		return -1;
+	}
+	// the newest frame in the FIFO is the one of now, the ones before go back one period each
+	now = mpu9250BusNow(bus);
+	for (i = 0; i < n; i++) {
+		busBuildSample(bus, &burst[i * MSE_FRAME_SIZE], now - (uint64_t)(frames - 1 - i) * bus->periodNs, &samples[i]);
+	}
+	return n;
+}
+
+// There is nothing to poll() on, the FIFO is checked once per sample period. In latest value
+// mode it waits for the next tick, like poll() on the driver.
+int mpu9250BusWait(MPU9250_control_t *handler, int timeoutMs)
+{
+	MPU9250_bus_t *bus = handler->_transportData;
+	uint64_t waited = 0, timeoutNs = (uint64_t)timeoutMs * 1000000, now, next;
+	int frames;
+
+	if (bus->latest) {
+		now = mpu9250BusNow(bus);
+		if (busLatestTick(bus, now) != bus->latestTick) {
+			return 1;
+		}
+		next = bus->latestStartNs + (bus->latestTick + 1) * bus->latestPeriodNs - now;
+		if (next > timeoutNs * bus->timeScale) {
+			busSleep(bus, timeoutNs * bus->timeScale);
+			return 0;
+		}
+		busSleep(bus, next);
+		return 1;
+	}
+	for (;;) {
+		if (bus->streaming) {
+			frames = busFifoFrames(handler);
+			if (frames != 0) {
+				return (frames > 0) ? 1 : -1;
+			}
+		}
+		if (waited >= timeoutNs * bus->timeScale) {
+			return 0;
+		}
+		busSleep(bus, bus->periodNs);
+		waited += bus->periodNs;
+	}
+}
+
+// /dev/i2c-N: plain I2C_RDWR transfers to the MPU9250, no driver needed
+
+static bool i2cDevOpen(MPU9250_control_t *handler, const char *device)
+{
+	MPU9250_i2cDev_t *dev;
+	char path[32];
+	const char *colon = strchr(device, ':');
+	size_t length = colon ? (size_t)(colon - device) : strlen(device);
+
+	if (length >= sizeof(path)) {
+		return false;
+	}
+	memcpy(path, device, length);
+	path[length] = '\0';
+
+	dev = calloc(1, sizeof(*dev));
+	if (dev == NULL) {
+		return false;
+	}
+	mpu9250BusInit(&dev->bus, 1.0);
+	dev->addr = colon ? (unsigned short)strtoul(colon + 1, NULL, 0) : MPU9250_I2C_ADDR;
+
+	handler->_fd = open(path, O_RDWR);
+	if (handler->_fd < 0) {
+		printf("Error opening %s\n", path);
+		free(dev);
+		return false;
+	}
+	handler->_transportData = dev;
+	return true;
+}
+
+static void i2cDevClose(MPU9250_control_t *handler)
+{
+	charDevClose(handler);
+	free(handler->_transportData);
+	handler->_transportData = NULL;
+}
+
+static bool i2cDevReadRegs(MPU9250_control_t *handler, unsigned char reg, unsigned short count, unsigned char *dest)
+{
+	const MPU9250_i2cDev_t *dev = handler->_transportData;
+	struct i2c_msg msgs[2] = {
+		{ .addr = dev->addr, .flags = 0, .len = 1, .buf = &reg },
+		{ .addr = dev->addr, .flags = I2C_M_RD, .len = count, .buf = dest },
+	};
+	struct i2c_rdwr_ioctl_data xfer = { .msgs = msgs, .nmsgs = 2 };
+
+	return ioctl(handler->_fd, I2C_RDWR, &xfer) == 2;
+}
+
+static bool i2cDevWriteReg(MPU9250_control_t *handler, unsigned char reg, unsigned char value)
+{
+	const MPU9250_i2cDev_t *dev = handler->_transportData;
+	unsigned char buf[2] = { reg, value };
+	struct i2c_msg msg = { .addr = dev->addr, .flags = 0, .len = 2, .buf = buf };
+	struct i2c_rdwr_ioctl_data xfer = { .msgs = &msg, .nmsgs = 1 };
+
+	return ioctl(handler->_fd, I2C_RDWR, &xfer) == 1;
+}
+
+const MPU9250_transport_t mpu9250I2cDevTransport = {
+	.name = "i2c-dev",
+	.open = i2cDevOpen,
+	.close = i2cDevClose,
+	.readRegs = i2cDevReadRegs,
+	.writeReg = i2cDevWriteReg,
+	.runBatch = mpu9250BusRunBatch,
+	.command = mpu9250BusCommand,
+	.readSamples = mpu9250BusReadSamples,
+	.wait = mpu9250BusWait,
+};
@@ -1,804 +1,549 @@
+#define _GNU_SOURCE
 #include <unistd.h>
-#include <stdint.h>
-#include <stdbool.h>
 #include <stdio.h>
-#include <fcntl.h>
-
-
-// physical constants
-#define MPU9250_G                     9.807f
-#define MPU9250_D2R                   3.14159265359f/180.0f
-
-// MPU9250 registers
-#define MPU9250_ACCEL_OUT             0x3B
-#define MPU9250_GYRO_OUT              0x43
-#define MPU9250_TEMP_OUT              0x41
-#define MPU9250_EXT_SENS_DATA_00      0x49
-#define MPU9250_ACCEL_CONFIG 	      0x1C
-#define MPU9250_ACCEL_FS_SEL_2G       0x00
-#define MPU9250_ACCEL_FS_SEL_4G       0x08
-#define MPU9250_ACCEL_FS_SEL_8G       0x10
-#define MPU9250_ACCEL_FS_SEL_16G      0x18
-#define MPU9250_GYRO_CONFIG           0x1B
-#define MPU9250_GYRO_FS_SEL_250DPS    0x00
-#define MPU9250_GYRO_FS_SEL_500DPS    0x08
-#define MPU9250_GYRO_FS_SEL_1000DPS   0x10
-#define MPU9250_GYRO_FS_SEL_2000DPS   0x18
-
-#define MPU9250_ACCEL_CONFIG2         0x1D
-#define MPU9250_ACCEL_DLPF_184        0x01
-#define MPU9250_ACCEL_DLPF_92         0x02
-#define MPU9250_ACCEL_DLPF_41         0x03
-#define MPU9250_ACCEL_DLPF_20         0x04
-#define MPU9250_ACCEL_DLPF_10         0x05
-#define MPU9250_ACCEL_DLPF_5          0x06
-#define MPU9250_CONFIG                0x1A
-#define MPU9250_GYRO_DLPF_184         0x01
-#define MPU9250_GYRO_DLPF_92          0x02
-#define MPU9250_GYRO_DLPF_41          0x03
-#define MPU9250_GYRO_DLPF_20          0x04
-#define MPU9250_GYRO_DLPF_10          0x05
-#define MPU9250_GYRO_DLPF_5           0x06
-#define MPU9250_SMPDIV                0x19
-#define MPU9250_INT_PIN_CFG           0x37
-#define MPU9250_INT_ENABLE            0x38
-#define MPU9250_INT_DISABLE           0x00
-#define MPU9250_INT_PULSE_50US        0x00
-#define MPU9250_INT_WOM_EN            0x40
-#define MPU9250_INT_RAW_RDY_EN        0x01
-#define MPU9250_PWR_MGMNT_1           0x6B
-#define MPU9250_PWR_CYCLE             0x20
-#define MPU9250_PWR_RESET             0x80
-#define MPU9250_CLOCK_SEL_PLL         0x01
-#define MPU9250_PWR_MGMNT_2           0x6C
-#define MPU9250_SEN_ENABLE            0x00
-#define MPU9250_DIS_GYRO              0x07
-#define MPU9250_USER_CTRL             0x6A
-#define MPU9250_I2C_MST_EN            0x20
-#define MPU9250_I2C_MST_CLK           0x0D
-#define MPU9250_I2C_MST_CTRL          0x24
-#define MPU9250_I2C_SLV0_ADDR         0x25
-#define MPU9250_I2C_SLV0_REG          0x26
-#define MPU9250_I2C_SLV0_DO           0x63
-#define MPU9250_I2C_SLV0_CTRL         0x27
-#define MPU9250_I2C_SLV0_EN           0x80
-#define MPU9250_I2C_READ_FLAG         0x80
-#define MPU9250_MOT_DETECT_CTRL       0x69
-#define MPU9250_ACCEL_INTEL_EN        0x80
-#define MPU9250_ACCEL_INTEL_MODE      0x40
-#define MPU9250_LP_ACCEL_ODR          0x1E
-#define MPU9250_WOM_THR               0x1F
-#define MPU9250_WHO_AM_I              0x75
-#define MPU9250_FIFO_EN               0x23
-#define MPU9250_FIFO_TEMP             0x80
-#define MPU9250_FIFO_GYRO             0x70
-#define MPU9250_FIFO_ACCEL            0x08
-#define MPU9250_FIFO_MAG              0x01
-#define MPU9250_FIFO_COUNT            0x72
-#define MPU9250_FIFO_READ             0x74
-
-// AK8963 registers
-#define MPU9250_AK8963_I2C_ADDR       0x0C
-#define MPU9250_AK8963_HXL            0x03
-#define MPU9250_AK8963_CNTL1          0x0A
-#define MPU9250_AK8963_PWR_DOWN       0x00
-#define MPU9250_AK8963_CNT_MEAS1      0x12
-#define MPU9250_AK8963_CNT_MEAS2      0x16
-#define MPU9250_AK8963_FUSE_ROM       0x0F
-#define MPU9250_AK8963_CNTL2          0x0B
-#define MPU9250_AK8963_RESET          0x01
-#define MPU9250_AK8963_ASA            0x10
-#define MPU9250_AK8963_WHO_AM_I       0x00
-
-
-//Different options for basic MPU9250 setting registers
-typedef enum
-{
-   MPU9250_ACCEL_RANGE_2G,
-   MPU9250_ACCEL_RANGE_4G,
-   MPU9250_ACCEL_RANGE_8G,
-   MPU9250_ACCEL_RANGE_16G
-} MPU9250_AccelRange_t;
-
-typedef enum
-{
-   MPU9250_GYRO_RANGE_250DPS,
-   MPU9250_GYRO_RANGE_500DPS,
-   MPU9250_GYRO_RANGE_1000DPS,
-   MPU9250_GYRO_RANGE_2000DPS
-} MPU9250_GyroRange_t;
-
-typedef enum
-{
-   MPU9250_DLPF_BANDWIDTH_184HZ,
-   MPU9250_DLPF_BANDWIDTH_92HZ,
-   MPU9250_DLPF_BANDWIDTH_41HZ,
-   MPU9250_DLPF_BANDWIDTH_20HZ,
-   MPU9250_DLPF_BANDWIDTH_10HZ,
-   MPU9250_DLPF_BANDWIDTH_5HZ
-} MPU9250_DlpfBandwidth_t;
-
-typedef enum
-{
-   MPU9250_LP_ACCEL_ODR_0_24HZ  = 0,
-   MPU9250_LP_ACCEL_ODR_0_49HZ  = 1,
-   MPU9250_LP_ACCEL_ODR_0_98HZ  = 2,
-   MPU9250_LP_ACCEL_ODR_1_95HZ  = 3,
-   MPU9250_LP_ACCEL_ODR_3_91HZ  = 4,
-   MPU9250_LP_ACCEL_ODR_7_81HZ  = 5,
-   MPU9250_LP_ACCEL_ODR_15_63HZ = 6,
-   MPU9250_LP_ACCEL_ODR_31_25HZ = 7,
-   MPU9250_LP_ACCEL_ODR_62_50HZ = 8,
-   MPU9250_LP_ACCEL_ODR_125HZ   = 9,
-   MPU9250_LP_ACCEL_ODR_250HZ   = 10,
-   MPU9250_LP_ACCEL_ODR_500HZ   = 11
-} MPU9250_LpAccelOdr_t;
-
-//Control structure for MPU9250 operation (only one IMU per project)
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <libgen.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "mpu9250.h"
+
+#define SAMPLES_PER_READ 256
+#define PRINT_PERIOD_MS 1000
+#define MAX_IMUS 8
+#define CAL_DIR "/var/lib/mse"
+// blocks between the reader and the consumer, a few seconds at 1 kHz
+#define QUEUE_BLOCKS 512
+
+//Acquisition state of one IMU: a reader thread that only moves samples from the driver to the
+//queue and a consumer thread that converts, records and prints them
 typedef struct {
-   // scale factors
-   float _accelScale;
-   float _gyroScale;
-   float _magScaleX;
-   float _magScaleY;
-   float _magScaleZ;
-   float _tempScale;
-   float _tempOffset;
-
-   // configuration
-   MPU9250_AccelRange_t    _accelRange;
-   MPU9250_GyroRange_t     _gyroRange;
-   MPU9250_DlpfBandwidth_t _bandwidth;
-   unsigned char _srd;
-
-   // buffer for reading from sensor
-   unsigned char _buffer[21];
-
-   // data buffer
-   float _ax, _ay, _az;
-   float _gx, _gy, _gz;
-   float _hx, _hy, _hz;
-   float _t;
-
-   // gyro bias estimation
-   unsigned char _numSamples;
-   double _gxbD, _gybD, _gzbD;
-   float _gxb, _gyb, _gzb;
-
-   // accel bias and scale factor estimation
-   double _axbD, _aybD, _azbD;
-   float _axmax, _aymax, _azmax;
-   float _axmin, _aymin, _azmin;
-   float _axb, _ayb, _azb;
-   float _axs;
-   float _ays;
-   float _azs;
-
-   // magnetometer bias and scale factor estimation
-   unsigned short _maxCounts;
-   float _deltaThresh;
-   unsigned char _coeff;
-   unsigned short _counter;
-   float _framedelta, _delta;
-   float _hxfilt, _hyfilt, _hzfilt;
-   float _hxmax, _hymax, _hzmax;
-   float _hxmin, _hymin, _hzmin;
-   float _hxb, _hyb, _hzb;
-   float _hxs;
-   float _hys;
-   float _hzs;
-   float _avgs;
-
-   // data counts
-   short _axcounts, _aycounts, _azcounts;
-   short _gxcounts, _gycounts, _gzcounts;
-   short _hxcounts, _hycounts, _hzcounts;
-   short _tcounts;
-
-   // transformation matrix
-   /* transform the accel and gyro axes to match the magnetometer axes */
-   short tX[3];
-   short tY[3];
-   short tZ[3];
-
-   // track success of interacting with sensor
-   bool _status;
-
-} MPU9250_control_t;
-
-
-static MPU9250_control_t handler;
-int mpu9250 = 0;
-
-static bool mpu9250ReadRegisters(unsigned char subAddress, unsigned char count);
-static bool mpu9250WriteRegister(unsigned char subAddress, unsigned char data);
-static char mpu9250SetSrd(unsigned char srd);
-static char mpu9250SetDlpfBandwidth(MPU9250_DlpfBandwidth_t bandwidth);
-static bool mpu9250SetGyroRange(MPU9250_GyroRange_t range);
-static char mpu9250CalibrateGyro(void);
-static char mpu9250WhoAmIAK8963(void);
-static char mpu9250WhoAmI(void);
-static char mpu9250ReadAK8963Registers(unsigned char subAddress, unsigned char data);
-static char mpu9250WriteAK8963Register(unsigned char subAddress, unsigned char data);
-static char mpu9250InitializeControlStructure(void);
-static char mpu9250Init(void);
-static bool mpu9250Read(void);
-static float mpu9250GetGyroX_rads(void);
-static float mpu9250GetGyroY_rads(void);
-static float mpu9250GetGyroZ_rads(void);
-
-
-static bool mpu9250ReadRegisters(unsigned char subAddress, unsigned char count)
+	const char *device;
+	char calPath[128];
+	MPU9250_control_t imu;          // reader: driver I/O and metrics only
+	MPU9250_control_t conv;         // consumer: copy of imu after init for conversion and calibration, no I/O
+	bool useRing;
+	bool useLatest;
+	bool useFusion;
+	bool useRecord;
+	char logPath[128];
+	MPU9250_logWriter_t log;
+	char metricsName[64];
+	MPU9250_metrics_t *metrics;
+	MPU9250_metrics_t ownMetrics;
+	struct mse_sample samples[SAMPLES_PER_READ];
+	MPU9250_rawBlock_t raw;
+	MPU9250_block_t converted;
+	MPU9250_fusion_t fusion;
+	MPU9250_quat_t quat[SAMPLES_PER_READ];
+	MPU9250_queue_t queue;
+	MPU9250_sampleBlock_t *slot;    // block the reader is filling from the ring
+	MPU9250_sampleBlock_t scratch;  // where the reader drains the driver while the queue is full
+	pthread_t thread;
+	pthread_t consumer;
+	bool stop;
+	int status;
+} acquisition_t;
+
+static pthread_mutex_t printLock = PTHREAD_MUTEX_INITIALIZER;
+
+// reader thread options: CPU to pin it to (-1 = any) and SCHED_FIFO priority (0 = normal scheduling)
+static int readerCpu = -1;
+static int readerPriority = 0;
+
+
+static long elapsedMs(const struct timespec *start)
 {
-	
-	if (write(mpu9250, &subAddress, 1) < 0) {
-		printf("Error mpu9250ReadRegisters on writing operationp\n ");
-		return false;
-	}
-	
-	if (read(mpu9250, handler._buffer, count) < 0) {
-		printf("Error mpu9250ReadRegisters on reading operationp\n ");
-		return false;
-	}
+	struct timespec now;
 
-	return true;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
 }
 
-static bool mpu9250WriteRegister(unsigned char subAddress, unsigned char data)
+// Keep the last sample, let them check the saved calibration, record them and track the orientation
+static void processSamples(acquisition_t *acq, const struct mse_sample *samples, int count)
 {
-	unsigned char  transmitDataBuffer[2];
-
-	transmitDataBuffer[0] = subAddress;
-	transmitDataBuffer[1] = data;
+	int i;
 
-	if (write(mpu9250, transmitDataBuffer, 2)) {
-		printf("Error writing for I2C\n");
-		return false;
-	}	
-	usleep(10000);
-
-	mpu9250ReadRegisters(subAddress,1);
-	
-	/* check the read back register against the written register */
-	if(handler._buffer[0] == data) {
-      		return true;
+	//La calibracion magnetica en linea necesita todas las muestras; en el control queda la ultima
+	for (i = acq->conv._magCalEnabled ? 0 : count - 1; i < count; i++) {
+		mpu9250ProcessSample(&acq->conv, &samples[i]);
 	}
-	else{
-      		return false;
+	mpu9250CalibrationCheck(&acq->conv, samples, count);
+	if (acq->useRecord) {
+		mpu9250LogWrite(&acq->log, samples, count);
+	}
+	//Orientacion de cada muestra leida, no solo de la ultima
+	if (acq->useFusion) {
+		acq->raw.count = 0;
+		mpu9250RawBlockAppend(&acq->raw, samples, count);
+		mpu9250ConvertBlock(&acq->conv, &acq->raw, &acq->converted);
+		mpu9250FusionUpdate(&acq->fusion, &acq->converted, acq->raw.timestampNs, acq->quat);
 	}
 }
 
-static char mpu9250SetSrd(unsigned char srd)
+// Consume everything buffered on the calling thread (replay), keeping the last sample in the control structure
+static int consumeSamples(acquisition_t *acq)
 {
-	/* setting the sample rate divider to 19 to facilitate setting up 
-      magnetometer */
-   // setting the sample rate divider
-	if (!mpu9250WriteRegister(MPU9250_SMPDIV, 19)) {
-		return -1;
-	}
-	if (srd > 9) {
-		// set AK8963 to Power Down
-		if (mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN) < 0) {
-			return -2;
-		}
-		usleep(100000); // long wait between AK8963 mode changes
-		// set AK8963 to 16 bit resolution, 8 Hz update rate
-		if (mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS1) < 0) {
-			return -3;
-		}
-		usleep(100000); // long wait between AK8963 mode changes
-		// instruct the MPU9250 to get 7 bytes of data from the AK8963 at the sample rate
-		mpu9250ReadAK8963Registers(MPU9250_AK8963_HXL, 7);
-	} else {
-		// set AK8963 to Power Down
-		if (mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN) < 0) {
-			return -2;
+	int count = 0, total = 0;
+
+	do {
+		count = mpu9250ReadSamples(&acq->imu, acq->samples, SAMPLES_PER_READ);
+		if (count < 0) {
+			printf("Fail reading value of %s\n", acq->device);
+			break;
 		}
-		usleep(100000); // long wait between AK8963 mode changes
-		// set AK8963 to 16 bit resolution, 100 Hz update rate
-		if (mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS2) < 0) {
-			return -3;
+		if (count > 0) {
+			processSamples(acq, acq->samples, count);
 		}
-		usleep(100000); // long wait between AK8963 mode changes
-		// instruct the MPU9250 to get 7 bytes of data from the AK8963 at the sample rate
-		mpu9250ReadAK8963Registers(MPU9250_AK8963_HXL, 7);
-	}
-	/* setting the sample rate divider */
-	if (!mpu9250WriteRegister(MPU9250_SMPDIV, srd)) { // setting the sample rate divider
-		return -4;
-	}
-	handler._srd = srd;
-	return 1;
+		total += count;
+	} while (count == SAMPLES_PER_READ);
+
+	return total;
 }
 
-static char mpu9250SetDlpfBandwidth(MPU9250_DlpfBandwidth_t bandwidth)
+// Ring callback of the reader: copy the sample to the block being filled, publish it when full
+static void ringToQueue(MPU9250_control_t *handler, const struct mse_sample *sample)
 {
-	switch (bandwidth) {
-		case MPU9250_DLPF_BANDWIDTH_184HZ: {
-         // setting accel bandwidth to 184Hz
-			if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_184)) { 
-				return -1;
-			}
-         // setting gyro bandwidth to 184Hz
-			if (!mpu9250WriteRegister(MPU9250_CONFIG, MPU9250_GYRO_DLPF_184)) { 
-				return -2;
-			}
-			break;
-		}
-		case MPU9250_DLPF_BANDWIDTH_92HZ: {
-         // setting accel bandwidth to 92Hz
-			if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_92)) { 
-				return -1;
-			}
-         // setting gyro bandwidth to 92Hz
-			if (!mpu9250WriteRegister(MPU9250_CONFIG, MPU9250_GYRO_DLPF_92)) { 
-				return -2;
-			}
-			break;
-		}
-		case MPU9250_DLPF_BANDWIDTH_41HZ: {
-         // setting accel bandwidth to 41Hz
-			if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_41)) { 
-				return -1;
-			}
-         // setting gyro bandwidth to 41Hz
-			if (!mpu9250WriteRegister(MPU9250_CONFIG, MPU9250_GYRO_DLPF_41)) { 
-				return -2;
-			}
-			break;
-		}
-		case MPU9250_DLPF_BANDWIDTH_20HZ: {
-         // setting accel bandwidth to 20Hz
-			if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_20)) { 
-				return -1;
-			}
-         // setting gyro bandwidth to 20Hz
-			if (!mpu9250WriteRegister(MPU9250_CONFIG, MPU9250_GYRO_DLPF_20)) { 
-				return -2;
-			}
-			break;
-		}
-		case MPU9250_DLPF_BANDWIDTH_10HZ: {
-         // setting accel bandwidth to 10Hz
-			if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_10)) { 
-				return -1;
-			}
-         // setting gyro bandwidth to 10Hz
-			if (!mpu9250WriteRegister(MPU9250_CONFIG, MPU9250_GYRO_DLPF_10)) { 
-				return -2;
-			}
-			break;
-		}
-		case MPU9250_DLPF_BANDWIDTH_5HZ: {
-         // setting accel bandwidth to 5Hz
-			if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_5)) { 
-				return -1;
-			}
-         // setting gyro bandwidth to 5Hz
-			if (!mpu9250WriteRegister(MPU9250_CONFIG, MPU9250_GYRO_DLPF_5)) { 
-				return -2;
-			}
-			break;
+	acquisition_t *acq = (acquisition_t *)((char *)handler - offsetof(acquisition_t, imu));
+
+	if (acq->slot == NULL) {
+		acq->slot = mpu9250QueueReserve(&acq->queue);
+		if (acq->slot == NULL) {
+			mpu9250QueueDrop(&acq->queue, 1);
+			return;
 		}
+		acq->slot->count = 0;
+	}
+	acq->slot->samples[acq->slot->count++] = *sample;
+	if (acq->slot->count == MPU9250_QUEUE_BLOCK_SAMPLES) {
+		mpu9250QueuePublish(&acq->queue);
+		acq->slot = NULL;
 	}
-	handler._bandwidth = bandwidth;
-	return 1;
 }
 
-static bool mpu9250SetGyroRange(MPU9250_GyroRange_t range)
+// Reader: move everything the driver has to the queue, nothing else is done on this thread. When the
+// consumer falls a whole queue behind the samples are still read, so the driver keeps its pace, and dropped
+static int readIntoQueue(acquisition_t *acq)
 {
-	switch(range) {
-		case MPU9250_GYRO_RANGE_250DPS: {
-		  // setting the gyro range to 250DPS
-		  if(!mpu9250WriteRegister(MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_250DPS)){
-			return false;
-		  }
-        // setting the gyro scale to 250DPS
-		  handler._gyroScale = 250.0f/32767.5f * MPU9250_D2R; 
-		  break;
-		}
-		case MPU9250_GYRO_RANGE_500DPS: {
-		  // setting the gyro range to 500DPS
-		  if(!mpu9250WriteRegister(MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_500DPS)){
-			return false;
-		  }
-        // setting the gyro scale to 500DPS
-		  handler._gyroScale = 500.0f/32767.5f * MPU9250_D2R; 
-		  break;
+	MPU9250_sampleBlock_t *block;
+	int count, total = 0;
+
+	if (acq->useRing) {
+		total = mpu9250ConsumeRing(&acq->imu, ringToQueue);
+		if (acq->slot != NULL) {
+			mpu9250QueuePublish(&acq->queue);
+			acq->slot = NULL;
 		}
-		case MPU9250_GYRO_RANGE_1000DPS: {
-		  // setting the gyro range to 1000DPS
-		  if(!mpu9250WriteRegister(MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_1000DPS)){
-			return false;
-		  }
-        // setting the gyro scale to 1000DPS
-		  handler._gyroScale = 1000.0f/32767.5f * MPU9250_D2R; 
-		  break;
+		return total;
+	}
+	do {
+		block = mpu9250QueueReserve(&acq->queue);
+		count = mpu9250ReadSamples(&acq->imu, (block != NULL) ? block->samples : acq->scratch.samples,
+		                           acq->useLatest ? 1 : MPU9250_QUEUE_BLOCK_SAMPLES);
+		if (count < 0) {
+			printf("Fail reading value of %s\n", acq->device);
+			return -1;
 		}
-		case MPU9250_GYRO_RANGE_2000DPS: {
-		  // setting the gyro range to 2000DPS
-		  if(!mpu9250WriteRegister(MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_2000DPS)){
-			return false;
-		  }
-        // setting the gyro scale to 2000DPS
-		  handler._gyroScale = 2000.0f/32767.5f * MPU9250_D2R; 
-		  break;
+		if (count > 0 && block != NULL) {
+			block->count = count;
+			mpu9250QueuePublish(&acq->queue);
+		} else if (count > 0) {
+			mpu9250QueueDrop(&acq->queue, count);
 		}
-	}
-	handler._gyroRange = range;
-	return true;
+		total += count;
+	} while (count == MPU9250_QUEUE_BLOCK_SAMPLES);
+
+	return total;
 }
 
-static char mpu9250CalibrateGyro(void)
+static void printImu(acquisition_t *acq, int total)
 {
-	// set the range, bandwidth, and srd
-	if (!mpu9250SetGyroRange(MPU9250_GYRO_RANGE_250DPS)) {
-		return -1;
-	}
-
-	if (mpu9250SetDlpfBandwidth(MPU9250_DLPF_BANDWIDTH_20HZ) < 0) {
-		return -2;
-	}
-
-	if (mpu9250SetSrd(19) < 0) {
-		return -3;
-	}
-
-	// take samples and find bias
-	handler._gxbD = 0;
-	handler._gybD = 0;
-	handler._gzbD = 0;
-
-	for (uint8_t i=0; i < handler._numSamples; i++) {
-		mpu9250Read();
-		handler._gxbD += ((mpu9250GetGyroX_rads() + handler._gxb)/handler._numSamples);
-		handler._gybD += ((mpu9250GetGyroY_rads() + handler._gyb)/handler._numSamples);
-		handler._gzbD += ((mpu9250GetGyroZ_rads() + handler._gzb)/handler._numSamples);
-		usleep(20000);
-	}
-
-	handler._gxb = (float)handler._gxbD;
-	handler._gyb = (float)handler._gybD;
-	handler._gzb = (float)handler._gzbD;
-
-	// set the range, bandwidth, and srd back to what they were
-	if (!mpu9250SetGyroRange(handler._gyroRange)) {
-		return -4;
-	}
-
-	if (mpu9250SetDlpfBandwidth(handler._bandwidth) < 0) {
-		return -5;
-	}
-
-	if (mpu9250SetSrd(handler._srd) < 0) {
-		return -6;
-	}
-	return 1;
+	MPU9250_control_t *handler = &acq->conv;
+
+	pthread_mutex_lock(&printLock);
+	printf( "%s muestras leidas: %d (seq %u, perdidas %u)\r\n", acq->device, total, handler->_seq, handler->_dropped);
+	printf( "Giroscopo:      (%f, %f, %f)   [rad/s]\r\n", handler->_gx, handler->_gy, handler->_gz);
+	printf( "Acelerometro:   (%f, %f, %f)   [m/s2]\r\n", handler->_ax, handler->_ay, handler->_az);
+	printf( "Magnetometro:   (%f, %f, %f)   [uT]\r\n", handler->_hx, handler->_hy, handler->_hz);
+	if (acq->useFusion) {
+		printf( "Orientacion:    (%f, %f, %f, %f)\r\n", acq->fusion.q.w, acq->fusion.q.x, acq->fusion.q.y, acq->fusion.q.z);
+	}
+	printf( "Temperatura:    %f   [C]\r\n", handler->_t);
+	if (acq->metrics != NULL) {
+		MPU9250_metrics_t metrics;
+
+		mpu9250MetricsRead(acq->metrics, &metrics);
+		printf( "Lecturas:       %llu (fallos %llu), intervalo p99 %llu us, jitter p99 %llu us\r\n",
+		        (unsigned long long)metrics.sampleReads, (unsigned long long)metrics.sampleFailures,
+		        (unsigned long long)mpu9250MetricsPercentile(&metrics.intervalNs, 0.99) / 1000,
+		        (unsigned long long)mpu9250MetricsPercentile(&metrics.jitterNs, 0.99) / 1000);
+	}
+	if (acq->queue.size != 0) {
+		printf( "Cola:           %llu bloques, descartadas %llu muestras, ocupacion maxima %u/%u\r\n",
+		        (unsigned long long)__atomic_load_n(&acq->queue.published, __ATOMIC_RELAXED),
+		        (unsigned long long)__atomic_load_n(&acq->queue.droppedSamples, __ATOMIC_RELAXED),
+		        __atomic_load_n(&acq->queue.highWater, __ATOMIC_RELAXED), acq->queue.size);
+	}
+	printf("\r\n");
+	pthread_mutex_unlock(&printLock);
 }
 
-static char mpu9250WhoAmIAK8963(void)
+static void printHistogram(const char *name, const MPU9250_histogram_t *histogram)
 {
-	// read the WHO AM I register
-	if (mpu9250ReadAK8963Registers(MPU9250_AK8963_WHO_AM_I,1) < 0) {
-		return -1;
-	}
-	// return the register value
-	return handler._buffer[0];
+	printf("%s_count %llu\n%s_mean_ns %llu\n%s_p50_ns %llu\n%s_p99_ns %llu\n%s_max_ns %llu\n",
+	       name, (unsigned long long)histogram->count,
+	       name, (unsigned long long)(histogram->count ? histogram->sumNs / histogram->count : 0),
+	       name, (unsigned long long)mpu9250MetricsPercentile(histogram, 0.50),
+	       name, (unsigned long long)mpu9250MetricsPercentile(histogram, 0.99),
+	       name, (unsigned long long)histogram->maxNs);
 }
 
-static char mpu9250WhoAmI(void)
+// Lo que exporta otro proceso en /dev/shm, una linea "nombre valor" por dato para el agente de monitoreo
+static int printMetrics(const char *name)
 {
-	// read the WHO AM I register
-	if (mpu9250ReadRegisters(MPU9250_WHO_AM_I,1) < 0) {
+	MPU9250_metrics_t *shared, metrics;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/%s.metrics", name);
+	shared = mpu9250MetricsOpenShared(path);
+	if (shared == NULL) {
 		return -1;
 	}
-
-	// return the register value
-	return handler._buffer[0];
+	mpu9250MetricsRead(shared, &metrics);
+	mpu9250MetricsUnmap(shared);
+
+	printf("device %s\npid %u\n", metrics.device, metrics.pid);
+	printf("age_ms %llu\n", (unsigned long long)((mpu9250MetricsNow() - metrics.updatedNs) / 1000000));
+	printf("period_ns %llu\n", (unsigned long long)metrics.periodNs);
+	printf("register_reads %llu\nregister_failures %llu\n", (unsigned long long)metrics.registerReads,
+	       (unsigned long long)metrics.registerFailures);
+	printf("sample_reads %llu\nsample_failures %llu\nsamples %llu\nlost %llu\nseq_resets %llu\n",
+	       (unsigned long long)metrics.sampleReads, (unsigned long long)metrics.sampleFailures,
+	       (unsigned long long)metrics.samples, (unsigned long long)metrics.lost,
+	       (unsigned long long)metrics.seqResets);
+	printf("waits %llu\nwait_timeouts %llu\nwait_failures %llu\n", (unsigned long long)metrics.waits,
+	       (unsigned long long)metrics.waitTimeouts, (unsigned long long)metrics.waitFailures);
+	printHistogram("register_read", &metrics.registerReadNs);
+	printHistogram("sample_read", &metrics.sampleReadNs);
+	printHistogram("interval", &metrics.intervalNs);
+	printHistogram("jitter", &metrics.jitterNs);
+	return 0;
 }
 
-
-static char mpu9250ReadAK8963Registers(unsigned char subAddress, unsigned char data)
+// Give back everything an acquisition thread took (the blocks are zeroed when not allocated)
+static void releaseAcquisition(acquisition_t *acq)
 {
-	// set slave 0 to the AK8963 and set for read
-	if (mpu9250WriteRegister(MPU9250_I2C_SLV0_ADDR, MPU9250_AK8963_I2C_ADDR | MPU9250_I2C_READ_FLAG) < 0) {
-		return -1;
-	}
-	// set the register to the desired AK8963 sub address
-	if (mpu9250WriteRegister(MPU9250_I2C_SLV0_REG, subAddress) < 0) {
-		return -2;
+	mpu9250Close(&acq->imu);
+	if (acq->metrics != NULL && acq->metrics != &acq->ownMetrics) {
+		mpu9250MetricsRemoveShared(acq->metrics, acq->metricsName);
+	}
+	acq->metrics = NULL;
+	mpu9250RawBlockFree(&acq->raw);
+	mpu9250BlockFree(&acq->converted);
+	mpu9250QueueFree(&acq->queue);
+	if (acq->useRecord) {
+		mpu9250LogClose(&acq->log);
+		acq->useRecord = false;
 	}
-	// enable I2C and request the bytes
-	if (mpu9250WriteRegister(MPU9250_I2C_SLV0_CTRL, MPU9250_I2C_SLV0_EN | (uint8_t)1) < 0) {
-		return -3;
-	}
-	usleep(1000); // takes some time for these registers to fill
-	// read the bytes off the MPU9250 EXT_SENS_DATA registers
-	handler._status = mpu9250ReadRegisters(MPU9250_EXT_SENS_DATA_00, 1);
-	return handler._status;
 }
 
-
-static char mpu9250WriteAK8963Register(unsigned char subAddress, unsigned char data)
+// Pin the reader to readerCpu and run it SCHED_FIFO at readerPriority, when they were asked for
+static void setReaderPolicy(acquisition_t *acq)
 {
-	// set slave 0 to the AK8963 and set for write
-	if (mpu9250WriteRegister(MPU9250_I2C_SLV0_ADDR, MPU9250_AK8963_I2C_ADDR) < 0) {
-		return -1;
-	}
-	// set the register to the desired AK8963 sub address
-	if (mpu9250WriteRegister(MPU9250_I2C_SLV0_REG, subAddress) < 0) {
-		return -2;
-	}
-	// store the data for write
-	if (mpu9250WriteRegister(MPU9250_I2C_SLV0_DO, data) < 0) {
-		return -3;
-	}
-	// enable I2C and send 1 byte
-	if (mpu9250WriteRegister(MPU9250_I2C_SLV0_CTRL, MPU9250_I2C_SLV0_EN | (uint8_t)1) < 0) {
-		return -4;
-	}
-	// read the register and confirm
-	if (mpu9250ReadAK8963Registers(subAddress,1) < 0) {
-		return -5;
+	struct sched_param param = { .sched_priority = readerPriority };
+	cpu_set_t cpus;
+	int ret;
+
+	if (readerCpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(readerCpu, &cpus);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (ret != 0) {
+			printf("%s: no se pudo fijar el lector a la CPU %d (%s)\n", acq->device, readerCpu, strerror(ret));
+		}
 	}
-	if(handler._buffer[0] == data) {
-		return 1;
-	} else{
-		return -6;
+	if (readerPriority > 0) {
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (ret != 0) {
+			printf("%s: no se pudo usar SCHED_FIFO %d (%s)\n", acq->device, readerPriority, strerror(ret));
+		}
 	}
 }
 
-
-static char mpu9250InitializeControlStructure(void)
+// Consumer: everything but reading, at its own pace; a slow printf only fills the queue
+static void *consumerThread(void *arg)
 {
-	handler._tempScale = 333.87f;
-	handler._tempOffset = 21.0f;
-	handler._numSamples = 100;
-	handler._axs = 1.0f;
-	handler._ays = 1.0f;
-	handler._azs = 1.0f;
-	handler._maxCounts = 1000;
-	handler._deltaThresh = 0.3f;
-	handler._coeff = 8;
-	handler._hxs = 1.0f;
-	handler._hys = 1.0f;
-	handler._hzs = 1.0f;
-	handler.tX[0] = 0;
-	handler.tX[1] = 1;
-	handler.tX[2] = 0;
-	handler.tY[0] = 1;
-	handler.tY[1] = 0;
-	handler.tY[2] = 0;
-	handler.tZ[0] = 0;
-	handler.tZ[1] = 0;
-	handler.tZ[2] = -1;
-}
-	
-static char  mpu9250Init(void)
-{
-	mpu9250InitializeControlStructure();
-	
-	// select clock source to gyro
-	if (!mpu9250WriteRegister(MPU9250_PWR_MGMNT_1, MPU9250_CLOCK_SEL_PLL)) {
-		return -1;
-	}
-
-	// enable I2C master mode
-    if (!mpu9250WriteRegister(MPU9250_USER_CTRL, MPU9250_I2C_MST_EN)) {
-        	return -2;
+	acquisition_t *acq = arg;
+	MPU9250_control_t *handler = &acq->conv;
+	MPU9250_sampleBlock_t *block;
+	struct timespec start;
+	int index = 0, total = 0;
+	long elapsed;
+	unsigned short magCalUpdates = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (index < 5) {
+		// dormir hasta que el lector publique un bloque o toque imprimir
+		elapsed = elapsedMs(&start);
+		block = mpu9250QueueWait(&acq->queue, (elapsed < PRINT_PERIOD_MS) ? PRINT_PERIOD_MS - elapsed : 0);
+		if (block != NULL) {
+			processSamples(acq, block->samples, block->count);
+			total += block->count;
+			mpu9250QueueRelease(&acq->queue);
+		}
+		if (elapsedMs(&start) < PRINT_PERIOD_MS) {
+			continue;
+		}
+		if (handler->_magCalUpdates != magCalUpdates) {
+			magCalUpdates = handler->_magCalUpdates;
+			mpu9250CalibrationSave(handler);
+		}
+		if (handler->_calStale) {
+			// la calibracion guardada ya no sirve, se vuelve a calibrar al proximo inicio
+			printf("%s: calibracion guardada vencida\n", acq->device);
+			remove(acq->calPath);
+			handler->_calLoaded = false;
+		}
+		printImu(acq, total);
+		total = 0;
+		index++;
+		clock_gettime(CLOCK_MONOTONIC, &start);
 	}
 
-	// set the I2C bus speed to 400 kHz
-	if (!mpu9250WriteRegister(MPU9250_I2C_MST_CTRL, MPU9250_I2C_MST_CLK)) {
-		return -2;
-	}
+	__atomic_store_n(&acq->stop, true, __ATOMIC_RELEASE);
+	return NULL;
+}
 
-	// set AK8963 to Power Down
-	mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN);
-	// reset the MPU9250
-	mpu9250WriteRegister(MPU9250_PWR_MGMNT_1, MPU9250_PWR_RESET);
-	// wait for MPU-9250 to come back up
-	usleep(1000);
-	// reset the AK8963
-	mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL2, MPU9250_AK8963_RESET);
+static void *acquisitionThread(void *arg)
+{
+	acquisition_t *acq = arg;
+	MPU9250_control_t *handler = &acq->imu;
+	int status = 0;
 
-	// select clock source to gyro
-	if (!mpu9250WriteRegister(MPU9250_PWR_MGMNT_1, MPU9250_CLOCK_SEL_PLL)) {
-		return -4;
+	acq->status = -1;
+	if (!mpu9250Open(handler, acq->device)) {
+		return NULL;
 	}
 
-	// check the WHO AM I byte, expected value is 0x71 (decimal 113) or 0x73 (decimal 115)
-	if ((mpu9250WhoAmI() != 113) && (mpu9250WhoAmI() != 115)) {
-		return -5;
+	// salud de la adquisicion para el agente de monitoreo (execute metrics), o solo para printImu
+	acq->metrics = mpu9250MetricsCreateShared(acq->metricsName, acq->device);
+	if (acq->metrics == NULL) {
+		acq->metrics = &acq->ownMetrics;
+		mpu9250MetricsInit(acq->metrics, acq->device);
 	}
+	mpu9250SetMetrics(handler, acq->metrics);
 
-	// enable accelerometer and gyro
-	if (!mpu9250WriteRegister(MPU9250_PWR_MGMNT_2, MPU9250_SEN_ENABLE)) {
-		return -6;
+	mpu9250SetCalibrationFile(handler, acq->calPath);
+	status = mpu9250Init(handler);
+	usleep(10000);
+
+	if (status < 0) {
+		printf("Error on initialization of %s with error = %d\n", acq->device, status);
 	}
-	// setting accel range to 16G as default
-	if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG, MPU9250_ACCEL_FS_SEL_16G)) {
-		return -7;
+	else {
+		printf("Success initialization of %s (%s)\n", acq->device,
+		       handler->_calLoaded ? "calibracion guardada" : "calibrado");
 	}
 
-	handler._accelScale = MPU9250_G * 16.0f / 32767.5f; // setting the accel scale to 16G
-	handler._accelRange = MPU9250_ACCEL_RANGE_16G;
+	// el magnetometro se calibra en linea con las mismas muestras que se leen
+	mpu9250MagCalibrationEnable(handler, true);
 
-	// setting the gyro range to 2000DPS as default
-	if (!mpu9250WriteRegister(MPU9250_GYRO_CONFIG, MPU9250_GYRO_FS_SEL_2000DPS)) {
-		return -8;
+	if (acq->useFusion) {
+		mpu9250FusionInit(&acq->fusion, MPU9250_FUSION_MADGWICK);
+		if (!mpu9250RawBlockAlloc(&acq->raw, SAMPLES_PER_READ) ||
+		    !mpu9250BlockAlloc(&acq->converted, SAMPLES_PER_READ)) {
+			releaseAcquisition(acq);
+			return NULL;
+		}
 	}
-
-   // setting the gyro scale to 2000DPS
-	handler._gyroScale = 2000.0f / 32767.5f * MPU9250_D2R; 
-	handler._gyroRange = MPU9250_GYRO_RANGE_2000DPS;
-
-	// setting bandwidth to 184Hz as default
-	if (!mpu9250WriteRegister(MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_184)) {
-		return -9;
+	if (!mpu9250QueueAlloc(&acq->queue, QUEUE_BLOCKS)) {
+		printf("Error allocating the queue of %s\n", acq->device);
+		releaseAcquisition(acq);
+		return NULL;
 	}
 
-   // setting gyro bandwidth to 184Hz
-	if (!mpu9250WriteRegister(MPU9250_CONFIG, MPU9250_GYRO_DLPF_184)) { 
-		return -10;
+	// la captura guarda las escalas y la calibracion con las que se convierte
+	if (acq->useRecord && !mpu9250LogCreate(&acq->log, acq->logPath, handler, MPU9250_LOG_DELTA)) {
+		acq->useRecord = false;
 	}
 
-	handler._bandwidth = MPU9250_DLPF_BANDWIDTH_184HZ;
+	// el consumidor convierte y calibra con su propia copia, el lector solo usa imu para leer
+	acq->conv = acq->imu;
+	mpu9250SetMetrics(&acq->conv, NULL);
 
-	// setting the sample rate divider to 0 as default
-	if (!mpu9250WriteRegister(MPU9250_SMPDIV, 0x00)) {
-		return -11;
+	if (acq->useRing && !mpu9250MapRing(handler)) {
+		releaseAcquisition(acq);
+		return NULL;
 	}
 
-	handler._srd = 0;
-
-	// enable I2C master mode
-	if (!mpu9250WriteRegister(MPU9250_USER_CTRL, MPU9250_I2C_MST_EN)) {
-		return -12;
+	//En modo ultimo valor solo interesa la muestra mas nueva, el driver adquiere una por periodo de impresion
+	if (acq->useLatest ? !mpu9250StartLatest(handler, PRINT_PERIOD_MS * 1000) : !mpu9250StartStreaming(handler)) {
+		releaseAcquisition(acq);
+		return NULL;
 	}
 
-	// set the I2C bus speed to 400 kHz
-	if (!mpu9250WriteRegister(MPU9250_I2C_MST_CTRL, MPU9250_I2C_MST_CLK)) {
-		return -13;
+	acq->stop = false;
+	if (pthread_create(&acq->consumer, NULL, consumerThread, acq) != 0) {
+		printf("Error creating the consumer thread of %s\n", acq->device);
+		if (acq->useLatest) {
+			mpu9250StopLatest(handler);
+		} else {
+			mpu9250StopStreaming(handler);
+		}
+		releaseAcquisition(acq);
+		return NULL;
 	}
 
-	// check AK8963 WHO AM I register, expected value is 0x48 (decimal 72)
-	if (mpu9250WhoAmIAK8963() != 72) {
-		return -14;
+	// desde aca este hilo solo lee, hasta que el consumidor termina
+	setReaderPolicy(acq);
+	while (!__atomic_load_n(&acq->stop, __ATOMIC_ACQUIRE)) {
+		//Leer las muestras a medida que llegan, sin dormir a ciegas (en modo ultimo valor, cada muestra nueva)
+		if (mpu9250WaitData(handler, PRINT_PERIOD_MS / 10) > 0) {
+			readIntoQueue(acq);
+		}
 	}
+	pthread_join(acq->consumer, NULL);
 
-	/* get the magnetometer calibration */
-	// set AK8963 to Power Down
-	if (mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN) < 0) {
-		return -15;
+	if (acq->useLatest) {
+		mpu9250StopLatest(handler);
+	} else {
+		mpu9250StopStreaming(handler);
 	}
-
-	usleep(100000);
-
-	// read the AK8963 ASA registers and compute magnetometer scale factors
-	mpu9250ReadAK8963Registers(MPU9250_AK8963_ASA, 3);
-	handler._magScaleX = ((((float) handler._buffer[0]) - 128.0f) / (256.0f) + 1.0f) * 4912.0f
-			/ 32760.0f; // micro Tesla
-	handler._magScaleY = ((((float) handler._buffer[1]) - 128.0f) / (256.0f) + 1.0f) * 4912.0f
-			/ 32760.0f; // micro Tesla
-	handler._magScaleZ = ((((float) handler._buffer[2]) - 128.0f) / (256.0f) + 1.0f) * 4912.0f
-			/ 32760.0f; // micro Tesla
-
-	// set AK8963 to Power Down
-	if (mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN) < 0) {
-		return -17;
+	if (acq->useRecord) {
+		printf("%s: %llu muestras en %s\n", acq->device, (unsigned long long)acq->log.records, acq->logPath);
 	}
+	releaseAcquisition(acq);
+	acq->status = 0;
+	return NULL;
+}
 
-	usleep(100000); // long wait between AK8963 mode changes
-
-	// set AK8963 to 16 bit resolution, 100 Hz update rate
-	if (mpu9250WriteAK8963Register(MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS2) < 0) {
-		return -18;
+// Pasa una captura por el mismo camino que las muestras del driver (conversion y fusion)
+static int replayCapture(const char *path, bool realtime)
+{
+	static acquisition_t acq;
+	MPU9250_control_t *handler = &acq.imu;
+	unsigned long long total = 0;
+	uint64_t start;
+	double seconds;
+
+	acq.device = path;
+	acq.useFusion = true;
+	if (!mpu9250OpenReplay(handler, path, realtime)) {
+		return -1;
 	}
-
-	usleep(100000); // long wait between AK8963 mode changes
-
-	// select clock source to gyro
-	if (!mpu9250WriteRegister(MPU9250_PWR_MGMNT_1, MPU9250_CLOCK_SEL_PLL)) {
-		return -19;
+	mpu9250Init(handler);
+	acq.conv = acq.imu;
+	mpu9250FusionInit(&acq.fusion, MPU9250_FUSION_MADGWICK);
+	if (!mpu9250RawBlockAlloc(&acq.raw, SAMPLES_PER_READ) ||
+	    !mpu9250BlockAlloc(&acq.converted, SAMPLES_PER_READ)) {
+		releaseAcquisition(&acq);
+		return -1;
 	}
 
-	// instruct the MPU9250 to get 7 bytes of data from the AK8963 at the sample rate
-	mpu9250ReadAK8963Registers(MPU9250_AK8963_HXL, 7);
-	
-	// estimate gyro bias
-	if (mpu9250CalibrateGyro() < 0) {
-		return -20;
+	start = mpu9250MetricsNow();
+	while (!mpu9250ReplayEnd(handler)) {
+		if (mpu9250WaitData(handler, PRINT_PERIOD_MS / 10) > 0) {
+			total += consumeSamples(&acq);
+		}
 	}
+	// en ns: una captura corta se reproduce en menos de un milisegundo
+	seconds = (mpu9250MetricsNow() - start) / 1e9;
 
-	return true;
-}
-
-// Funciones para obtener los datos.
-
-//Read sensor registers and store data at control structure
-static bool mpu9250Read(void)
-{
-	// grab the data from the MPU9250
-	if(!mpu9250ReadRegisters(MPU9250_ACCEL_OUT, 21)) {
-		return false;
-	}
-	// combine into 16 bit values
-	handler._axcounts = (((int16_t)handler._buffer[0]) << 8)  | handler._buffer[1];
-	handler._aycounts = (((int16_t)handler._buffer[2]) << 8)  | handler._buffer[3];
-	handler._azcounts = (((int16_t)handler._buffer[4]) << 8)  | handler._buffer[5];
-	handler._tcounts  = (((int16_t)handler._buffer[6]) << 8)  | handler._buffer[7];
-	handler._gxcounts = (((int16_t)handler._buffer[8]) << 8)  | handler._buffer[9];
-	handler._gycounts = (((int16_t)handler._buffer[10]) << 8) | handler._buffer[11];
-	handler._gzcounts = (((int16_t)handler._buffer[12]) << 8) | handler._buffer[13];
-	handler._hxcounts = (((int16_t)handler._buffer[15]) << 8) | handler._buffer[14];
-	handler._hycounts = (((int16_t)handler._buffer[17]) << 8) | handler._buffer[16];
-	handler._hzcounts = (((int16_t)handler._buffer[19]) << 8) | handler._buffer[18];
-	// transform and convert to float values
-	handler._ax = (((float)(handler.tX[0]*handler._axcounts + handler.tX[1]*handler._aycounts + handler.tX[2]*handler._azcounts) * handler._accelScale) - handler._axb)*handler._axs;
-	handler._ay = (((float)(handler.tY[0]*handler._axcounts + handler.tY[1]*handler._aycounts + handler.tY[2]*handler._azcounts) * handler._accelScale) - handler._ayb)*handler._ays;
-	handler._az = (((float)(handler.tZ[0]*handler._axcounts + handler.tZ[1]*handler._aycounts + handler.tZ[2]*handler._azcounts) * handler._accelScale) - handler._azb)*handler._azs;
-	handler._gx = ((float) (handler.tX[0]*handler._gxcounts + handler.tX[1]*handler._gycounts + handler.tX[2]*handler._gzcounts) * handler._gyroScale) -  handler._gxb;
-	handler._gy = ((float) (handler.tY[0]*handler._gxcounts + handler.tY[1]*handler._gycounts + handler.tY[2]*handler._gzcounts) * handler._gyroScale) -  handler._gyb;
-	handler._gz = ((float) (handler.tZ[0]*handler._gxcounts + handler.tZ[1]*handler._gycounts + handler.tZ[2]*handler._gzcounts) * handler._gyroScale) -  handler._gzb;
-	handler._hx = (((float)(handler._hxcounts) * handler._magScaleX) - handler._hxb)*handler._hxs;
-	handler._hy = (((float)(handler._hycounts) * handler._magScaleY) - handler._hyb)*handler._hys;
-	handler._hz = (((float)(handler._hzcounts) * handler._magScaleZ) - handler._hzb)*handler._hzs;
-	handler._t = ((((float) handler._tcounts)  - handler._tempOffset)/ handler._tempScale) + handler._tempOffset;
-	
-	return true;
+	printImu(&acq, (int)total);
+	printf("%s: %llu muestras en %.3f s, %.0f muestras/s\n", path, total, seconds,
+	       (seconds > 0) ? total / seconds : 0.0);
+	releaseAcquisition(&acq);
+	return 0;
 }
 
-// Returns the gyroscope measurement in the x direction, rad/s
-static float mpu9250GetGyroX_rads(void)
+// Usage: execute [-c cpu] [-r priority] [stream|mmap|latest|fusion|record] [device ...], by default /dev/mse00
+// each IMU has a reader thread that only takes samples from the driver, pinned to cpu with -c and
+// SCHED_FIFO at priority with -r (needs CAP_SYS_NICE), and a consumer thread for the rest
+// device is /dev/mseXX (driver), /dev/i2c-N[:address] (no driver) or emu[:noise=1,speed=1,seed=1]
+// (emulated IMU, speed > 1 runs the sensor clock faster); mmap only works with /dev/mseXX
+// record leaves every sample of /dev/mseXX in mseXX.mlog
+// execute replay mseXX.mlog [realtime] plays a capture back, as fast as possible or at the recorded rate
+// while running, every IMU exports its acquisition health in /dev/shm/mseXX.metrics;
+// execute metrics [mseXX ...] prints it from another process
+int main(int argc, char *argv[])
 {
-	return handler._gx;
-}
+	static acquisition_t imus[MAX_IMUS];
+	const char *program = argv[0], *mode;
+	int count = 0, i, status = 0, opt;
+
+	while ((opt = getopt(argc, argv, "+c:r:")) != -1) {
+		if (opt == 'c') {
+			readerCpu = atoi(optarg);
+		} else if (opt == 'r') {
+			readerPriority = atoi(optarg);
+		} else {
+			printf("Usage: %s [-c cpu] [-r priority] [mode] [device ...]\n", program);
+			return -1;
+		}
+	}
+	// the mode and the devices follow as if there were no options
+	argc -= optind - 1;
+	argv += optind - 1;
+	mode = (argc > 1) ? argv[1] : "stream";
 
-// Returns the gyroscope measurement in the y direction, rad/s
-static float mpu9250GetGyroY_rads(void)
-{
-	return handler._gy;
-}
+	// sin fallos de pagina en el lector de tiempo real
+	if (readerPriority > 0 && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		perror("mlockall");
+	}
 
-// Returns the gyroscope measurement in the z direction, rad/s
-static float mpu9250GetGyroZ_rads(void)
-{
-	return handler._gz;
-}
+	if (strcmp(mode, "replay") == 0) {
+		if (argc < 3) {
+			printf("Usage: %s replay mseXX.mlog [realtime]\n", program);
+			return -1;
+		}
+		return replayCapture(argv[2], argc > 3 && strcmp(argv[3], "realtime") == 0);
+	}
+	if (strcmp(mode, "metrics") == 0) {
+		for (i = 2; i < argc; i++) {
+			status |= printMetrics(argv[i]);
+		}
+		return (argc > 2) ? status : printMetrics("mse00");
+	}
 
-int main(void)
-{
-	int status = 0, index = 0;
-	mpu9250 = open("/dev/mse00", O_RDWR);
+	for (i = 2; i < argc && count < MAX_IMUS; i++) {
+		imus[count++].device = argv[i];
+	}
+	if (count == 0) {
+		imus[count++].device = "/dev/mse00";
+	}
 
-	status = mpu9250Init();
-	usleep(10000);
+	for (i = 0; i < count; i++) {
+		char name[64];
 
-	if (status < 0) {
-		printf("Error on initialization of mpu9250 with error = %d", status);
-	}
-	else {
-		printf("Success initialization\n");
+		// one calibration cache per IMU, /var/lib/mse/mse00.cal
+		snprintf(name, sizeof(name), "%s", imus[i].device);
+		snprintf(imus[i].calPath, sizeof(imus[i].calPath), "%s/%s.cal", CAL_DIR, basename(name));
+		snprintf(imus[i].logPath, sizeof(imus[i].logPath), "%s.mlog", basename(name));
+		snprintf(imus[i].metricsName, sizeof(imus[i].metricsName), "/%s.metrics", basename(name));
+		imus[i].useRing = (strcmp(mode, "mmap") == 0);
+		imus[i].useLatest = (strcmp(mode, "latest") == 0);
+		imus[i].useFusion = (strcmp(mode, "fusion") == 0);
+		imus[i].useRecord = (strcmp(mode, "record") == 0);
+		if (pthread_create(&imus[i].thread, NULL, acquisitionThread, &imus[i]) != 0) {
+			printf("Error creating the thread of %s\n", imus[i].device);
+			imus[i].status = -1;
+			imus[i].device = NULL;
+		}
 	}
 
-	while(index < 5){
-		//Leer el sensor y guardar en estructura de control
-		if (!mpu9250Read()) {
-			printf("Fail reading value of MPU9250");
+	for (i = 0; i < count; i++) {
+		if (imus[i].device != NULL) {
+			pthread_join(imus[i].thread, NULL);
 		}
-		usleep(10000);
-      		// Imprimir resultados
-      		printf( "Giroscopo:      (%f, %f, %f)   [rad/s]\r\n", handler._gx, handler._gy, handler._gz);
-		usleep(10000);
-		printf( "Acelerometro:   (%f, %f, %f)   [m/s2]\r\n", handler._ax, handler._ay, handler._az);
-		usleep(10000);
-		printf( "Magnetometro:   (%f, %f, %f)   [uT]\r\n", handler._hx, handler._hy, handler._hz);
-		usleep(10000);
-		printf( "Temperatura:    %f   [C]\r\n\r\n", handler._t);
-		sleep(1);
-		index++;
-   	}
-	
-	close(mpu9250);
+		if (imus[i].status < 0) {
+			status = -1;
+		}
+	}
+
+	return status;
 }